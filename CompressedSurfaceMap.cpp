@@ -0,0 +1,297 @@
+#include "CompressedSurfaceMap.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+#include "ParallelFor.h"
+
+static const char kMagic[4] = {'S', 'P', 'L', 'Q'};
+
+static void writeVarint(std::vector<uint8_t>& out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+// Returns false when the varint runs past end or does not fit 64 bits.
+static bool readVarint(const uint8_t*& in, const uint8_t* end, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && in < end; shift += 7) {
+        uint8_t byte = *in++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Planar prediction from the already coded neighbours, restricted to the tile so tiles decode independently. Computed
+// modulo 2^64, like the errors added to it, so that any coded data decodes without signed overflow; maps the encoder
+// produces never wrap.
+static uint64_t predict(const int64_t* plane, int x, int y, int w)
+{
+    if (x > 0 && y > 0) {
+        return (uint64_t)plane[y * w + x - 1] + (uint64_t)plane[(y - 1) * w + x] - (uint64_t)plane[(y - 1) * w + x - 1];
+    }
+    if (x > 0) {
+        return plane[x - 1];
+    }
+    if (y > 0) {
+        return plane[(y - 1) * w];
+    }
+    return 0;
+}
+
+// Codes the prediction errors of one plane. A token with the low bit clear holds a zigzag coded nonzero error, a
+// token with the low bit set holds the length of a run of zero errors.
+static void encodePlane(const int64_t* plane, int w, int h, std::vector<uint8_t>& out)
+{
+    uint64_t zeros = 0;
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            uint64_t error = (uint64_t)plane[y * w + x] - predict(plane, x, y, w);
+            if (error == 0) {
+                zeros++;
+                continue;
+            }
+            if (zeros > 0) {
+                writeVarint(out, (zeros << 1) | 1);
+                zeros = 0;
+            }
+            uint64_t zigzag = (error << 1) ^ (0 - (error >> 63));
+            writeVarint(out, zigzag << 1);
+        }
+    }
+    if (zeros > 0) {
+        writeVarint(out, (zeros << 1) | 1);
+    }
+}
+
+static bool decodePlane(const uint8_t*& in, const uint8_t* end, int w, int h, int64_t* plane)
+{
+    uint64_t zeros = 0;
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            uint64_t error = 0;
+            if (zeros > 0) {
+                zeros--;
+            } else {
+                uint64_t token;
+                if (!readVarint(in, end, token) || token == 1) {
+                    return false;
+                }
+                if (token & 1) {
+                    zeros = (token >> 1) - 1;
+                } else {
+                    uint64_t zigzag = token >> 1;
+                    error = (zigzag >> 1) ^ (0 - (zigzag & 1));
+                }
+            }
+            plane[y * w + x] = (int64_t)(predict(plane, x, y, w) + error);
+        }
+    }
+    return zeros == 0;
+}
+
+CompressedSurfaceMap::CompressedSurfaceMap() : _width(0), _height(0), _tileSize(1), _step(1) {}
+
+static void sampleBuffer(void* context, int x0, int y0, int w, int h, double* out, size_t rowStride)
+{
+    const std::pair<const double*, int>& buffer = *static_cast<std::pair<const double*, int>*>(context);
+    for (int y = 0; y < h; ++y) {
+        const double* row = buffer.first + ((size_t)(y0 + y) * buffer.second + x0) * 2;
+        std::copy(row, row + 2 * w, out + y * rowStride);
+    }
+}
+
+static void sampleGrid(void* context, int x0, int y0, int w, int h, double* out, size_t rowStride)
+{
+    static_cast<ParametricSurfaceGrid*>(context)->generateSurfaceTile(x0, y0, w, h, out, rowStride);
+}
+
+CompressedSurfaceMap CompressedSurfaceMap::encode(const double* points, int width, int height, const vec2d& origin,
+                                                  const CompressedSurfaceMapOptions& options)
+{
+    std::pair<const double*, int> buffer(points, width);
+    return encode(width, height, origin, options, sampleBuffer, &buffer);
+}
+
+CompressedSurfaceMap CompressedSurfaceMap::encode(ParametricSurfaceGrid& grid,
+                                                 const CompressedSurfaceMapOptions& options)
+{
+    return encode(grid.pixelWidth(), grid.pixelHeight(), grid.pixelOrigin(), options, sampleGrid, &grid);
+}
+
+CompressedSurfaceMap CompressedSurfaceMap::encode(int width, int height, const vec2d& origin,
+                                                  const CompressedSurfaceMapOptions& options, SampleFunction sample,
+                                                  void* context)
+{
+    CompressedSurfaceMap map;
+    if (!(options.quantizationStep > 0) || !std::isfinite(options.quantizationStep) || width < 0 || height < 0) {
+        return map;
+    }
+    map._width = width;
+    map._height = height;
+    map._tileSize = std::max(1, options.tileSize);
+    map._step = options.quantizationStep;
+    map._origin = origin;
+
+    int tileSize = map._tileSize;
+    int numTiles = map.tilesX() * map.tilesY();
+    std::vector<std::vector<uint8_t>> tiles(numTiles);
+    parallelFor(numTiles, options.numThreads, [&](int index) {
+        int x0 = (index % map.tilesX()) * tileSize;
+        int y0 = (index / map.tilesX()) * tileSize;
+        int w = std::min(tileSize, width - x0);
+        int h = std::min(tileSize, height - y0);
+        std::vector<double> samples((size_t)w * h * 2);
+        sample(context, x0, y0, w, h, samples.data(), (size_t)w * 2);
+        std::vector<int64_t> plane((size_t)w * h);
+        for (int channel = 0; channel < 2; ++channel) {
+            double base = channel == 0 ? origin.x + x0 : origin.y + y0;
+            for (int y = 0; y < h; ++y) {
+                for (int x = 0; x < w; ++x) {
+                    double identity = base + (channel == 0 ? x : y);
+                    plane[y * w + x] = std::llround((samples[2 * (y * w + x) + channel] - identity) / map._step);
+                }
+            }
+            encodePlane(plane.data(), w, h, tiles[index]);
+        }
+    });
+
+    map._tileOffsets.resize(numTiles + 1);
+    size_t size = 0;
+    for (int i = 0; i < numTiles; ++i) {
+        map._tileOffsets[i] = size;
+        size += tiles[i].size();
+    }
+    map._tileOffsets[numTiles] = size;
+    map._data.reserve(size);
+    for (int i = 0; i < numTiles; ++i) {
+        map._data.insert(map._data.end(), tiles[i].begin(), tiles[i].end());
+    }
+    return map;
+}
+
+bool CompressedSurfaceMap::decodeTile(int tileX, int tileY, double* out, size_t rowStride) const
+{
+    int x0 = tileX * _tileSize;
+    int y0 = tileY * _tileSize;
+    int w = std::min(_tileSize, _width - x0);
+    int h = std::min(_tileSize, _height - y0);
+    int index = tileY * tilesX() + tileX;
+    const uint8_t* in = _data.data() + _tileOffsets[index];
+    const uint8_t* end = _data.data() + _tileOffsets[index + 1];
+    std::vector<int64_t> plane((size_t)w * h);
+    for (int channel = 0; channel < 2; ++channel) {
+        if (!decodePlane(in, end, w, h, plane.data())) {
+            return false;
+        }
+        double base = channel == 0 ? _origin.x + x0 : _origin.y + y0;
+        for (int y = 0; y < h; ++y) {
+            double* row = out + y * rowStride;
+            for (int x = 0; x < w; ++x) {
+                double identity = base + (channel == 0 ? x : y);
+                row[2 * x + channel] = identity + plane[y * w + x] * _step;
+            }
+        }
+    }
+    return in == end;
+}
+
+bool CompressedSurfaceMap::decode(std::vector<double>& points, int numThreads) const
+{
+    points.resize((size_t)_width * _height * 2);
+    std::atomic<bool> failed(false);
+    parallelFor(tilesX() * tilesY(), numThreads, [&](int index) {
+        int tileX = index % tilesX();
+        int tileY = index / tilesX();
+        size_t offset = ((size_t)tileY * _tileSize * _width + (size_t)tileX * _tileSize) * 2;
+        if (!decodeTile(tileX, tileY, points.data() + offset, (size_t)_width * 2)) {
+            failed = true;
+        }
+    });
+    return !failed;
+}
+
+struct CompressedSurfaceMapHeader {
+    char magic[4];
+    int32_t width;
+    int32_t height;
+    int32_t tileSize;
+    double step;
+    double originX;
+    double originY;
+};
+
+std::vector<uint8_t> CompressedSurfaceMap::serialize() const
+{
+    CompressedSurfaceMapHeader header;
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.width = _width;
+    header.height = _height;
+    header.tileSize = _tileSize;
+    header.step = _step;
+    header.originX = _origin.x;
+    header.originY = _origin.y;
+
+    size_t indexBytes = _tileOffsets.size() * sizeof(uint64_t);
+    std::vector<uint8_t> bytes(sizeof(header) + indexBytes + _data.size());
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    std::memcpy(bytes.data() + sizeof(header), _tileOffsets.data(), indexBytes);
+    std::copy(_data.begin(), _data.end(), bytes.begin() + sizeof(header) + indexBytes);
+    return bytes;
+}
+
+bool CompressedSurfaceMap::deserialize(const uint8_t* bytes, size_t size, CompressedSurfaceMap& map)
+{
+    CompressedSurfaceMapHeader header;
+    CompressedSurfaceMap result;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, bytes, sizeof(header));
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.width < 0 || header.height < 0 ||
+        header.tileSize <= 0 || !(header.step > 0) || !std::isfinite(header.step)) {
+        return false;
+    }
+    // tilesX() and tilesY() round up in int, and the tile count must fit the index that follows the header
+    size_t tilesX = ((size_t)header.width + header.tileSize - 1) / header.tileSize;
+    size_t tilesY = ((size_t)header.height + header.tileSize - 1) / header.tileSize;
+    size_t maxTiles = (size - sizeof(header)) / sizeof(uint64_t);
+    if (header.width > INT32_MAX - header.tileSize || header.height > INT32_MAX - header.tileSize ||
+        (tilesY > 0 && tilesX > maxTiles / tilesY) || tilesX * tilesY >= maxTiles) {
+        return false;
+    }
+    result._width = header.width;
+    result._height = header.height;
+    result._tileSize = header.tileSize;
+    result._step = header.step;
+    result._origin = vec2d(header.originX, header.originY);
+    size_t numTiles = (size_t)result.tilesX() * result.tilesY();
+    size_t indexBytes = (numTiles + 1) * sizeof(uint64_t);
+    if (size < sizeof(header) + indexBytes) {
+        return false;
+    }
+    result._tileOffsets.resize(numTiles + 1);
+    std::memcpy(result._tileOffsets.data(), bytes + sizeof(header), indexBytes);
+    // decodeTile() reads tile i between offsets i and i + 1, so they must ascend from 0 to the end of the data
+    if (result._tileOffsets[0] != 0 || result._tileOffsets[numTiles] != size - sizeof(header) - indexBytes) {
+        return false;
+    }
+    for (size_t i = 0; i < numTiles; ++i) {
+        if (result._tileOffsets[i] > result._tileOffsets[i + 1]) {
+            return false;
+        }
+    }
+    result._data.assign(bytes + sizeof(header) + indexBytes, bytes + size);
+    map = std::move(result);
+    return true;
+}
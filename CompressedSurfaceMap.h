@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ParametricSurfaceGrid.h"
+#include "vec2.h"
+
+struct CompressedSurfaceMapOptions {
+    // residuals are rounded to multiples of this step, in pixels, so the decoded map is within step / 2 of the input
+    double quantizationStep = 1.0 / 256;
+    // tiles are the unit of random access, each one is coded independently
+    int tileSize = 64;
+    // 0 means one thread per hardware thread
+    int numThreads = 0;
+};
+
+// Compact representation of a sample map as generated by generateSurfacePoints(). Each sample is stored as its
+// quantized offset from the identity map the grid starts from, (x, y) + pixelOrigin(). Within a tile, offsets are
+// predicted from their left, top and top-left neighbours and only the prediction error is written, as variable length
+// integers with run length coded zeros. Smooth maps mostly code to a single byte per channel, and untouched areas to
+// almost nothing.
+class CompressedSurfaceMap {
+public:
+    CompressedSurfaceMap();
+
+    // Encodes a width x height map in the x,y interleaved layout of generateSurfacePoints(). Returns an empty map when
+    // options.quantizationStep is not positive.
+    static CompressedSurfaceMap encode(const double* points, int width, int height, const vec2d& origin,
+                                       const CompressedSurfaceMapOptions& options = CompressedSurfaceMapOptions());
+    // Encodes the sample map of grid tile by tile, without generating the whole map first.
+    static CompressedSurfaceMap encode(ParametricSurfaceGrid& grid,
+                                       const CompressedSurfaceMapOptions& options = CompressedSurfaceMapOptions());
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+    int tileSize() const { return _tileSize; }
+    int tilesX() const { return (_width + _tileSize - 1) / _tileSize; }
+    int tilesY() const { return (_height + _tileSize - 1) / _tileSize; }
+    double quantizationStep() const { return _step; }
+    // bytes of coded data, without the tile index
+    size_t compressedSize() const { return _data.size(); }
+
+    // Decodes one tile into out, in the layout of generateSurfacePoints(). rowStride is in doubles. Returns false when
+    // the coded tile is corrupt, leaving out partially written.
+    bool decodeTile(int tileX, int tileY, double* out, size_t rowStride) const;
+    // Decodes the whole map, in parallel across tiles. Returns false when any tile is corrupt.
+    bool decode(std::vector<double>& points, int numThreads = 0) const;
+
+    // Flat byte representation, to store the map or send it to another process.
+    std::vector<uint8_t> serialize() const;
+    // Checks the header and tile index against size and leaves map unchanged when they do not match. Tile data is only
+    // checked as it is decoded.
+    static bool deserialize(const uint8_t* bytes, size_t size, CompressedSurfaceMap& map);
+
+private:
+    typedef void (*SampleFunction)(void* context, int x0, int y0, int w, int h, double* out, size_t rowStride);
+    static CompressedSurfaceMap encode(int width, int height, const vec2d& origin,
+                                       const CompressedSurfaceMapOptions& options, SampleFunction sample,
+                                       void* context);
+
+private:
+    int _width;
+    int _height;
+    int _tileSize;
+    double _step;
+    vec2d _origin;
+    // _tileOffsets[i] is where tile i starts in _data, with one extra entry for the end of the last tile
+    std::vector<uint64_t> _tileOffsets;
+    std::vector<uint8_t> _data;
+};
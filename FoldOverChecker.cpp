@@ -0,0 +1,204 @@
+#include "FoldOverChecker.h"
+
+#include <algorithm>
+
+#include "ParallelFor.h"
+
+namespace {
+
+struct Interval {
+    double lo, hi;
+
+    Interval(double lo, double hi) : lo(lo), hi(hi) {}
+    Interval operator+(const Interval& o) const { return Interval(lo + o.lo, hi + o.hi); }
+    Interval operator-(const Interval& o) const { return Interval(lo - o.hi, hi - o.lo); }
+    Interval operator*(const Interval& o) const
+    {
+        double p[4] = {lo * o.lo, lo * o.hi, hi * o.lo, hi * o.hi};
+        return Interval(*std::min_element(p, p + 4), *std::max_element(p, p + 4));
+    }
+    Interval operator*(double s) const { return s >= 0 ? Interval(lo * s, hi * s) : Interval(hi * s, lo * s); }
+};
+
+// Spline arguments over a cell: a + t * d for t in [t0, t1]
+Interval span(double a, double d, double t0, double t1)
+{
+    double p = a + t0 * d;
+    double q = a + t1 * d;
+    return Interval(std::min(p, q), std::max(p, q));
+}
+
+Interval values(const tk::spline& spline, const Interval& x)
+{
+    Interval range(0, 0);
+    spline.value_range(x.lo, x.hi, range.lo, range.hi);
+    return range;
+}
+
+Interval slopes(const tk::spline& spline, const Interval& x)
+{
+    Interval range(0, 0);
+    spline.deriv_range(x.lo, x.hi, range.lo, range.hi);
+    return range;
+}
+
+// The four boundary splines and corners of a patch, in the notation of the class comment.
+struct Patch {
+    const tk::spline* col0;
+    const tk::spline* col1;
+    const tk::spline* row0;
+    const tk::spline* row1;
+    vec2d c00, c10, c01, c11;
+    // determinant of the pixel to (u, v) map, to express Jacobians per output pixel
+    double pixelScale;
+
+    // x(u, v) = (1 - u) * col0(c00.y + v * dy0) + u * col1(c10.y + v * dy1), likewise for y
+    double dy0() const { return c01.y - c00.y; }
+    double dy1() const { return c11.y - c10.y; }
+    double dx0() const { return c10.x - c00.x; }
+    double dx1() const { return c11.x - c01.x; }
+
+    double jacobian(double u, double v) const
+    {
+        double y0 = c00.y + v * dy0(), y1 = c10.y + v * dy1();
+        double x0 = c00.x + u * dx0(), x1 = c01.x + u * dx1();
+        double xu = (*col1)(y1) - (*col0)(y0);
+        double xv = (1 - u) * col0->deriv(1, y0) * dy0() + u * col1->deriv(1, y1) * dy1();
+        double yu = (1 - v) * row0->deriv(1, x0) * dx0() + v * row1->deriv(1, x1) * dx1();
+        double yv = (*row1)(x1) - (*row0)(x0);
+        return (xu * yv - xv * yu) * pixelScale;
+    }
+
+    double jacobianLowerBound(double u0, double u1, double v0, double v1) const
+    {
+        Interval y0 = span(c00.y, dy0(), v0, v1), y1 = span(c10.y, dy1(), v0, v1);
+        Interval x0 = span(c00.x, dx0(), u0, u1), x1 = span(c01.x, dx1(), u0, u1);
+        Interval xu = values(*col1, y1) - values(*col0, y0);
+        Interval xv = Interval(1 - u1, 1 - u0) * (slopes(*col0, y0) * dy0()) +
+                      Interval(u0, u1) * (slopes(*col1, y1) * dy1());
+        Interval yu = Interval(1 - v1, 1 - v0) * (slopes(*row0, x0) * dx0()) +
+                      Interval(v0, v1) * (slopes(*row1, x1) * dx1());
+        Interval yv = values(*row1, x1) - values(*row0, x0);
+        return ((xu * yv) - (xv * yu)).lo * pixelScale;
+    }
+};
+
+} // namespace
+
+FoldOverChecker::FoldOverChecker(ParametricSurfaceGrid& grid, double threshold, int maxDepth)
+    : _grid(grid), _threshold(threshold), _maxDepth(std::max(0, maxDepth)), _patchesX(0), _patchesY(0), _revision(0),
+      _numPatchesChecked(0)
+{
+}
+
+bool FoldOverChecker::checkPatch(ParametricSurfaceGrid& grid, int row, int col, double threshold, int maxDepth,
+                                 double& minJacobian)
+{
+    Patch patch;
+    patch.col0 = &grid.colSpline(col);
+    patch.col1 = &grid.colSpline(col + 1);
+    patch.row0 = &grid.rowSpline(row);
+    patch.row1 = &grid.rowSpline(row + 1);
+    patch.c00 = grid.controlPointPosition(row, col);
+    patch.c10 = grid.controlPointPosition(row, col + 1);
+    patch.c01 = grid.controlPointPosition(row + 1, col);
+    patch.c11 = grid.controlPointPosition(row + 1, col + 1);
+    // the last patch of an axis is narrower when the resolution does not divide the size
+    double resX = grid.gridResolutionX(), resY = grid.gridResolutionY();
+    double patchWidth = std::min(resX, grid.pixelWidth() - col * resX);
+    double patchHeight = std::min(resY, grid.pixelHeight() - row * resY);
+    patch.pixelScale = 1 / (patchWidth * patchHeight);
+
+    struct Cell {
+        double u0, u1, v0, v1;
+        int depth;
+    };
+    std::vector<Cell> stack(1, Cell{0, 1, 0, 1, 0});
+    minJacobian = patch.jacobian(0.5, 0.5);
+    bool valid = true;
+    while (!stack.empty()) {
+        Cell cell = stack.back();
+        stack.pop_back();
+        if (patch.jacobianLowerBound(cell.u0, cell.u1, cell.v0, cell.v1) > threshold) {
+            continue;
+        }
+        double um = (cell.u0 + cell.u1) / 2, vm = (cell.v0 + cell.v1) / 2;
+        minJacobian = std::min(minJacobian, patch.jacobian(um, vm));
+        if (minJacobian <= threshold) {
+            return false;
+        }
+        if (cell.depth == maxDepth) {
+            // inconclusive, keep looking for a proof of a fold-over in the other cells
+            valid = false;
+            continue;
+        }
+        stack.push_back(Cell{cell.u0, um, cell.v0, vm, cell.depth + 1});
+        stack.push_back(Cell{um, cell.u1, cell.v0, vm, cell.depth + 1});
+        stack.push_back(Cell{cell.u0, um, vm, cell.v1, cell.depth + 1});
+        stack.push_back(Cell{um, cell.u1, vm, cell.v1, cell.depth + 1});
+    }
+    return valid;
+}
+
+void FoldOverChecker::reset()
+{
+    _patchesX = _grid.numControlPointsX() - 1;
+    _patchesY = _grid.numControlPointsY() - 1;
+    _valid.assign(_patchesX * _patchesY, 0);
+    _minJacobian.assign(_patchesX * _patchesY, 0);
+}
+
+const std::vector<FoldOver>& FoldOverChecker::check(int numThreads)
+{
+    std::vector<int> dirty;
+    if (_revision == 0 || _grid.layoutRevision() > _revision || _grid.numControlPointsX() - 1 != _patchesX ||
+        _grid.numControlPointsY() - 1 != _patchesY) {
+        reset();
+        dirty.resize(_patchesX * _patchesY);
+        for (int i = 0; i < (int)dirty.size(); ++i) {
+            dirty[i] = i;
+        }
+    } else if (_grid.revision() > _revision) {
+        // a changed row spline bounds the patch rows above and below it, a column spline the patch columns beside it
+        std::vector<char> rows(_patchesY, 0), cols(_patchesX, 0);
+        for (int row = 0; row <= _patchesY; ++row) {
+            if (_grid.rowRevision(row) > _revision) {
+                rows[std::max(0, row - 1)] = 1;
+                rows[std::min(row, _patchesY - 1)] = 1;
+            }
+        }
+        for (int col = 0; col <= _patchesX; ++col) {
+            if (_grid.columnRevision(col) > _revision) {
+                cols[std::max(0, col - 1)] = 1;
+                cols[std::min(col, _patchesX - 1)] = 1;
+            }
+        }
+        for (int row = 0; row < _patchesY; ++row) {
+            for (int col = 0; col < _patchesX; ++col) {
+                if (rows[row] || cols[col]) {
+                    dirty.push_back(row * _patchesX + col);
+                }
+            }
+        }
+    }
+    _revision = _grid.revision();
+    _numPatchesChecked = dirty.size();
+    if (dirty.empty()) {
+        return _foldOvers;
+    }
+
+    parallelFor(dirty.size(), numThreads, [&](int i) {
+        int index = dirty[i];
+        double minJacobian;
+        _valid[index] = checkPatch(_grid, index / _patchesX, index % _patchesX, _threshold, _maxDepth, minJacobian);
+        _minJacobian[index] = minJacobian;
+    });
+
+    _foldOvers.clear();
+    for (int index = 0; index < _patchesX * _patchesY; ++index) {
+        if (!_valid[index]) {
+            _foldOvers.push_back(FoldOver{index / _patchesX, index % _patchesX, _minJacobian[index]});
+        }
+    }
+    return _foldOvers;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ParametricSurfaceGrid.h"
+
+// A patch of the grid that folds over, or could not be proven not to.
+struct FoldOver {
+    int row;
+    int col;
+    // Smallest Jacobian determinant of the map from output pixels to the surface found in the patch, 1 for an untouched
+    // patch. At or below the checker's threshold the fold-over is proven; above it the patch only could not be
+    // proven valid within the subdivision limit, so it is still reported.
+    double minJacobian;
+};
+
+// Validates the surface patch by patch, without generating the sample map. A Coons patch of the grid is
+// x(u, v) = (1 - u) * col0(y0(v)) + u * col1(y1(v)) and y(u, v) = (1 - v) * row0(x0(u)) + v * row1(x1(u)), where the
+// spline arguments are linear in u or v, so the partial derivatives only depend on spline values and slopes over
+// intervals. Their exact ranges bound the Jacobian determinant over a cell; a cell whose lower bound is above the
+// threshold is valid, otherwise it is split in four until the bound is conclusive, the determinant at its center
+// proves a fold-over or maxDepth is reached.
+class FoldOverChecker {
+public:
+    explicit FoldOverChecker(ParametricSurfaceGrid& grid, double threshold = 0, int maxDepth = 6);
+
+    // Checks the patches changed since the last check, all of them the first time, on numThreads threads, 0 meaning
+    // one per hardware thread. A moved control point changes its row and column spline, and so every patch next to
+    // them. Returns the offending patches of the whole grid in row-major order.
+    const std::vector<FoldOver>& check(int numThreads = 0);
+    bool isValid(int numThreads = 0) { return check(numThreads).empty(); }
+    // Patches evaluated by the last check().
+    int numPatchesChecked() const { return _numPatchesChecked; }
+
+    // Checks a single patch. Returns true if it is proven not to fold over; minJacobian is set to the smallest
+    // determinant sampled.
+    static bool checkPatch(ParametricSurfaceGrid& grid, int row, int col, double threshold, int maxDepth,
+                           double& minJacobian);
+
+private:
+    void reset();
+
+private:
+    ParametricSurfaceGrid& _grid;
+    double _threshold;
+    int _maxDepth;
+    int _patchesX;
+    int _patchesY;
+    // per patch: proven valid, and the smallest determinant sampled
+    std::vector<char> _valid;
+    std::vector<double> _minJacobian;
+    std::vector<FoldOver> _foldOvers;
+    // grid revision the results are up to date with, 0 before the first check
+    uint64_t _revision;
+    int _numPatchesChecked;
+};
@@ -0,0 +1,248 @@
+#include "GridSnapshot.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <unordered_set>
+
+typedef std::shared_ptr<const tk::spline> SplinePtr;
+typedef std::shared_ptr<const std::vector<double>> TilePtr;
+
+struct GridSnapshot::Data {
+    rect rectangle;
+    int width;
+    int height;
+    double resX;
+    double resY;
+    std::vector<SplinePtr> rows;
+    std::vector<SplinePtr> cols;
+    int tileSize;
+    int tilesX;
+    int tilesY;
+    // row-major, each tile holding its pixels x, y interleaved, empty without a map
+    std::vector<TilePtr> tiles;
+};
+
+static SplinePtr copySpline(const tk::spline& spline)
+{
+    // the copy lives on the heap; snapshots never refit, so the solver workspace is not worth keeping
+    std::shared_ptr<tk::spline> copy = std::make_shared<tk::spline>(spline);
+    copy->release_workspace();
+    return copy;
+}
+
+GridSnapshot GridSnapshot::capture(ParametricSurfaceGrid& grid, const GridSnapshot* base, bool includeMap,
+                                   int tileSize)
+{
+    std::shared_ptr<Data> data = std::make_shared<Data>();
+    State& state = grid.getState();
+    data->rectangle = state.rectangle;
+    data->width = grid.pixelWidth();
+    data->height = grid.pixelHeight();
+    data->resX = grid.gridResolutionX();
+    data->resY = grid.gridResolutionY();
+    int numRows = grid.numControlPointsY();
+    int numCols = grid.numControlPointsX();
+
+    // anything the grid changed after base was taken has a newer revision; a new layout replaces every spline
+    const Data* shared = nullptr;
+    uint64_t since = 0;
+    if (base && base->_data && base->_grid == &grid && grid.layoutRevision() <= base->_revision) {
+        shared = base->_data.get();
+        since = base->_revision;
+        assert((int)shared->rows.size() == numRows && (int)shared->cols.size() == numCols);
+    }
+    data->rows.resize(numRows);
+    for (int row = 0; row < numRows; ++row) {
+        bool unchanged = shared && grid.rowRevision(row) <= since;
+        data->rows[row] = unchanged ? shared->rows[row] : copySpline(grid.rowSpline(row));
+    }
+    data->cols.resize(numCols);
+    for (int col = 0; col < numCols; ++col) {
+        bool unchanged = shared && grid.columnRevision(col) <= since;
+        data->cols[col] = unchanged ? shared->cols[col] : copySpline(grid.colSpline(col));
+    }
+
+    data->tileSize = std::max(1, tileSize);
+    data->tilesX = 0;
+    data->tilesY = 0;
+    if (includeMap) {
+        const SurfacePoints& map = state.surfacePoints;
+        int width = data->width, height = data->height, size = data->tileSize;
+        assert(map.size() == (size_t)width * height * 2);
+        data->tilesX = (width + size - 1) / size;
+        data->tilesY = (height + size - 1) / size;
+        bool shareTiles = shared && !shared->tiles.empty() && shared->tileSize == size;
+        std::vector<char> stale(data->tilesX * data->tilesY, shareTiles ? 0 : 1);
+        if (shareTiles) {
+            // same dependency bands as LazySurfaceMap::update() invalidates
+            for (int row = 0; row < numRows; ++row) {
+                int y0, y1;
+                grid.pixelRowsOfRow(row, y0, y1);
+                if (grid.rowRevision(row) > since && y0 < y1) {
+                    for (int ty = y0 / size; ty <= (y1 - 1) / size; ++ty) {
+                        std::fill(stale.begin() + ty * data->tilesX, stale.begin() + (ty + 1) * data->tilesX, 1);
+                    }
+                }
+            }
+            for (int col = 0; col < numCols; ++col) {
+                int x0, x1;
+                grid.pixelColumnsOfColumn(col, x0, x1);
+                if (grid.columnRevision(col) > since && x0 < x1) {
+                    for (int ty = 0; ty < data->tilesY; ++ty) {
+                        for (int tx = x0 / size; tx <= (x1 - 1) / size; ++tx) {
+                            stale[ty * data->tilesX + tx] = 1;
+                        }
+                    }
+                }
+            }
+        }
+        data->tiles.resize(data->tilesX * data->tilesY);
+        for (int ty = 0; ty < data->tilesY; ++ty) {
+            for (int tx = 0; tx < data->tilesX; ++tx) {
+                int index = ty * data->tilesX + tx;
+                if (!stale[index]) {
+                    data->tiles[index] = shared->tiles[index];
+                    continue;
+                }
+                int x0 = tx * size, y0 = ty * size;
+                int w = std::min(size, width - x0), h = std::min(size, height - y0);
+                std::shared_ptr<std::vector<double>> tile = std::make_shared<std::vector<double>>((size_t)w * h * 2);
+                for (int y = 0; y < h; ++y) {
+                    memcpy(tile->data() + (size_t)y * w * 2, map.data() + ((size_t)(y0 + y) * width + x0) * 2,
+                           w * 2 * sizeof(double));
+                }
+                data->tiles[index] = tile;
+            }
+        }
+    }
+
+    GridSnapshot snapshot;
+    snapshot._data = data;
+    snapshot._grid = &grid;
+    snapshot._revision = grid.revision();
+    return snapshot;
+}
+
+bool GridSnapshot::hasMap() const
+{
+    return _data && !_data->tiles.empty();
+}
+
+int GridSnapshot::pixelWidth() const
+{
+    return _data->width;
+}
+
+int GridSnapshot::pixelHeight() const
+{
+    return _data->height;
+}
+
+GridSnapshot GridSnapshot::restore(ParametricSurfaceGrid& grid) const
+{
+    assert(_data);
+    const Data& data = *_data;
+    std::vector<const ParametricSurfaceGrid::Spline*> rows, cols;
+    for (const SplinePtr& spline : data.rows) {
+        rows.push_back(spline.get());
+    }
+    for (const SplinePtr& spline : data.cols) {
+        cols.push_back(spline.get());
+    }
+    grid.setGridData(data.rectangle, data.resX, data.resY, rows, cols);
+
+    if (!data.tiles.empty()) {
+        SurfacePoints& map = grid.getState().surfacePoints;
+        int width = data.width, height = data.height, size = data.tileSize;
+        map.resize((size_t)width * height * 2);
+        for (int ty = 0; ty < data.tilesY; ++ty) {
+            for (int tx = 0; tx < data.tilesX; ++tx) {
+                const std::vector<double>& tile = *data.tiles[ty * data.tilesX + tx];
+                int x0 = tx * size, y0 = ty * size;
+                int w = std::min(size, width - x0), h = std::min(size, height - y0);
+                for (int y = 0; y < h; ++y) {
+                    memcpy(map.data() + ((size_t)(y0 + y) * width + x0) * 2, tile.data() + (size_t)y * w * 2,
+                           w * 2 * sizeof(double));
+                }
+            }
+        }
+    }
+
+    // the restored grid bumped its revisions, so the next capture can only share with a snapshot taken after that
+    GridSnapshot rebased = *this;
+    rebased._grid = &grid;
+    rebased._revision = grid.revision();
+    return rebased;
+}
+
+size_t GridSnapshot::memoryBytes(const std::vector<GridSnapshot>& snapshots)
+{
+    std::unordered_set<const void*> seen;
+    size_t bytes = 0;
+    for (const GridSnapshot& snapshot : snapshots) {
+        if (!snapshot._data || !seen.insert(snapshot._data.get()).second) {
+            continue;
+        }
+        const Data& data = *snapshot._data;
+        bytes += sizeof(Data) + (data.rows.capacity() + data.cols.capacity()) * sizeof(SplinePtr) +
+                 data.tiles.capacity() * sizeof(TilePtr);
+        for (const std::vector<SplinePtr>* splines : {&data.rows, &data.cols}) {
+            for (const SplinePtr& spline : *splines) {
+                if (seen.insert(spline.get()).second) {
+                    bytes += sizeof(tk::spline) + spline->memory_size();
+                }
+            }
+        }
+        for (const TilePtr& tile : data.tiles) {
+            if (seen.insert(tile.get()).second) {
+                bytes += sizeof(std::vector<double>) + tile->capacity() * sizeof(double);
+            }
+        }
+    }
+    return bytes;
+}
+
+GridHistory::GridHistory(ParametricSurfaceGrid& grid, bool includeMap, int tileSize)
+    : _grid(grid), _includeMap(includeMap), _tileSize(tileSize), _current(-1)
+{
+}
+
+void GridHistory::commit()
+{
+    _steps.resize(_current + 1);
+    _base = GridSnapshot::capture(_grid, _base.isNull() ? nullptr : &_base, _includeMap, _tileSize);
+    _steps.push_back(_base);
+    _current++;
+}
+
+bool GridHistory::undo()
+{
+    if (!canUndo()) {
+        return false;
+    }
+    restore(_current - 1);
+    return true;
+}
+
+bool GridHistory::redo()
+{
+    if (!canRedo()) {
+        return false;
+    }
+    restore(_current + 1);
+    return true;
+}
+
+void GridHistory::clear()
+{
+    _steps.clear();
+    _current = -1;
+    _base = GridSnapshot();
+}
+
+void GridHistory::restore(int step)
+{
+    _current = step;
+    _base = _steps[step].restore(_grid);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "ParametricSurfaceGrid.h"
+
+// Immutable state of a ParametricSurfaceGrid, optionally with its sample map, for undo history.
+//
+// Every row spline, column spline and map tile is held by a reference counted pointer. A snapshot captured on top of
+// an earlier one of the same grid shares everything the grid did not change since, so a history step only costs the
+// splines of the moved control points and the map tiles that depend on them. Copying a snapshot only copies a pointer.
+class GridSnapshot {
+public:
+    GridSnapshot() : _grid(nullptr), _revision(0) {}
+
+    // Captures grid, sharing what did not change since base with it when base was taken from, or restored into, the
+    // same grid. With includeMap, the sample map is kept in tiles of tileSize pixels; the map must be up to date with
+    // the grid, as generateSurfacePoints() leaves it.
+    static GridSnapshot capture(ParametricSurfaceGrid& grid, const GridSnapshot* base = nullptr,
+                                bool includeMap = false, int tileSize = 128);
+    // Sets grid to the captured state, including the sample map when it was captured. Returns the snapshot rebased on
+    // grid, to capture the next state on top of.
+    GridSnapshot restore(ParametricSurfaceGrid& grid) const;
+
+    bool isNull() const { return !_data; }
+    bool hasMap() const;
+    int pixelWidth() const;
+    int pixelHeight() const;
+    // Bytes held by the snapshots, counting storage shared between them once.
+    static size_t memoryBytes(const std::vector<GridSnapshot>& snapshots);
+
+private:
+    // defined with the splines it holds in the source file, as tk is private to each translation unit
+    struct Data;
+
+private:
+    std::shared_ptr<const Data> _data;
+    // grid the data matches at revision _revision, what the next capture can share from
+    ParametricSurfaceGrid* _grid;
+    uint64_t _revision;
+};
+
+// Linear undo history on top of GridSnapshot. The current state is committed after every edit; undo and redo restore
+// the grid to the neighbouring states. Committing after an undo drops the states that could have been redone.
+class GridHistory {
+public:
+    explicit GridHistory(ParametricSurfaceGrid& grid, bool includeMap = false, int tileSize = 128);
+
+    // Records the current state of the grid as a new step.
+    void commit();
+    bool canUndo() const { return _current > 0; }
+    bool canRedo() const { return _current + 1 < (int)_steps.size(); }
+    bool undo();
+    bool redo();
+    void clear();
+    int numSteps() const { return _steps.size(); }
+    int currentStep() const { return _current; }
+    size_t memoryBytes() const { return GridSnapshot::memoryBytes(_steps); }
+
+private:
+    void restore(int step);
+
+private:
+    ParametricSurfaceGrid& _grid;
+    bool _includeMap;
+    int _tileSize;
+    std::vector<GridSnapshot> _steps;
+    int _current;
+    // the state the grid was last captured or restored as
+    GridSnapshot _base;
+};
@@ -2,8 +2,12 @@
 
 #include "vec2.h" 
 
-class IParametricSurface {
+template <class T>
+class IParametricSurfaceT {
 public:
-    virtual vec2d surfacePoint(double u, double v) = 0;
-    virtual vec2d surfacePoint(const vec2d& point) = 0;
+    virtual ~IParametricSurfaceT() {}
+    virtual vec2<T> surfacePoint(T u, T v) = 0;
+    virtual vec2<T> surfacePoint(const vec2<T>& point) = 0;
 };
+
+typedef IParametricSurfaceT<double> IParametricSurface;
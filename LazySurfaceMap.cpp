@@ -0,0 +1,148 @@
+#include "LazySurfaceMap.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <thread>
+
+LazySurfaceMap::LazySurfaceMap(ParametricSurfaceGrid& grid, int tileSize)
+    : _grid(grid), _tileSize(std::max(1, tileSize)), _width(0), _height(0), _tilesX(0), _tilesY(0), _revision(0),
+      _numTilesGenerated(0)
+{
+    resize();
+}
+
+void LazySurfaceMap::resize()
+{
+    _width = _grid.pixelWidth();
+    _height = _grid.pixelHeight();
+    _tilesX = (_width + _tileSize - 1) / _tileSize;
+    _tilesY = (_height + _tileSize - 1) / _tileSize;
+    _tiles.reset(new Tile[_tilesX * _tilesY]);
+    for (int i = 0; i < _tilesX * _tilesY; ++i) {
+        _tiles[i].state = Empty;
+    }
+    _revision = _grid.revision();
+}
+
+void LazySurfaceMap::update()
+{
+    if (_grid.revision() == _revision) {
+        return;
+    }
+    if (_grid.pixelWidth() != _width || _grid.pixelHeight() != _height) {
+        resize();
+        return;
+    }
+    if (_grid.layoutRevision() > _revision) {
+        invalidate();
+        return;
+    }
+    // a row spline feeds every patch above and below it over the whole width, a column spline every patch left and
+    // right of it over the whole height
+    for (int row = 0; row < _grid.numControlPointsY(); ++row) {
+        if (_grid.rowRevision(row) > _revision) {
+            int y0, y1;
+            _grid.pixelRowsOfRow(row, y0, y1);
+            if (y0 < y1) {
+                invalidateTiles(0, y0 / _tileSize, _tilesX, (y1 - 1) / _tileSize + 1);
+            }
+        }
+    }
+    for (int col = 0; col < _grid.numControlPointsX(); ++col) {
+        if (_grid.columnRevision(col) > _revision) {
+            int x0, x1;
+            _grid.pixelColumnsOfColumn(col, x0, x1);
+            if (x0 < x1) {
+                invalidateTiles(x0 / _tileSize, 0, (x1 - 1) / _tileSize + 1, _tilesY);
+            }
+        }
+    }
+    _revision = _grid.revision();
+}
+
+void LazySurfaceMap::invalidate()
+{
+    invalidateTiles(0, 0, _tilesX, _tilesY);
+    _revision = _grid.revision();
+}
+
+void LazySurfaceMap::invalidateTiles(int tileX0, int tileY0, int tileX1, int tileY1)
+{
+    for (int ty = tileY0; ty < tileY1; ++ty) {
+        for (int tx = tileX0; tx < tileX1; ++tx) {
+            _tiles[ty * _tilesX + tx].state.store(Empty, std::memory_order_relaxed);
+        }
+    }
+}
+
+bool LazySurfaceMap::isTileReady(int tileX, int tileY) const
+{
+    return _tiles[tileY * _tilesX + tileX].state.load(std::memory_order_acquire) == Ready;
+}
+
+LazySurfaceMap::Tile& LazySurfaceMap::ensureTile(int tileX, int tileY)
+{
+    assert(tileX >= 0 && tileX < _tilesX && tileY >= 0 && tileY < _tilesY);
+    Tile& tile = _tiles[tileY * _tilesX + tileX];
+    int state = tile.state.load(std::memory_order_acquire);
+    if (state == Ready) {
+        return tile;
+    }
+    if (state == Empty && tile.state.compare_exchange_strong(state, Generating, std::memory_order_acquire)) {
+        if (!tile.data) {
+            tile.data.reset(new double[(size_t)_tileSize * _tileSize * 2]);
+        }
+        int w = tileWidth(tileX);
+        _grid.generateSurfaceTile(tileX * _tileSize, tileY * _tileSize, w, tileHeight(tileY), tile.data.get(),
+                                  (size_t)w * 2);
+        _numTilesGenerated++;
+        tile.state.store(Ready, std::memory_order_release);
+        return tile;
+    }
+    // another thread is generating the tile; tiles take well under a millisecond, so waiting is cheaper than blocking
+    while (tile.state.load(std::memory_order_acquire) != Ready) {
+        std::this_thread::yield();
+    }
+    return tile;
+}
+
+const double* LazySurfaceMap::tileData(int tileX, int tileY)
+{
+    return ensureTile(tileX, tileY).data.get();
+}
+
+vec2d LazySurfaceMap::at(int x, int y)
+{
+    assert(x >= 0 && x < _width && y >= 0 && y < _height);
+    int tileX = x / _tileSize;
+    int tileY = y / _tileSize;
+    const double* p = ensureTile(tileX, tileY).data.get() +
+                      2 * ((size_t)(y - tileY * _tileSize) * tileWidth(tileX) + (x - tileX * _tileSize));
+    return vec2d(p[0], p[1]);
+}
+
+const double* LazySurfaceMap::rowSpan(int x, int y, int& count)
+{
+    assert(x >= 0 && x < _width && y >= 0 && y < _height);
+    int tileX = x / _tileSize;
+    int tileY = y / _tileSize;
+    int w = tileWidth(tileX);
+    int localX = x - tileX * _tileSize;
+    count = w - localX;
+    return ensureTile(tileX, tileY).data.get() + 2 * ((size_t)(y - tileY * _tileSize) * w + localX);
+}
+
+void LazySurfaceMap::copyRow(int x, int y, int count, double* out)
+{
+    assert(x >= 0 && count >= 0 && x + count <= _width);
+    while (count > 0) {
+        int spanCount;
+        const double* span = rowSpan(x, y, spanCount);
+        spanCount = std::min(spanCount, count);
+        std::memcpy(out, span, spanCount * 2 * sizeof(double));
+        out += 2 * spanCount;
+        x += spanCount;
+        count -= spanCount;
+    }
+}
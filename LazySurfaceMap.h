@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "ParametricSurfaceGrid.h"
+#include "vec2.h"
+
+// Sample map of a ParametricSurfaceGrid that is generated tile by tile on first access, for consumers that only read
+// part of it, like a cropped viewport. Tiles are generated by the thread that first asks for them; accessors can be
+// called from any number of threads at once and a tile is never generated twice. Samples are the same as
+// generateSurfacePoints() produces.
+class LazySurfaceMap {
+public:
+    explicit LazySurfaceMap(ParametricSurfaceGrid& grid, int tileSize = 64);
+    LazySurfaceMap(const LazySurfaceMap&) = delete;
+    LazySurfaceMap& operator=(const LazySurfaceMap&) = delete;
+
+    // Catches up with the changes of the grid since the last update: only the tiles that depend on row or column
+    // splines of moved control points are dropped, a new size, origin or grid resolution drops them all. Dropped tiles
+    // are generated again on next access. Must not run concurrently with the accessors.
+    void update();
+    // Drops every tile.
+    void invalidate();
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+    int tileSize() const { return _tileSize; }
+    int tilesX() const { return _tilesX; }
+    int tilesY() const { return _tilesY; }
+    bool isTileReady(int tileX, int tileY) const;
+    // Number of tiles generated since construction, regenerations included.
+    uint64_t numTilesGenerated() const { return _numTilesGenerated; }
+
+    vec2d at(int x, int y);
+    // Pixels of a tile, generated if needed, with tileWidth(tileX) x,y pairs per row.
+    const double* tileData(int tileX, int tileY);
+    int tileWidth(int tileX) const { return std::min(_tileSize, _width - tileX * _tileSize); }
+    int tileHeight(int tileY) const { return std::min(_tileSize, _height - tileY * _tileSize); }
+    // Pixels x, y interleaved from (x, y) to the end of its tile row. count is set to the number of pixels in the span.
+    const double* rowSpan(int x, int y, int& count);
+    // Copies count pixels of row y starting at x to out, x, y interleaved, generating the tiles the span crosses.
+    void copyRow(int x, int y, int count, double* out);
+
+private:
+    enum TileState { Empty, Generating, Ready };
+    struct Tile {
+        std::atomic<int> state;
+        // kept across invalidations, so a regenerated tile reuses its buffer
+        std::unique_ptr<double[]> data;
+    };
+
+    void resize();
+    Tile& ensureTile(int tileX, int tileY);
+    void invalidateTiles(int tileX0, int tileY0, int tileX1, int tileY1);
+
+private:
+    ParametricSurfaceGrid& _grid;
+    int _tileSize;
+    int _width;
+    int _height;
+    int _tilesX;
+    int _tilesY;
+    std::unique_ptr<Tile[]> _tiles;
+    // grid revision the tiles are up to date with
+    uint64_t _revision;
+    std::atomic<uint64_t> _numTilesGenerated;
+};
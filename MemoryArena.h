@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Monotonic memory arena. Allocations are bump-pointer from large blocks and are never freed individually; the whole
+// arena is released at once by reset(). Blocks are kept across resets, so once an arena has grown to its working size
+// further allocate()/reset() cycles do not call into the global allocator.
+class MemoryArena {
+public:
+    explicit MemoryArena(size_t blockSize = 64 * 1024) : _blockSize(blockSize), _current(0), _offset(0)
+    {
+        _blocks.reserve(16);
+    }
+    // Arenas are never shared by copying: a copy starts empty with the same block size.
+    MemoryArena(const MemoryArena& other) : MemoryArena(other._blockSize) {}
+    MemoryArena& operator=(const MemoryArena&) { return *this; }
+    ~MemoryArena() { releaseBlocks(); }
+
+    void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+    {
+        assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+        while (_current < _blocks.size()) {
+            Block& block = _blocks[_current];
+            size_t start = alignUp(reinterpret_cast<uintptr_t>(block.data) + _offset, alignment) -
+                           reinterpret_cast<uintptr_t>(block.data);
+            if (start + bytes <= block.size) {
+                _offset = start + bytes;
+                return block.data + start;
+            }
+            // this block is exhausted, continue on the next retained one
+            _current++;
+            _offset = 0;
+        }
+        size_t size = std::max(_blockSize, bytes + alignment);
+        _blocks.push_back(Block{static_cast<char*>(::operator new(size)), size});
+        _current = _blocks.size() - 1;
+        _offset = 0;
+        return allocate(bytes, alignment);
+    }
+
+    // Releases every allocation at once. If the arena had to grow into several blocks, they are coalesced into a single
+    // block big enough for the whole previous working set, so the next cycle fits without growing.
+    void reset()
+    {
+        if (_blocks.size() > 1) {
+            size_t total = capacity();
+            releaseBlocks();
+            _blocks.push_back(Block{static_cast<char*>(::operator new(total)), total});
+        }
+        _current = 0;
+        _offset = 0;
+    }
+
+    size_t capacity() const
+    {
+        size_t total = 0;
+        for (const Block& block : _blocks) {
+            total += block.size;
+        }
+        return total;
+    }
+
+    size_t bytesUsed() const
+    {
+        size_t total = _offset;
+        for (size_t i = 0; i < _current && i < _blocks.size(); ++i) {
+            total += _blocks[i].size;
+        }
+        return total;
+    }
+
+private:
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    static uintptr_t alignUp(uintptr_t value, size_t alignment)
+    {
+        return (value + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    }
+
+    void releaseBlocks()
+    {
+        for (Block& block : _blocks) {
+            ::operator delete(block.data);
+        }
+        _blocks.clear();
+    }
+
+private:
+    size_t _blockSize;
+    std::vector<Block> _blocks;
+    size_t _current;
+    size_t _offset;
+};
+
+// STL allocator drawing from a MemoryArena. A null arena falls back to the global allocator, so containers using this
+// allocator behave like plain std containers unless an arena is plugged in. Copies of containers never inherit the
+// arena (see select_on_container_copy_construction), since the arena owner may reset it at any time.
+template <class T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator(MemoryArena* arena = nullptr) : _arena(arena) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : _arena(other.arena()) {}
+
+    T* allocate(size_t n)
+    {
+        if (_arena) {
+            return static_cast<T*>(_arena->allocate(n * sizeof(T), alignof(T)));
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t)
+    {
+        if (!_arena) {
+            ::operator delete(p);
+        }
+    }
+
+    ArenaAllocator select_on_container_copy_construction() const { return ArenaAllocator(); }
+    MemoryArena* arena() const { return _arena; }
+
+private:
+    MemoryArena* _arena;
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena() == b.arena(); }
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena() != b.arena(); }
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+
+// How large buffers, like sample maps, are backed by memory pages.
+struct PagePolicy {
+    enum HugePages {
+        // buffers come from the global allocator
+        NoHugePages,
+        // buffers are mapped 2 MB aligned and the kernel is asked to back them with transparent huge pages; where those
+        // are disabled they end up on regular pages
+        TransparentHugePages,
+        // buffers are mapped from the reserved hugetlb pool, falling back to transparent huge pages when the pool is
+        // empty or not configured
+        ExplicitHugePages,
+    };
+    HugePages hugePages = NoHugePages;
+    // New elements are left uninitialized instead of being zeroed by the allocating thread, so every page is placed on
+    // the NUMA node of the thread that writes it first, following the kernel's default first-touch policy.
+    bool firstTouch = false;
+    // buffers smaller than this always come from the global allocator
+    size_t minHugePageBytes = 4 * 1024 * 1024;
+
+    bool operator==(const PagePolicy& other) const
+    {
+        return hugePages == other.hugePages && firstTouch == other.firstTouch &&
+               minHugePageBytes == other.minHugePageBytes;
+    }
+    bool operator!=(const PagePolicy& other) const { return !(*this == other); }
+};
+
+// Allocates and frees bytes following policy. Mapped buffers are rounded up to whole huge pages, so that freeing only
+// needs the size that was asked for, whichever kind of page the mapping ended up on.
+inline void* allocatePages(size_t bytes, const PagePolicy& policy)
+{
+    const size_t hugePageSize = 2 * 1024 * 1024;
+    if (policy.hugePages == PagePolicy::NoHugePages || bytes < policy.minHugePageBytes) {
+        return ::operator new(bytes);
+    }
+    size_t size = (bytes + hugePageSize - 1) / hugePageSize * hugePageSize;
+#ifdef MAP_HUGETLB
+    if (policy.hugePages == PagePolicy::ExplicitHugePages) {
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            return p;
+        }
+    }
+#endif
+    // over-map by one huge page and trim, so the buffer starts on a huge page boundary
+    void* mapping = mmap(nullptr, size + hugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    uintptr_t start = reinterpret_cast<uintptr_t>(mapping);
+    uintptr_t aligned = (start + hugePageSize - 1) / hugePageSize * hugePageSize;
+    size_t head = aligned - start;
+    if (head > 0) {
+        munmap(mapping, head);
+    }
+    if (hugePageSize - head > 0) {
+        munmap(reinterpret_cast<void*>(aligned + size), hugePageSize - head);
+    }
+#ifdef MADV_HUGEPAGE
+    // only a hint, fails harmlessly on kernels without transparent huge pages
+    madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+#endif
+    return reinterpret_cast<void*>(aligned);
+}
+
+inline void freePages(void* p, size_t bytes, const PagePolicy& policy)
+{
+    const size_t hugePageSize = 2 * 1024 * 1024;
+    if (policy.hugePages == PagePolicy::NoHugePages || bytes < policy.minHugePageBytes) {
+        ::operator delete(p);
+        return;
+    }
+    munmap(p, (bytes + hugePageSize - 1) / hugePageSize * hugePageSize);
+}
+
+// STL allocator placing its buffers following a PagePolicy. With the default policy it behaves like std::allocator.
+// The policy travels with the container on copy, move and swap.
+template <class T>
+class PageAllocator {
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    PageAllocator(const PagePolicy& policy = PagePolicy()) : _policy(policy) {}
+    template <class U>
+    PageAllocator(const PageAllocator<U>& other) : _policy(other.policy()) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(allocatePages(n * sizeof(T), _policy)); }
+    void deallocate(T* p, size_t n) { freePages(p, n * sizeof(T), _policy); }
+
+    // default construction is what resize() uses; under first touch it leaves the memory alone
+    template <class U>
+    void construct(U* p)
+    {
+        if (_policy.firstTouch) {
+            ::new (static_cast<void*>(p)) U;
+        } else {
+            ::new (static_cast<void*>(p)) U();
+        }
+    }
+    template <class U, class... Args>
+    void construct(U* p, Args&&... args)
+    {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+
+    const PagePolicy& policy() const { return _policy; }
+
+private:
+    PagePolicy _policy;
+};
+
+template <class T, class U>
+bool operator==(const PageAllocator<T>& a, const PageAllocator<U>& b) { return a.policy() == b.policy(); }
+template <class T, class U>
+bool operator!=(const PageAllocator<T>& a, const PageAllocator<U>& b) { return a.policy() != b.policy(); }
+
+// Vector whose buffer is placed following a PagePolicy.
+template <class T>
+using PageVector = std::vector<T, PageAllocator<T>>;
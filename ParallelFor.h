@@ -0,0 +1,51 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Runs fn(i) for every i in [0, count) on up to numThreads threads, numThreads <= 0 meaning one per hardware thread.
+// Indices are handed out one at a time, so work items of uneven cost balance out across the threads.
+template <class Fn>
+void parallelFor(int count, int numThreads, Fn fn)
+{
+    if (numThreads <= 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    numThreads = std::min(numThreads, count);
+    if (numThreads <= 1) {
+        for (int i = 0; i < count; ++i) {
+            fn(i);
+        }
+        return;
+    }
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        for (int i = next++; i < count; i = next++) {
+            fn(i);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1; t < numThreads; ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+// Splits a width x height area in tileSize x tileSize tiles, clipped at the borders, and runs fn(x0, y0, w, h) for each
+// one with parallelFor().
+template <class Fn>
+void parallelForTiles(int width, int height, int tileSize, int numThreads, Fn fn)
+{
+    int tilesX = (width + tileSize - 1) / tileSize;
+    int tilesY = (height + tileSize - 1) / tileSize;
+    parallelFor(tilesX * tilesY, numThreads, [&](int index) {
+        int x0 = (index % tilesX) * tileSize;
+        int y0 = (index / tilesX) * tileSize;
+        fn(x0, y0, std::min(tileSize, width - x0), std::min(tileSize, height - y0));
+    });
+}
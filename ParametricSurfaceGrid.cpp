@@ -2,33 +2,38 @@
 
 #include <cmath>
 #include <iostream>
+#include <limits>
 
 #include "rect.h"
+#include "ParallelFor.h"
 
-vec2d interpolateBetweenU(double t, double y_sp0, double y_sp1, const tk::spline& sp0, const tk::spline& sp1)
+template <class T>
+vec2<T> interpolateBetweenU(T t, T y_sp0, T y_sp1, const tk::basic_spline<T>& sp0, const tk::basic_spline<T>& sp1)
 {
-    vec2d p0(sp0(y_sp0), y_sp0);
-    vec2d p1(sp1(y_sp1), y_sp1);
+    vec2<T> p0(sp0(y_sp0), y_sp0);
+    vec2<T> p1(sp1(y_sp1), y_sp1);
     return  p0 * (1 - t) + p1 * t;
 }
-vec2d interpolateBetweenV(double t, double x_sp0, double x_sp1, const tk::spline& sp0, const tk::spline& sp1)
+template <class T>
+vec2<T> interpolateBetweenV(T t, T x_sp0, T x_sp1, const tk::basic_spline<T>& sp0, const tk::basic_spline<T>& sp1)
 {
-    vec2d p0(x_sp0, sp0(x_sp0));
-    vec2d p1(x_sp1, sp1(x_sp1));
+    vec2<T> p0(x_sp0, sp0(x_sp0));
+    vec2<T> p1(x_sp1, sp1(x_sp1));
     return p0 * (1 - t) + p1 * t;
 }
 // corner parameters are numbered according to XY variation, for instance, corner00 is smaller x and smaller y, corner01
 // is smaller x and bigger y and so on..
-vec2d generateSplinePatch(double nu, double nv, const tk::spline& spU0, const tk::spline& spU1,
-                            const tk::spline& spV0, const tk::spline& spV1, const vec2d& corner00,
-                            const vec2d& corner01, const vec2d& corner10, const vec2d& corner11)
+template <class T>
+vec2<T> generateSplinePatch(T nu, T nv, const tk::basic_spline<T>& spU0, const tk::basic_spline<T>& spU1,
+                            const tk::basic_spline<T>& spV0, const tk::basic_spline<T>& spV1, const vec2<T>& corner00,
+                            const vec2<T>& corner01, const vec2<T>& corner10, const vec2<T>& corner11)
 {
     // interpolate patches using Coon's Patch
-    vec2d result;
-    vec2d B =
+    vec2<T> result;
+    vec2<T> B =
         corner00 * (1 - nv) * (1 - nu) + corner01 * nv * (1 - nu) + corner10 * (1 - nv) * nu + corner11 * nv * nu;
 
-    vec2d Lc = interpolateBetweenU(nu, corner00.y * (1 - nv) + nv * corner01.y,
+    vec2<T> Lc = interpolateBetweenU(nu, corner00.y * (1 - nv) + nv * corner01.y,
                                      corner10.y * (1 - nv) + nv * corner11.y, spU0, spU1);
     result = Lc;
     result += interpolateBetweenV(nv, corner00.x * (1 - nu) + nu * corner10.x,
@@ -37,237 +42,1207 @@ vec2d generateSplinePatch(double nu, double nv, const tk::spline& spU0, const tk
     return result;
 }
 
-ParametricSurfaceGrid::ParametricSurfaceGrid(const vec2d& pixelOrigin, double sizeWidth, double sizeHeight,
-                                             int gridXControlPointResolution, int gridYControlPointResolution)
+template <class T>
+ParametricSurfaceGridT<T>::ParametricSurfaceGridT(const vec2<T>& pixelOrigin, T sizeWidth, T sizeHeight,
+                                                  int gridXControlPointResolution, int gridYControlPointResolution)
+    : _numThreads(1), _activeArena(0), _splinesAlongX(ArenaAllocator<Spline>(&_arenas[0])),
+      _splinesAlongY(ArenaAllocator<Spline>(&_arenas[0])), _revision(0), _layoutRevision(0),
+      _tessellationBound(0), _tessellationBoundRevision(0)
 {
-    _state.rectangle = rect(pixelOrigin, sizeWidth, sizeHeight);
-    _gridXControlPointResolution = std::max(5, gridXControlPointResolution);
-    _gridYControlPointResolution = std::max(5, gridYControlPointResolution);
+    _state.rectangle = rectT<T>(pixelOrigin, sizeWidth, sizeHeight);
+    _gridXControlPointResolution = std::max(minGridResolution, gridXControlPointResolution);
+    _gridYControlPointResolution = std::max(minGridResolution, gridYControlPointResolution);
 
     createGridData();
 }
 
-void ParametricSurfaceGrid::setPixelWidth(int width)
+template <class T>
+ParametricSurfaceGridT<T>& ParametricSurfaceGridT<T>::operator=(const ParametricSurfaceGridT& other)
 {
+    if (this == &other) {
+        return *this;
+    }
+    // the splines of this grid stay in its active arena, as arena allocators do not propagate on assignment, so the
+    // arena index must not be taken from other
+    MemoryArena& arena = beginGridData();
+    SplineVector splinesAlongX{ArenaAllocator<Spline>(&arena)};
+    SplineVector splinesAlongY{ArenaAllocator<Spline>(&arena)};
+    splinesAlongX.reserve(other._splinesAlongX.size());
+    splinesAlongY.reserve(other._splinesAlongY.size());
+    for (const Spline& spline : other._splinesAlongX) {
+        splinesAlongX.emplace_back(false, &arena);
+        splinesAlongX.back() = spline;
+    }
+    for (const Spline& spline : other._splinesAlongY) {
+        splinesAlongY.emplace_back(false, &arena);
+        splinesAlongY.back() = spline;
+    }
+    _state = other._state;
+    _placedSurfacePoints = other._placedSurfacePoints;
+    _gridXControlPointResolution = other._gridXControlPointResolution;
+    _gridYControlPointResolution = other._gridYControlPointResolution;
+    _numControlPointsX = other._numControlPointsX;
+    _numControlPointsY = other._numControlPointsY;
+    _numThreads = other._numThreads;
+    commitGridData(splinesAlongX, splinesAlongY);
+    return *this;
+}
 
-    _state.rectangle.setWidth(std::max(1, width));
-    createGridData();
+template <class T>
+void ParametricSurfaceGridT<T>::setPixelWidth(int width)
+{
+    setPixelSize(width, pixelHeight());
 }
-void ParametricSurfaceGrid::setPixelHeight(int height)
+template <class T>
+void ParametricSurfaceGridT<T>::setPixelHeight(int height)
 {
-    _state.rectangle.setHeight(std::max(1, height));
-    createGridData();
+    setPixelSize(pixelWidth(), height);
 }
 
-void ParametricSurfaceGrid::setPixelSize(int width, int height)
+template <class T>
+void ParametricSurfaceGridT<T>::setPixelSize(int width, int height)
 {
-    _state.rectangle.setSize(std::max(1, width), std::max(1, height));
-    createGridData();
+    width = std::max(1, width);
+    height = std::max(1, height);
+    T sx = width / (T)pixelWidth();
+    T sy = height / (T)pixelHeight();
+    if (!canScaleGrid(sx, sy)) {
+        // shrinking would bring knots closer than the splines allow, or the resolution below its minimum, so the grid
+        // is created anew for the new size
+        _state.rectangle.setSize(width, height);
+        createGridData();
+        return;
+    }
+    // row splines map x to y, column splines y to x
+    for (Spline& spline : _splinesAlongY) {
+        spline.scale(sx, sy);
+    }
+    for (Spline& spline : _splinesAlongX) {
+        spline.scale(sy, sx);
+    }
+    // the control points keep their place relative to the map, so the number of control points does not change
+    _gridXControlPointResolution *= sx;
+    _gridYControlPointResolution *= sy;
+    _state.rectangle.setSize(width, height);
+    buildAxisTables();
+    layoutChanged();
+}
+
+template <class T>
+bool ParametricSurfaceGridT<T>::canScaleGrid(T sx, T sy)
+{
+    if (_gridXControlPointResolution * sx < minGridResolution ||
+        _gridYControlPointResolution * sy < minGridResolution) {
+        return false;
+    }
+    const T spacing = Spline::min_point_spacing;
+    for (int row = 0; row < _numControlPointsY; ++row) {
+        for (int col = 0; col + 1 < _numControlPointsX; ++col) {
+            vec2<T> a = controlPointPosition(row, col), b = controlPointPosition(row, col + 1);
+            if ((b.x - a.x) * sx < spacing) {
+                return false;
+            }
+        }
+    }
+    for (int col = 0; col < _numControlPointsX; ++col) {
+        for (int row = 0; row + 1 < _numControlPointsY; ++row) {
+            vec2<T> a = controlPointPosition(row, col), b = controlPointPosition(row + 1, col);
+            if ((b.y - a.y) * sy < spacing) {
+                return false;
+            }
+        }
+    }
+    return true;
 }
 
-void ParametricSurfaceGrid::setControlPointPosition(int row, int col, const vec2d& point)
+template <class T>
+void ParametricSurfaceGridT<T>::setControlPointPosition(int row, int col, const vec2<T>& point)
 {
-    assert(row < _splinesAlongY.size() && _splinesAlongY[row].getNumPoints() > col);
-    assert(col < _splinesAlongX.size() && _splinesAlongX[col].getNumPoints() > row);
-    vec2d oldPosition = controlPointPosition(row, col);
-    _splinesAlongY[row].set_point(col, point.x, point.y);
-    _splinesAlongX[col].set_point(row, point.y, point.x);
-    vec2d newPosition = controlPointPosition(row, col);
+    assert(row < (int)_splinesAlongY.size() && (int)_splinesAlongY[row].getNumPoints() > col);
+    assert(col < (int)_splinesAlongX.size() && (int)_splinesAlongX[col].getNumPoints() > row);
+    // each spline would clamp along its own axis only, x in the row spline and y in the column spline, and leave the
+    // other coordinate unclamped, so the point is clamped along both axes first and the two splines get the same point
+    const T spacing = Spline::min_point_spacing;
+    T lowX = -std::numeric_limits<T>::max(), highX = std::numeric_limits<T>::max();
+    T lowY = lowX, highY = highX;
+    T x, y;
+    if (col > 0) {
+        _splinesAlongY[row].get_point(col - 1, x, y);
+        lowX = x + spacing;
+    }
+    if (col + 1 < _numControlPointsX) {
+        _splinesAlongY[row].get_point(col + 1, x, y);
+        highX = x - spacing;
+    }
+    if (row > 0) {
+        _splinesAlongX[col].get_point(row - 1, y, x);
+        lowY = y + spacing;
+    }
+    if (row + 1 < _numControlPointsY) {
+        _splinesAlongX[col].get_point(row + 1, y, x);
+        highY = y - spacing;
+    }
+    // as in Spline::set_point(), the lower bound wins when the neighbours leave no room
+    vec2<T> clamped(std::max(lowX, std::min(highX, point.x)), std::max(lowY, std::min(highY, point.y)));
+    _splinesAlongY[row].store_point(col, clamped.x, clamped.y);
+    _splinesAlongX[col].store_point(row, clamped.y, clamped.x);
+    _splinesAlongY[row].refit();
+    _splinesAlongX[col].refit();
+    splinesChanged(row, col);
 }
 
-void ParametricSurfaceGrid::moveControlPoint(int row, int col, const vec2d& delta)
+template <class T>
+void ParametricSurfaceGridT<T>::moveControlPoint(int row, int col, const vec2<T>& delta)
 {
-    assert(row < _splinesAlongY.size() && _splinesAlongY[row].getNumPoints() > col);
-    assert(col < _splinesAlongX.size() && _splinesAlongX[col].getNumPoints() > row);
-    vec2d oldPosition = controlPointPosition(row, col);
-    _splinesAlongY[row].move_point(col, delta.x, delta.y);
-    _splinesAlongX[col].move_point(row, delta.y, delta.x);
-    vec2d newPosition = controlPointPosition(row, col);
+    setControlPointPosition(row, col, controlPointPosition(row, col) + delta);
 }
 
-vec2d ParametricSurfaceGrid::controlPointPosition(int row, int col)
+template <class T>
+void ParametricSurfaceGridT<T>::setControlPointPositions(const std::vector<vec2<T>>& points)
 {
-    assert(row < _splinesAlongY.size() && _splinesAlongY[row].getNumPoints() > col);
-    assert(col < _splinesAlongX.size() && _splinesAlongX[col].getNumPoints() > row);
+    assert(points.size() == (size_t)_numControlPointsX * _numControlPointsY);
+    // Clamping point by point with set_point() would hold each new point against neighbours that still have their old
+    // positions. Points are clamped against their new left and upper neighbours instead, already stored on this pass,
+    // and the same clamped point is written to its row and its column spline.
+    const T spacing = Spline::min_point_spacing;
+    for (int row = 0; row < _numControlPointsY; ++row) {
+        for (int col = 0; col < _numControlPointsX; ++col) {
+            vec2<T> point = points[row * _numControlPointsX + col];
+            T x, y;
+            if (col > 0) {
+                _splinesAlongY[row].get_point(col - 1, x, y);
+                point.x = std::max(point.x, x + spacing);
+            }
+            if (row > 0) {
+                _splinesAlongX[col].get_point(row - 1, y, x);
+                point.y = std::max(point.y, y + spacing);
+            }
+            _splinesAlongY[row].store_point(col, point.x, point.y);
+            _splinesAlongX[col].store_point(row, point.y, point.x);
+        }
+    }
+    // refitted together, so the solver runs across the splines of one axis instead of one spline at a time
+    Spline::refit_batch(_splinesAlongY.data(), _splinesAlongY.size(), _refitWorkspace);
+    Spline::refit_batch(_splinesAlongX.data(), _splinesAlongX.size(), _refitWorkspace);
+    // every spline was refitted, though the ones whose points did not change keep their function
+    _revision++;
+    _rowRevisions.assign(_numControlPointsY, _revision);
+    _columnRevisions.assign(_numControlPointsX, _revision);
+}
 
-    double x, y;
+template <class T>
+void ParametricSurfaceGridT<T>::controlPointPositions(std::vector<vec2<T>>& points)
+{
+    points.resize(_numControlPointsX * _numControlPointsY);
+    for (int row = 0; row < _numControlPointsY; ++row) {
+        for (int col = 0; col < _numControlPointsX; ++col) {
+            points[row * _numControlPointsX + col] = controlPointPosition(row, col);
+        }
+    }
+}
+
+template <class T>
+vec2<T> ParametricSurfaceGridT<T>::controlPointPosition(int row, int col)
+{
+    assert(row < (int)_splinesAlongY.size() && (int)_splinesAlongY[row].getNumPoints() > col);
+    assert(col < (int)_splinesAlongX.size() && (int)_splinesAlongX[col].getNumPoints() > row);
+
+    T x, y;
     _splinesAlongY[row].get_point(col, x, y);
-    return vec2d(x, y);
+    return vec2<T>(x, y);
+}
+
+// A buffer that has to grow is reallocated empty: the old samples are overwritten anyway, and copying them over would
+// touch every new page from this thread.
+template <class Map>
+static void resizeMap(Map& map, size_t size)
+{
+    if (size > map.capacity()) {
+        map.clear();
+    }
+    map.resize(size);
+}
+
+template <class T>
+const SurfacePointsT<T>& ParametricSurfaceGridT<T>::generateSurfacePoints()
+{
+    resizeMap(_state.surfacePoints, (size_t)pixelWidth() * pixelHeight() * 2);
+    generateSurfacePoints(_state.surfacePoints.data(), false);
+    return _state.surfacePoints;
+}
+
+template <class T>
+const PageVector<T>& ParametricSurfaceGridT<T>::generatePlacedSurfacePoints()
+{
+    resizeMap(_placedSurfacePoints, (size_t)pixelWidth() * pixelHeight() * 2);
+    generateSurfacePoints(_placedSurfacePoints.data(), mapPagePolicy().firstTouch);
+    return _placedSurfacePoints;
+}
+
+template <class T>
+void ParametricSurfaceGridT<T>::generateSurfacePoints(T* data, bool firstTouch)
+{
+    int width = _state.rectangle.width();
+    int height = _state.rectangle.height();
+    if (!firstTouch) {
+        parallelForTiles(width, height, generationTileSize, _numThreads, [&](int x0, int y0, int w, int h) {
+            generateSurfaceTile(x0, y0, w, h, data + ((size_t)y0 * width + x0) * 2, (size_t)width * 2);
+        });
+        return;
+    }
+    // one band of rows per work item, so no page is shared by two threads and each is first touched by its generator
+    int tileSize = generationTileSize;
+    int numBands = (height + tileSize - 1) / tileSize;
+    parallelFor(numBands, _numThreads, [&](int band) {
+        int y0 = band * tileSize;
+        int h = std::min(tileSize, height - y0);
+        for (int x0 = 0; x0 < width; x0 += tileSize) {
+            int w = std::min(tileSize, width - x0);
+            generateSurfaceTile(x0, y0, w, h, data + ((size_t)y0 * width + x0) * 2, (size_t)width * 2);
+        }
+    });
+}
+
+template <class T>
+void ParametricSurfaceGridT<T>::generateSurfaceTile(int x0, int y0, int tileWidth, int tileHeight, T* out,
+                                                   size_t rowStride)
+{
+    if (allSplinesLinear()) {
+        return generateLinearTile(x0, y0, tileWidth, tileHeight, out, rowStride);
+    }
+    // the usual resolutions get a kernel whose patch buffers are sized at compile time, larger ones the generic loop;
+    // chosen by the pixels a patch actually spans, which a fractional resolution can round up
+    if (_maxPatchSpan <= 16) {
+        return generatePatchTile<16>(x0, y0, tileWidth, tileHeight, out, rowStride);
+    }
+    if (_maxPatchSpan <= 32) {
+        return generatePatchTile<32>(x0, y0, tileWidth, tileHeight, out, rowStride);
+    }
+    if (_maxPatchSpan <= maxPatchKernelSpan) {
+        return generatePatchTile<maxPatchKernelSpan>(x0, y0, tileWidth, tileHeight, out, rowStride);
+    }
+    assert(x0 >= 0 && x0 + tileWidth <= (int)_columnTable.t.size());
+    assert(y0 >= 0 && y0 + tileHeight <= (int)_rowTable.t.size());
+    vec2<T> gridOrigin = pixelOrigin();
+    for (int y = 0; y < tileHeight; y++) {
+        T* row = out + y * rowStride;
+        int r = y0 + y;
+        for (int x = 0; x < tileWidth; x++) {
+            int c = x0 + x;
+            vec2<T> surfacepoint = evaluatePatch(_rowTable.i0[r], _rowTable.i1[r], _columnTable.i0[c],
+                                                 _columnTable.i1[c], _columnTable.t[c], _rowTable.t[r]);
+            row[2 * x + 0] = surfacepoint.x + gridOrigin.x;
+            row[2 * x + 1] = surfacepoint.y + gridOrigin.y;
+        }
+    }
+}
+
+template <class T>
+template <int Span>
+void ParametricSurfaceGridT<T>::generatePatchTile(int x0, int y0, int tileWidth, int tileHeight, T* out,
+                                                 size_t rowStride)
+{
+    static_assert(Span > 0 && (Span & (Span - 1)) == 0, "patch span must be a power of two");
+    assert(x0 >= 0 && x0 + tileWidth <= (int)_columnTable.t.size());
+    assert(y0 >= 0 && y0 + tileHeight <= (int)_rowTable.t.size());
+    vec2<T> gridOrigin = pixelOrigin();
+    const int* rows0 = &_rowTable.i0[y0];
+    const int* rows1 = &_rowTable.i1[y0];
+    const T* nvs = &_rowTable.t[y0];
+    const int* cols0 = &_columnTable.i0[x0];
+    const int* cols1 = &_columnTable.i1[x0];
+    const T* nus = &_columnTable.t[x0];
+    T nu[Span], mu[Span], xA[Span], xB[Span], sV0[Span], sV1[Span];
+
+    // blocks of pixels sharing their patch, cut at Span pixels should the resolution not fit after all
+    for (int by = 0; by < tileHeight;) {
+        int row = rows0[by], row1 = rows1[by];
+        int byEnd = by + 1;
+        while (byEnd < tileHeight && byEnd - by < Span && rows0[byEnd] == row && rows1[byEnd] == row1) {
+            byEnd++;
+        }
+        const Spline& spV0 = _splinesAlongY[row];
+        const Spline& spV1 = _splinesAlongY[row1];
+        for (int bx = 0; bx < tileWidth;) {
+            int col = cols0[bx], col1 = cols1[bx];
+            int bxEnd = bx + 1;
+            while (bxEnd < tileWidth && bxEnd - bx < Span && cols0[bxEnd] == col && cols1[bxEnd] == col1) {
+                bxEnd++;
+            }
+            int n = bxEnd - bx;
+            const Spline& spU0 = _splinesAlongX[col];
+            const Spline& spU1 = _splinesAlongX[col1];
+            vec2<T> c00 = controlPointPosition(row, col);
+            vec2<T> c10 = controlPointPosition(row, col1);
+            vec2<T> c01 = controlPointPosition(row1, col);
+            vec2<T> c11 = controlPointPosition(row1, col1);
+            // everything below is computed exactly as generateSplinePatch() does, only hoisted out of the pixel loop
+            for (int i = 0; i < n; i++) {
+                nu[i] = nus[bx + i];
+                mu[i] = 1 - nu[i];
+                xA[i] = c00.x * mu[i] + nu[i] * c10.x;
+                xB[i] = c01.x * mu[i] + nu[i] * c11.x;
+                sV0[i] = spV0(xA[i]);
+                sV1[i] = spV1(xB[i]);
+            }
+            for (int y = by; y < byEnd; y++) {
+                T nv = nvs[y];
+                T mv = 1 - nv;
+                T yA = c00.y * mv + nv * c01.y;
+                T yB = c10.y * mv + nv * c11.y;
+                T sU0 = spU0(yA);
+                T sU1 = spU1(yB);
+                vec2<T> b00 = c00 * mv, b01 = c01 * nv, b10 = c10 * mv, b11 = c11 * nv;
+                T* outRow = out + y * rowStride + 2 * bx;
+                for (int i = 0; i < n; i++) {
+                    T lx = (sU0 * mu[i] + sU1 * nu[i]) + (xA[i] * mv + xB[i] * nv);
+                    T ly = (yA * mu[i] + yB * nu[i]) + (sV0[i] * mv + sV1[i] * nv);
+                    T cx = ((b00.x * mu[i] + b01.x * mu[i]) + b10.x * nu[i]) + b11.x * nu[i];
+                    T cy = ((b00.y * mu[i] + b01.y * mu[i]) + b10.y * nu[i]) + b11.y * nu[i];
+                    outRow[2 * i + 0] = (lx - cx) + gridOrigin.x;
+                    outRow[2 * i + 1] = (ly - cy) + gridOrigin.y;
+                }
+            }
+            bx = bxEnd;
+        }
+        by = byEnd;
+    }
+}
+
+template <class T>
+bool ParametricSurfaceGridT<T>::allSplinesLinear()
+{
+    for (const Spline& spline : _splinesAlongY) {
+        if (!spline.isLinear()) {
+            return false;
+        }
+    }
+    for (const Spline& spline : _splinesAlongX) {
+        if (!spline.isLinear()) {
+            return false;
+        }
+    }
+    return true;
 }
 
-const std::vector<double>& ParametricSurfaceGrid::generateSurfacePoints()
+template <class T>
+void ParametricSurfaceGridT<T>::generateLinearTile(int x0, int y0, int tileWidth, int tileHeight, T* out,
+                                                  size_t rowStride)
 {
+    // the knot flags of a row live on the stack, so wider tiles are generated in strips of generationTileSize columns
+    int stripWidth = generationTileSize;
+    if (tileWidth > stripWidth) {
+        for (int x = 0; x < tileWidth; x += stripWidth) {
+            generateLinearTile(x0 + x, y0, std::min(stripWidth, tileWidth - x), tileHeight, out + 2 * x, rowStride);
+        }
+        return;
+    }
     int width = _state.rectangle.width();
     int height = _state.rectangle.height();
+    vec2<T> gridOrigin = pixelOrigin();
+    const int* cols = &_columnTable.i0[x0];
+    const T* nus = &_columnTable.t[x0];
+    unsigned char onKnot[generationTileSize];
 
-    vec2d gridOrigin = pixelOrigin();
-    _state.surfacePoints.resize(width * height * 2);
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            double u = x / (double)width;
-            double v = y / (double)height;
-            vec2d surfacepoint = surfacePoint(u, v);
-            _state.surfacePoints[2 * y * width + 2 * x + 0] = surfacepoint.x + gridOrigin.x;
-            _state.surfacePoints[2 * y * width + 2 * x + 1] = surfacepoint.y + gridOrigin.y;
+    for (int y = 0; y < tileHeight; y++) {
+        T* outRow = out + y * rowStride;
+        T v = (y0 + y) / (T)height;
+        int row = _rowTable.i0[y0 + y];
+        int row1 = _rowTable.i1[y0 + y];
+        T nv = _rowTable.t[y0 + y];
+        T mv = 1 - nv;
+
+        int x = 0;
+        while (x < tileWidth) {
+            int col = cols[x];
+            int spanEnd = x + 1;
+            while (spanEnd < tileWidth && cols[spanEnd] == col) {
+                spanEnd++;
+            }
+            // pixels beyond the last control point do not occur inside the map, evaluate them generically anyway
+            if (col + 1 >= _numControlPointsX) {
+                for (; x < spanEnd; x++) {
+                    onKnot[x] = 1;
+                }
+                continue;
+            }
+            // everything that is constant along the span, computed exactly as generateSplinePatch() does
+            vec2<T> c00 = controlPointPosition(row, col);
+            vec2<T> c10 = controlPointPosition(row, col + 1);
+            vec2<T> c01 = controlPointPosition(row1, col);
+            vec2<T> c11 = controlPointPosition(row1, col + 1);
+            T yA = c00.y * mv + nv * c01.y;
+            T yB = c10.y * mv + nv * c11.y;
+            T sU0 = _splinesAlongX[col](yA);
+            T sU1 = _splinesAlongX[col + 1](yB);
+            // the row splines are evaluated inside their segment col, as long as x stays within its knots
+            T slope0 = (c10.y - c00.y) / (c10.x - c00.x);
+            T slope1 = (c11.y - c01.y) / (c11.x - c01.x);
+            // on the first knot the segment holds inclusively, on the others the spline takes the segment before
+            int firstInclusive = col == 0;
+            vec2<T> b00 = c00 * mv, b01 = c01 * nv, b10 = c10 * mv, b11 = c11 * nv;
+            for (int i = x; i < spanEnd; i++) {
+                T nu = nus[i];
+                T mu = 1 - nu;
+                T xA = c00.x * mu + nu * c10.x;
+                T xB = c01.x * mu + nu * c11.x;
+                T sV0 = slope0 * (xA - c00.x) + c00.y;
+                T sV1 = slope1 * (xB - c01.x) + c01.y;
+                T lx = (sU0 * mu + sU1 * nu) + (xA * mv + xB * nv);
+                T ly = (yA * mu + yB * nu) + (sV0 * mv + sV1 * nv);
+                T bx = ((b00.x * mu + b01.x * mu) + b10.x * nu) + b11.x * nu;
+                T by = ((b00.y * mu + b01.y * mu) + b10.y * nu) + b11.y * nu;
+                outRow[2 * i + 0] = (lx - bx) + gridOrigin.x;
+                outRow[2 * i + 1] = (ly - by) + gridOrigin.y;
+                onKnot[i] = (xA < c00.x) | ((xA == c00.x) & !firstInclusive) | (xA > c10.x) | (xB < c01.x) |
+                            ((xB == c01.x) & !firstInclusive) | (xB > c11.x);
+            }
+            x = spanEnd;
+        }
+        for (int i = 0; i < tileWidth; i++) {
+            if (onKnot[i]) {
+                vec2<T> surfacepoint = surfacePoint((x0 + i) / (T)width, v);
+                outRow[2 * i + 0] = surfacepoint.x + gridOrigin.x;
+                outRow[2 * i + 1] = surfacepoint.y + gridOrigin.y;
+            }
         }
     }
+}
+
+template <class T>
+void ParametricSurfaceGridT<T>::tessellationAxis(int subdivisions, bool alongX, std::vector<double>& coords)
+{
+    int size = alongX ? pixelWidth() : pixelHeight();
+    T resolution = alongX ? _gridXControlPointResolution : _gridYControlPointResolution;
+    int numPatches = (alongX ? _numControlPointsX : _numControlPointsY) - 1;
+    coords.clear();
+    for (int patch = 0; patch < numPatches; ++patch) {
+        double start = std::min<T>(size, patch * resolution);
+        double end = std::min<T>(size, (patch + 1) * resolution);
+        for (int k = 0; k < subdivisions; ++k) {
+            coords.push_back(start + (end - start) * k / subdivisions);
+        }
+    }
+    coords.push_back(size);
+}
+
+template <class T>
+void ParametricSurfaceGridT<T>::tessellate(int subdivisions, SurfaceMesh& mesh)
+{
+    subdivisions = std::max(1, subdivisions);
+    std::vector<double> xs, ys;
+    tessellationAxis(subdivisions, true, xs);
+    tessellationAxis(subdivisions, false, ys);
+    int width = pixelWidth();
+    int height = pixelHeight();
+    vec2<T> gridOrigin = pixelOrigin();
+
+    mesh.width = width;
+    mesh.height = height;
+    mesh.vertices.resize(xs.size() * ys.size() * 4);
+    for (size_t j = 0; j < ys.size(); ++j) {
+        for (size_t i = 0; i < xs.size(); ++i) {
+            double* vertex = &mesh.vertices[(j * xs.size() + i) * 4];
+            vec2<T> point = surfacePoint(xs[i] / width, ys[j] / height);
+            vertex[0] = xs[i];
+            vertex[1] = ys[j];
+            vertex[2] = point.x + gridOrigin.x;
+            vertex[3] = point.y + gridOrigin.y;
+        }
+    }
+    // two triangles per cell, split along the v00-v11 diagonal
+    mesh.indices.clear();
+    mesh.indices.reserve((xs.size() - 1) * (ys.size() - 1) * 6);
+    for (size_t j = 0; j + 1 < ys.size(); ++j) {
+        for (size_t i = 0; i + 1 < xs.size(); ++i) {
+            uint32_t v00 = j * xs.size() + i;
+            uint32_t v10 = v00 + 1;
+            uint32_t v01 = v00 + xs.size();
+            uint32_t v11 = v01 + 1;
+            mesh.indices.insert(mesh.indices.end(), {v00, v10, v11, v00, v11, v01});
+        }
+    }
+}
+
+// Largest absolute value in [lo, hi].
+template <class T>
+static T absMax(T lo, T hi)
+{
+    return std::max(std::abs(lo), std::abs(hi));
+}
+
+// Pixel interval [start, end] of one patch along an axis, as tessellationAxis() cuts it, with the patch coordinate t of
+// its ends and dt, the change of t per pixel, as locateAxis() maps pixels into the patch.
+template <class T>
+static void patchInterval(int patch, int numPatches, int size, T resolution, double& start, double& end, double& t0,
+                          double& t1, double& dt)
+{
+    start = std::min<double>(size, patch * resolution);
+    end = patch == numPatches - 1 ? size : std::min<double>(size, (patch + 1) * resolution);
+    // the last interval may be a fraction of a full one, which locateAxis() stretches to the whole patch
+    double fraction = size / (double)resolution - (numPatches - 1);
+    dt = 1 / (double)resolution;
+    if (patch == numPatches - 1 && fraction > 0 && fraction < 1) {
+        dt /= fraction;
+    }
+    t0 = (start - patch * (double)resolution) * dt;
+    t1 = (end - patch * (double)resolution) * dt;
+}
+
+template <class T>
+double ParametricSurfaceGridT<T>::tessellationBound()
+{
+    if (_tessellationBoundRevision == _revision) {
+        return _tessellationBound;
+    }
+    int numPatchesX = _numControlPointsX - 1;
+    int numPatchesY = _numControlPointsY - 1;
+    double bound = 0;
+    for (int row = 0; row < numPatchesY; ++row) {
+        double startY, endY, v0, v1, dv;
+        patchInterval(row, numPatchesY, pixelHeight(), _gridYControlPointResolution, startY, endY, v0, v1, dv);
+        for (int col = 0; col < numPatchesX; ++col) {
+            double startX, endX, u0, u1, du;
+            patchInterval(col, numPatchesX, pixelWidth(), _gridXControlPointResolution, startX, endX, u0, u1, du);
+            if (endX <= startX || endY <= startY) {
+                continue;
+            }
+            vec2<T> c00 = controlPointPosition(row, col);
+            vec2<T> c10 = controlPointPosition(row, col + 1);
+            vec2<T> c01 = controlPointPosition(row + 1, col);
+            vec2<T> c11 = controlPointPosition(row + 1, col + 1);
+            // the column splines are evaluated at yA = c00.y + v * dyA and yB = c10.y + v * dyB, weighted by 1 - u and
+            // u, and the row splines likewise at xA and xB along u, weighted by 1 - v and v
+            double dyA = c01.y - c00.y, dyB = c11.y - c10.y;
+            double dxA = c10.x - c00.x, dxB = c11.x - c01.x;
+            double weightU0 = absMax(1 - u0, 1 - u1), weightU1 = absMax(u0, u1);
+            double weightV0 = absMax(1 - v0, 1 - v1), weightV1 = absMax(v0, v1);
+            // range of the slope of a spline over [at0, at1], scaled by step, and the largest curvature there
+            auto slopeAndCurvature = [](const Spline& spline, double at0, double at1, double step, double& slopeLo,
+                                        double& slopeHi, double& curvature) {
+                T lo, hi;
+                spline.deriv_range(std::min(at0, at1), std::max(at0, at1), lo, hi);
+                slopeLo = std::min(lo * step, hi * step);
+                slopeHi = std::max(lo * step, hi * step);
+                spline.second_deriv_range(std::min(at0, at1), std::max(at0, at1), lo, hi);
+                curvature = absMax(lo, hi);
+            };
+            double slopeU0[2], slopeU1[2], slopeV0[2], slopeV1[2], curvatureU0, curvatureU1, curvatureV0, curvatureV1;
+            slopeAndCurvature(_splinesAlongX[col], c00.y + v0 * dyA, c00.y + v1 * dyA, dyA, slopeU0[0], slopeU0[1],
+                              curvatureU0);
+            slopeAndCurvature(_splinesAlongX[col + 1], c10.y + v0 * dyB, c10.y + v1 * dyB, dyB, slopeU1[0], slopeU1[1],
+                              curvatureU1);
+            slopeAndCurvature(_splinesAlongY[row], c00.x + u0 * dxA, c00.x + u1 * dxA, dxA, slopeV0[0], slopeV0[1],
+                              curvatureV0);
+            slopeAndCurvature(_splinesAlongY[row + 1], c01.x + u0 * dxB, c01.x + u1 * dxB, dxB, slopeV1[0], slopeV1[1],
+                              curvatureV1);
+            // the bilinear terms of the Coons patch cancel in the second derivatives, leaving x_uu = 0,
+            // x_vv = (1 - u) U0'' dyA^2 + u U1'' dyB^2 and x_uv = U1' dyB - U0' dyA, and symmetrically for y; the
+            // chain rule takes them to pixels
+            double xvv = (weightU0 * curvatureU0 * dyA * dyA + weightU1 * curvatureU1 * dyB * dyB) * dv * dv;
+            double xuv = absMax(slopeU1[0] - slopeU0[1], slopeU1[1] - slopeU0[0]) * du * dv;
+            double yuu = (weightV0 * curvatureV0 * dxA * dxA + weightV1 * curvatureV1 * dxB * dxB) * du * du;
+            double yuv = absMax(slopeV1[0] - slopeV0[1], slopeV1[1] - slopeV0[0]) * du * dv;
+            // linear interpolation on a triangle is off by half the Hessian, weighted by the barycentric coordinates,
+            // applied to the offsets to the vertices; over the cells of a patch the offsets have a variance of at most
+            // a quarter of the squared cell size along each axis
+            double width = endX - startX, height = endY - startY;
+            double errorX = (2 * xuv * width * height + xvv * height * height) / 8;
+            double errorY = (yuu * width * width + 2 * yuv * width * height) / 8;
+            bound = std::max(bound, std::hypot(errorX, errorY));
+        }
+    }
+    _tessellationBound = bound;
+    _tessellationBoundRevision = _revision;
+    return bound;
+}
+
+template <class T>
+int ParametricSurfaceGridT<T>::tessellateWithinError(double maxError, SurfaceMesh& mesh, int maxSubdivisions,
+                                                    double* error)
+{
+    // the bound shrinks with the square of the cell size, so the level follows from the bound of whole patches
+    double bound = tessellationBound();
+    maxSubdivisions = std::max(1, maxSubdivisions);
+    int subdivisions = 1;
+    if (bound > 0) {
+        double needed = maxError > 0 ? std::ceil(std::sqrt(bound / maxError)) : maxSubdivisions;
+        subdivisions = (int)std::max(1.0, std::min<double>(needed, maxSubdivisions));
+    }
+    tessellate(subdivisions, mesh);
+    if (error) {
+        *error = bound / ((double)subdivisions * subdivisions);
+    }
+    return subdivisions;
+}
+
+template <class T>
+const SurfacePointsT<T>& ParametricSurfaceGridT<T>::generateSurfacePointsTessellated(double maxError, int numThreads)
+{
+    // rasterizing costs more per pixel than the linear and patch kernels evaluating the surface
+    if (allSplinesLinear() || _maxPatchSpan <= maxPatchKernelSpan) {
+        return generateSurfacePoints();
+    }
+    int width = _state.rectangle.width();
+    int height = _state.rectangle.height();
+    // cells of less than a few pixels would not be cheaper than evaluating the surface per pixel
+    int maxSubdivisions = std::max<int>(1, std::max(_gridXControlPointResolution, _gridYControlPointResolution) / 4);
+    SurfaceMesh mesh;
+    double error;
+    tessellateWithinError(maxError, mesh, maxSubdivisions, &error);
+    if (error > maxError) {
+        return generateSurfacePoints();
+    }
+    resizeMap(_state.surfacePoints, (size_t)width * height * 2);
+    rasterizeSurfaceMesh(mesh, _state.surfacePoints.data(), (size_t)width * 2, numThreads);
     return _state.surfacePoints;
 }
 
-void ParametricSurfaceGrid::rebuildGridData(int gridXRes, int gridYRes, int gridWidth, int gridHeight)
+template <class T>
+void ParametricSurfaceGridT<T>::rebuildGridData(T gridXRes, T gridYRes, int gridWidth, int gridHeight)
 {
     if (_splinesAlongX.size() == 0 || _splinesAlongY.size() == 0) {
         return createGridData();
     }
-    std::vector<tk::spline> splinesAlongX;
-    std::vector<tk::spline> splinesAlongY;
+    MemoryArena& arena = beginGridData();
+    SplineVector splinesAlongX{ArenaAllocator<Spline>(&arena)};
+    SplineVector splinesAlongY{ArenaAllocator<Spline>(&arena)};
 
     int newWidth = gridWidth > 0 ? gridWidth : _state.rectangle.width();
     int newHeight = gridHeight > 0 ? gridHeight : _state.rectangle.height();
-    int newResX = gridXRes > 0 ? gridXRes : _gridXControlPointResolution;
-    int newResY = gridYRes > 0 ? gridYRes : _gridYControlPointResolution;
+    T newResX = gridXRes > 0 ? gridXRes : _gridXControlPointResolution;
+    T newResY = gridYRes > 0 ? gridYRes : _gridYControlPointResolution;
     int numControlPointsX = std::max<int>(3, 1 + std::ceil(newWidth / (float)newResX));
     int numControlPointsY = std::max<int>(3, 1 + std::ceil(newHeight / (float)newResY));
+    splinesAlongY.reserve(numControlPointsY);
+    splinesAlongX.reserve(numControlPointsX);
+    tk::arena_vector<T> x(std::max(numControlPointsX, numControlPointsY), 0.0, ArenaAllocator<T>(&arena));
+    tk::arena_vector<T> y(x.size(), 0.0, ArenaAllocator<T>(&arena));
 
     // create horizontal splines, along y axis
     for (int j = 0; j < numControlPointsY; ++j) {
-        int ycoord = std::min(newHeight, j * newResY);
-        bool isLinear = rowSpline(j).isLinear();
-        tk::spline spline(isLinear);
-        double v = ycoord / (double)newHeight;
-        std::vector<double> x, y;
+        T ycoord = std::min<T>(newHeight, j * newResY);
+        bool isLinear = rowSpline(std::min(j, _numControlPointsY - 1)).isLinear();
+        T v = ycoord / (T)newHeight;
         for (int i = 0; i < numControlPointsX; ++i) {
-            int xcoord = std::min(newWidth, i * newResX);
-            double u = xcoord / (double)newWidth;
-            vec2d point = surfacePoint(u, v);
-            x.push_back(point.x);
-            y.push_back(point.y);
+            T xcoord = std::min<T>(newWidth, i * newResX);
+            T u = xcoord / (T)newWidth;
+            vec2<T> point = surfacePoint(u, v);
+            x[i] = point.x;
+            y[i] = point.y;
         }
-        spline.set_points(x, y);
-        splinesAlongY.push_back(spline);
+        splinesAlongY.emplace_back(isLinear, &arena);
+        splinesAlongY.back().set_points(x.data(), y.data(), numControlPointsX);
     }
 
     for (int j = 0; j < numControlPointsX; ++j) {
-        int xcoord = std::min(newWidth, j * newResX);
-        bool isLinear = colSpline(j).isLinear();
-        tk::spline spline(isLinear);
-        std::vector<double> x, y;
-        double u = xcoord / (double)newWidth;
+        T xcoord = std::min<T>(newWidth, j * newResX);
+        bool isLinear = colSpline(std::min(j, _numControlPointsX - 1)).isLinear();
+        T u = xcoord / (T)newWidth;
         for (int i = 0; i < numControlPointsY; ++i) {
-            int ycoord = std::min(newHeight, i * newResY);
-            double v = ycoord / (double)newHeight;
-            vec2d point = surfacePoint(u, v);
-            x.push_back(point.y);
-            y.push_back(point.x);
+            T ycoord = std::min<T>(newHeight, i * newResY);
+            T v = ycoord / (T)newHeight;
+            vec2<T> point = surfacePoint(u, v);
+            x[i] = point.y;
+            y[i] = point.x;
         }
-        spline.set_points(x, y);
-        splinesAlongX.push_back(spline);
+        splinesAlongX.emplace_back(isLinear, &arena);
+        splinesAlongX.back().set_points(x.data(), y.data(), numControlPointsY);
     }
     _state.rectangle.setSize(std::max(20, newWidth), std::max(20, newHeight));
     _gridXControlPointResolution = newResX;
     _gridYControlPointResolution = newResY;
     _numControlPointsX = numControlPointsX;
     _numControlPointsY = numControlPointsY;
-    _splinesAlongX = splinesAlongX;
-    _splinesAlongY = splinesAlongY;
-    assert(_splinesAlongY.size() == _numControlPointsY);
-    assert(_splinesAlongX.size() == _numControlPointsX);
+    commitGridData(splinesAlongX, splinesAlongY);
+    assert((int)_splinesAlongY.size() == _numControlPointsY);
+    assert((int)_splinesAlongX.size() == _numControlPointsX);
 }
 
-void ParametricSurfaceGrid::createGridData()
+// Places the control points of an axis refined by factor on the original axis. New control point i either is original
+// control point index[i], with t[i] == 0, or lies inside the original interval index[i], at the interval position t[i]
+// that surfacePoint() would compute for it.
+template <class T>
+static void refineAxis(int size, T resolution, int numControlPoints, int factor, T newResolution,
+                       tk::arena_vector<int>& index, tk::arena_vector<T>& t)
 {
-    _splinesAlongX.clear();
-    _splinesAlongY.clear();
+    for (size_t i = 0; i < index.size(); ++i) {
+        T position = std::min<T>(size, i * newResolution);
+        int interval = i / factor;
+        if (position == size) {
+            index[i] = numControlPoints - 1;
+            t[i] = 0;
+        } else if (i % factor == 0) {
+            index[i] = interval;
+            t[i] = 0;
+        } else {
+            T start = interval * resolution;
+            T end = std::min<T>(size, (interval + 1) * resolution);
+            index[i] = interval;
+            t[i] = (position - start) / (end - start);
+        }
+    }
+}
+
+template <class T>
+bool ParametricSurfaceGridT<T>::refineGridData(T gridXRes, T gridYRes)
+{
+    int factorX = std::lround(_gridXControlPointResolution / gridXRes);
+    int factorY = std::lround(_gridYControlPointResolution / gridYRes);
+    if (factorX < 1 || factorY < 1 || factorX * gridXRes != _gridXControlPointResolution ||
+        factorY * gridYRes != _gridYControlPointResolution) {
+        return false;
+    }
+    if (factorX == 1 && factorY == 1) {
+        return true;
+    }
+    int width = pixelWidth();
+    int height = pixelHeight();
+    int numControlPointsX = std::max<int>(3, 1 + std::ceil(width / (float)gridXRes));
+    int numControlPointsY = std::max<int>(3, 1 + std::ceil(height / (float)gridYRes));
+    // the refined lattice only nests into the current one if the current one is laid out regularly
+    if (_numControlPointsX != std::max<int>(3, 1 + std::ceil(width / (float)_gridXControlPointResolution)) ||
+        _numControlPointsY != std::max<int>(3, 1 + std::ceil(height / (float)_gridYControlPointResolution))) {
+        return false;
+    }
+
+    MemoryArena& arena = beginGridData();
+    SplineVector splinesAlongX{ArenaAllocator<Spline>(&arena)};
+    SplineVector splinesAlongY{ArenaAllocator<Spline>(&arena)};
+    splinesAlongY.reserve(numControlPointsY);
+    splinesAlongX.reserve(numControlPointsX);
+    tk::arena_vector<int> colIndex(numControlPointsX, 0, ArenaAllocator<int>(&arena));
+    tk::arena_vector<int> rowIndex(numControlPointsY, 0, ArenaAllocator<int>(&arena));
+    tk::arena_vector<T> colT(numControlPointsX, 0, ArenaAllocator<T>(&arena));
+    tk::arena_vector<T> rowT(numControlPointsY, 0, ArenaAllocator<T>(&arena));
+    refineAxis(width, _gridXControlPointResolution, _numControlPointsX, factorX, gridXRes, colIndex, colT);
+    refineAxis(height, _gridYControlPointResolution, _numControlPointsY, factorY, gridYRes, rowIndex, rowT);
+    // control points of the refined grid, row-major
+    tk::arena_vector<T> px((size_t)numControlPointsX * numControlPointsY, 0, ArenaAllocator<T>(&arena));
+    tk::arena_vector<T> py(px.size(), 0, ArenaAllocator<T>(&arena));
+    tk::arena_vector<T> knots(std::max(numControlPointsX, numControlPointsY), 0, ArenaAllocator<T>(&arena));
+    tk::arena_vector<T> values(knots.size(), 0, ArenaAllocator<T>(&arena));
+
+    // the original splines keep their functions and gain knots where the new rows and columns cross them; their
+    // control points are taken from them afterwards, so the crossing splines agree exactly
+    // new rows and columns are linear where the original splines around them are
+    for (int j = 0; j < numControlPointsY; ++j) {
+        int row = rowIndex[j];
+        if (rowT[j] != 0) {
+            splinesAlongY.emplace_back(_splinesAlongY[row].isLinear() && _splinesAlongY[row + 1].isLinear(), &arena);
+            continue;
+        }
+        splinesAlongY.emplace_back(false, &arena);
+        int count = 0;
+        for (int i = 0; i < numControlPointsX; ++i) {
+            if (colT[i] != 0) {
+                T x0 = controlPointPosition(row, colIndex[i]).x;
+                T x1 = controlPointPosition(row, colIndex[i] + 1).x;
+                knots[count++] = x0 * (1 - colT[i]) + colT[i] * x1;
+            }
+        }
+        Spline& spline = splinesAlongY.back();
+        spline = _splinesAlongY[row];
+        spline.insert_knots(knots.data(), count);
+        for (int i = 0; i < numControlPointsX; ++i) {
+            spline.get_point(i, px[j * numControlPointsX + i], py[j * numControlPointsX + i]);
+        }
+    }
+    for (int i = 0; i < numControlPointsX; ++i) {
+        int col = colIndex[i];
+        if (colT[i] != 0) {
+            splinesAlongX.emplace_back(_splinesAlongX[col].isLinear() && _splinesAlongX[col + 1].isLinear(), &arena);
+            continue;
+        }
+        splinesAlongX.emplace_back(false, &arena);
+        int count = 0;
+        for (int j = 0; j < numControlPointsY; ++j) {
+            if (rowT[j] != 0) {
+                T y0 = controlPointPosition(rowIndex[j], col).y;
+                T y1 = controlPointPosition(rowIndex[j] + 1, col).y;
+                knots[count++] = y0 * (1 - rowT[j]) + rowT[j] * y1;
+            }
+        }
+        Spline& spline = splinesAlongX.back();
+        spline = _splinesAlongX[col];
+        spline.insert_knots(knots.data(), count);
+        for (int j = 0; j < numControlPointsY; ++j) {
+            if (rowT[j] != 0) {
+                spline.get_point(j, py[j * numControlPointsX + i], px[j * numControlPointsX + i]);
+            }
+        }
+    }
+    // control points inside the original patches lie on no original spline, they are evaluated on their known patch
+    for (int j = 0; j < numControlPointsY; ++j) {
+        for (int i = 0; i < numControlPointsX; ++i) {
+            if (rowT[j] != 0 && colT[i] != 0) {
+                vec2<T> point = evaluatePatch(rowIndex[j], rowIndex[j] + 1, colIndex[i], colIndex[i] + 1, colT[i],
+                                              rowT[j]);
+                px[j * numControlPointsX + i] = point.x;
+                py[j * numControlPointsX + i] = point.y;
+            }
+        }
+    }
+
+    // only the new rows and columns are fitted
+    for (int j = 0; j < numControlPointsY; ++j) {
+        if (rowT[j] != 0) {
+            splinesAlongY[j].set_points(&px[j * numControlPointsX], &py[j * numControlPointsX], numControlPointsX);
+        }
+    }
+    for (int i = 0; i < numControlPointsX; ++i) {
+        if (colT[i] != 0) {
+            for (int j = 0; j < numControlPointsY; ++j) {
+                knots[j] = py[j * numControlPointsX + i];
+                values[j] = px[j * numControlPointsX + i];
+            }
+            splinesAlongX[i].set_points(knots.data(), values.data(), numControlPointsY);
+        }
+    }
+
+    _gridXControlPointResolution = gridXRes;
+    _gridYControlPointResolution = gridYRes;
+    _numControlPointsX = numControlPointsX;
+    _numControlPointsY = numControlPointsY;
+    commitGridData(splinesAlongX, splinesAlongY);
+    return true;
+}
+
+template <class T>
+MemoryArena& ParametricSurfaceGridT<T>::beginGridData()
+{
+    // the inactive arena only holds splines that were replaced by the last commit, so it can be dropped as a whole
+    MemoryArena& arena = _arenas[1 - _activeArena];
+    arena.reset();
+    return arena;
+}
+
+template <class T>
+void ParametricSurfaceGridT<T>::layoutChanged()
+{
+    _layoutRevision = ++_revision;
+    _rowRevisions.assign(_splinesAlongY.size(), _revision);
+    _columnRevisions.assign(_splinesAlongX.size(), _revision);
+}
+
+template <class T>
+void ParametricSurfaceGridT<T>::splinesChanged(int row, int col)
+{
+    _revision++;
+    _rowRevisions[row] = _revision;
+    _columnRevisions[col] = _revision;
+}
+
+// First and one past the last index of the axis table whose patch is bounded by control point i. The patches of a table
+// only grow along the axis, so the range is contiguous.
+template <class T>
+static void axisRange(const std::vector<int>& i0, const std::vector<int>& i1, int i, int& begin, int& end)
+{
+    int size = i0.size();
+    begin = 0;
+    while (begin < size && i1[begin] < i) {
+        begin++;
+    }
+    end = begin;
+    while (end < size && i0[end] <= i) {
+        end++;
+    }
+}
+
+// Longest run of consecutive entries of an axis table that share their patch.
+static int longestPatchRun(const std::vector<int>& i0, const std::vector<int>& i1)
+{
+    int longest = 0;
+    for (size_t begin = 0; begin < i0.size();) {
+        size_t end = begin + 1;
+        while (end < i0.size() && i0[end] == i0[begin] && i1[end] == i1[begin]) {
+            end++;
+        }
+        longest = std::max<int>(longest, end - begin);
+        begin = end;
+    }
+    return longest;
+}
+
+template <class T>
+void ParametricSurfaceGridT<T>::pixelRowsOfRow(int row, int& y0, int& y1)
+{
+    axisRange<T>(_rowTable.i0, _rowTable.i1, row, y0, y1);
+}
+
+template <class T>
+void ParametricSurfaceGridT<T>::pixelColumnsOfColumn(int col, int& x0, int& x1)
+{
+    axisRange<T>(_columnTable.i0, _columnTable.i1, col, x0, x1);
+}
+
+template <class T>
+void ParametricSurfaceGridT<T>::buildAxisTables()
+{
+    int width = pixelWidth();
+    int height = pixelHeight();
+    _columnTable.resize(width);
+    _rowTable.resize(height);
+    // same computation as surfacePoint() does for the pixel, so that table driven generation matches it exactly
+    for (int x = 0; x < width; ++x) {
+        int row, row1;
+        T nv;
+        locatePatch(x / (T)width, 0, row, row1, _columnTable.i0[x], _columnTable.i1[x], _columnTable.t[x], nv);
+    }
+    for (int y = 0; y < height; ++y) {
+        int col, col1;
+        T nu;
+        locatePatch(0, y / (T)height, _rowTable.i0[y], _rowTable.i1[y], col, col1, nu, _rowTable.t[y]);
+    }
+    _maxPatchSpan =
+        std::max(longestPatchRun(_columnTable.i0, _columnTable.i1), longestPatchRun(_rowTable.i0, _rowTable.i1));
+}
+
+template <class T>
+void ParametricSurfaceGridT<T>::createGridData()
+{
+    MemoryArena& arena = beginGridData();
+    SplineVector splinesAlongX{ArenaAllocator<Spline>(&arena)};
+    SplineVector splinesAlongY{ArenaAllocator<Spline>(&arena)};
     int width = pixelWidth();
     int height = pixelHeight();
     _numControlPointsX = std::max<int>(3, 1 + std::ceil(width / (float)_gridXControlPointResolution));
     _numControlPointsY = std::max<int>(3, 1 + std::ceil(height / (float)_gridYControlPointResolution));
+    splinesAlongY.reserve(_numControlPointsY);
+    splinesAlongX.reserve(_numControlPointsX);
+    tk::arena_vector<T> x(std::max(_numControlPointsX, _numControlPointsY), 0.0, ArenaAllocator<T>(&arena));
+    tk::arena_vector<T> y(x.size(), 0.0, ArenaAllocator<T>(&arena));
 
     // create horizontal splines, along y axis
     for (int j = 0; j < _numControlPointsY; ++j) {
-        int ycoord = std::min(height, j * _gridYControlPointResolution);
-        tk::spline spline(false);
-        std::vector<double> x, y;
+        T ycoord = std::min<T>(height, j * _gridYControlPointResolution);
         for (int i = 0; i < _numControlPointsX; ++i) {
-            int xcoord = std::min(width, i * _gridXControlPointResolution);
-            x.push_back(xcoord);
-            y.push_back(ycoord);
+            T xcoord = std::min<T>(width, i * _gridXControlPointResolution);
+            x[i] = xcoord;
+            y[i] = ycoord;
         }
-        spline.set_points(x, y);
-        _splinesAlongY.push_back(spline);
+        splinesAlongY.emplace_back(false, &arena);
+        splinesAlongY.back().set_points(x.data(), y.data(), _numControlPointsX);
     }
 
     for (int j = 0; j < _numControlPointsX; ++j) {
-        int xcoord = std::min(width, j * _gridXControlPointResolution);
-        tk::spline spline(false);
-        std::vector<double> x, y;
+        T xcoord = std::min<T>(width, j * _gridXControlPointResolution);
         for (int i = 0; i < _numControlPointsY; ++i) {
-            int ycoord = std::min(height, i * _gridYControlPointResolution);
-            x.push_back(ycoord);
-            y.push_back(xcoord);
+            T ycoord = std::min<T>(height, i * _gridYControlPointResolution);
+            x[i] = ycoord;
+            y[i] = xcoord;
         }
-        spline.set_points(x, y);
-        _splinesAlongX.push_back(spline);
+        splinesAlongX.emplace_back(false, &arena);
+        splinesAlongX.back().set_points(x.data(), y.data(), _numControlPointsY);
     }
-    assert(_splinesAlongY.size() == _numControlPointsY);
-    assert(_splinesAlongX.size() == _numControlPointsX);
+    commitGridData(splinesAlongX, splinesAlongY);
+    assert((int)_splinesAlongY.size() == _numControlPointsY);
+    assert((int)_splinesAlongX.size() == _numControlPointsX);
 }
 
-vec2d ParametricSurfaceGrid::surfacePoint(double u, double v)
+// Finds the control point interval along one axis of the grid for the scaled coordinate coord = t * size / resolution.
+// i0 and i1 are the control points bounding the interval, equal when coord lies exactly on a control point, and nt is
+// the position inside the interval, stretched over the narrower last interval. Coordinates outside the grid are clamped
+// to the first or last interval and extrapolate.
+template <class T>
+static void locateAxis(T coord, int size, T resolution, int numControlPoints, int& i0, int& i1, T& nt)
+{
+    int last = numControlPoints - 1;
+    if (coord < 0) {
+        i0 = 0;
+        i1 = 1;
+    } else if (std::ceil(coord) > last) {
+        i0 = last - 1;
+        i1 = last;
+    } else {
+        i0 = std::floor(coord);
+        i1 = std::ceil(coord);
+    }
+    nt = coord - i0;
+    if (i1 == last) {
+        // fraction of a full interval covered by the last one, the same as the fractional part of size / resolution
+        // but robust to a ratio that only misses an integer by rounding, as after a resize
+        T s = size / resolution - (last - 1);
+        if (s > 0 && s < 1) {
+            nt /= s;
+        }
+    }
+}
+
+template <class T>
+void ParametricSurfaceGridT<T>::locatePatch(T u, T v, int& row, int& row1, int& col, int& col1, T& nu, T& nv)
 {
-    // first step is to know which 4 splines to use, depending on where u,v coordinates are
     int width = pixelWidth();
     int height = pixelHeight();
-    double coordRow = (v * height / _gridYControlPointResolution);
-    double coordCol = (u * width / _gridXControlPointResolution);
-    int row = std::floor(coordRow);
-    int col = std::floor(coordCol);
-    int col1 = std::ceil(coordCol);
-    int row1 = std::ceil(coordRow);
-
-    const tk::spline& spU0 = _splinesAlongX[col];
-    const tk::spline& spU1 = _splinesAlongX[col1];
-    const tk::spline& spV0 = _splinesAlongY[row];
-    const tk::spline& spV1 = _splinesAlongY[row1];
-    vec2d p00 = controlPointPosition(row, col);
-    vec2d p10 = controlPointPosition(row, col1);
-    vec2d p11 = controlPointPosition(row1, col1);
-    vec2d p01 = controlPointPosition(row1, col);
-    double nv = coordRow - row;
-    double nu = coordCol - col;
-    if (row1 == _splinesAlongY.size() - 1) {
-        double intpart;
-        double s = std::modf(height / (double)_gridYControlPointResolution, &intpart);
-        if (s > 0) {
-            nv /= s;
-        }
-    }
-    if (col1 == _splinesAlongX.size() - 1) {
-        double intpart;
-        double s = modf(width / (double)_gridXControlPointResolution, &intpart);
-        if (s > 0) {
-            nu /= s;
+    T coordRow = (v * height / _gridYControlPointResolution);
+    T coordCol = (u * width / _gridXControlPointResolution);
+    locateAxis(coordRow, height, _gridYControlPointResolution, _splinesAlongY.size(), row, row1, nv);
+    locateAxis(coordCol, width, _gridXControlPointResolution, _splinesAlongX.size(), col, col1, nu);
+}
+
+template <class T>
+vec2<T> ParametricSurfaceGridT<T>::evaluatePatch(int row, int row1, int col, int col1, T nu, T nv)
+{
+    const Spline& spU0 = _splinesAlongX[col];
+    const Spline& spU1 = _splinesAlongX[col1];
+    const Spline& spV0 = _splinesAlongY[row];
+    const Spline& spV1 = _splinesAlongY[row1];
+    vec2<T> p00 = controlPointPosition(row, col);
+    vec2<T> p10 = controlPointPosition(row, col1);
+    vec2<T> p11 = controlPointPosition(row1, col1);
+    vec2<T> p01 = controlPointPosition(row1, col);
+
+    return generateSplinePatch(nu, nv, spU0, spU1, spV0, spV1, p00, p01, p10, p11);
+}
+
+template <class T>
+vec2<T> ParametricSurfaceGridT<T>::surfacePoint(T u, T v)
+{
+    // first step is to know which 4 splines to use, depending on where u,v coordinates are
+    int row, row1, col, col1;
+    T nu, nv;
+    locatePatch(u, v, row, row1, col, col1, nu, nv);
+    return evaluatePatch(row, row1, col, col1, nu, nv);
+}
+
+template <class T>
+void ParametricSurfaceGridT<T>::surfacePoints(const T* uv, size_t count, T* out, int numThreads)
+{
+    // locate every point once and bin the points by patch with a counting sort, so that points of the same patch are
+    // evaluated together
+    struct Location {
+        int row, row1, col, col1;
+        T nu, nv;
+    };
+    int numPatchesX = _numControlPointsX - 1;
+    int numPatches = numPatchesX * (_numControlPointsY - 1);
+    std::vector<Location> location(count);
+    std::vector<size_t> binStart(numPatches + 1, 0);
+    for (size_t i = 0; i < count; ++i) {
+        Location& l = location[i];
+        locatePatch(uv[2 * i], uv[2 * i + 1], l.row, l.row1, l.col, l.col1, l.nu, l.nv);
+        binStart[std::min(l.row, _numControlPointsY - 2) * numPatchesX + std::min(l.col, numPatchesX - 1) + 1]++;
+    }
+    for (int i = 0; i < numPatches; ++i) {
+        binStart[i + 1] += binStart[i];
+    }
+    // the sorted copy keeps the evaluation pass reading sequentially
+    std::vector<std::pair<Location, size_t>> sorted(count);
+    for (size_t i = 0; i < count; ++i) {
+        const Location& l = location[i];
+        sorted[binStart[std::min(l.row, _numControlPointsY - 2) * numPatchesX + std::min(l.col, numPatchesX - 1)]++] =
+            std::make_pair(l, i);
+    }
+
+    // evaluate in bin order and scatter the results back to the input order
+    const size_t chunkSize = 4096;
+    int numChunks = (count + chunkSize - 1) / chunkSize;
+    parallelFor(numChunks, numThreads, [&](int chunk) {
+        size_t end = std::min(count, (chunk + 1) * chunkSize);
+        for (size_t i = chunk * chunkSize; i < end; ++i) {
+            const Location& l = sorted[i].first;
+            size_t index = sorted[i].second;
+            vec2<T> point = evaluatePatch(l.row, l.row1, l.col, l.col1, l.nu, l.nv);
+            out[2 * index] = point.x;
+            out[2 * index + 1] = point.y;
         }
+    });
+}
+
+template <class T>
+void ParametricSurfaceGridT<T>::surfacePoints(const std::vector<vec2<T>>& uv, std::vector<vec2<T>>& out,
+                                              int numThreads)
+{
+    static_assert(sizeof(vec2<T>) == 2 * sizeof(T), "vec2 must be two packed scalars");
+    out.resize(uv.size());
+    surfacePoints(&uv.data()->x, uv.size(), &out.data()->x, numThreads);
+}
+
+template <class T>
+vec2<T> ParametricSurfaceGridT<T>::surfacePoint(const vec2<T>& point) { return surfacePoint(point.x, point.y); }
+
+static void hashBytes(uint64_t& hash, const void* data, size_t size)
+{
+    // FNV-1a
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
     }
+}
 
-    return generateSplinePatch(nu, nv, spU0, spU1, spV0, spV1, p00, p01, p10, p11);
+template <class T>
+static void hashSpline(uint64_t& hash, tk::basic_spline<T>& spline)
+{
+    bool isLinear = spline.isLinear();
+    hashBytes(hash, &isLinear, sizeof(isLinear));
+    for (unsigned int i = 0; i < spline.getNumPoints(); ++i) {
+        T point[2];
+        spline.get_point(i, point[0], point[1]);
+        hashBytes(hash, point, sizeof(point));
+    }
+}
+
+template <class T>
+uint64_t ParametricSurfaceGridT<T>::stateHash()
+{
+    uint64_t hash = 14695981039346656037ull;
+    T layout[4] = {pixelOrigin().x, pixelOrigin().y, _state.rectangle.width(), _state.rectangle.height()};
+    T resolution[2] = {_gridXControlPointResolution, _gridYControlPointResolution};
+    hashBytes(hash, layout, sizeof(layout));
+    hashBytes(hash, resolution, sizeof(resolution));
+    for (Spline& spline : _splinesAlongY) {
+        hashSpline(hash, spline);
+    }
+    for (Spline& spline : _splinesAlongX) {
+        hashSpline(hash, spline);
+    }
+    return hash;
 }
 
-vec2d ParametricSurfaceGrid::surfacePoint(const vec2d& point) { return surfacePoint(point.x, point.y); }
+template <class T>
+void ParametricSurfaceGridT<T>::stateKey(std::vector<T>& key)
+{
+    key.assign({pixelOrigin().x, pixelOrigin().y, (T)_state.rectangle.width(), (T)_state.rectangle.height(),
+                _gridXControlPointResolution, _gridYControlPointResolution});
+    for (SplineVector* splines : {&_splinesAlongY, &_splinesAlongX}) {
+        for (Spline& spline : *splines) {
+            key.push_back(spline.isLinear());
+            for (unsigned int i = 0; i < spline.getNumPoints(); ++i) {
+                T x, y;
+                spline.get_point(i, x, y);
+                key.push_back(x);
+                key.push_back(y);
+            }
+        }
+    }
+}
 
-void ParametricSurfaceGrid::setGridResolution(int resX, int resY)
+template <class T>
+void ParametricSurfaceGridT<T>::setGridResolution(int resX, int resY)
 {
-    rebuildGridData(resX, resY);
+    changeGridResolution(resX, resY);
 }
 
-void ParametricSurfaceGrid::setGridResolutionY(int resY)
+template <class T>
+void ParametricSurfaceGridT<T>::setGridResolutionY(int resY)
 {
-    setGridResolution(_gridXControlPointResolution, resY);
+    changeGridResolution(_gridXControlPointResolution, resY);
 }
 
-void ParametricSurfaceGrid::setGridResolutionX(int resX)
+template <class T>
+void ParametricSurfaceGridT<T>::setGridResolutionX(int resX)
 {
-    setGridResolution(resX, _gridYControlPointResolution);
+    changeGridResolution(resX, _gridYControlPointResolution);
 }
 
+template <class T>
+void ParametricSurfaceGridT<T>::changeGridResolution(T resX, T resY)
+{
+    if (!refineGridData(resX, resY)) {
+        rebuildGridData(resX, resY);
+    }
+}
 
+template class ParametricSurfaceGridT<float>;
+template class ParametricSurfaceGridT<double>;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
 
 #include <IParametricSurface.h>
@@ -7,64 +8,270 @@
 #include "vec2.h"
 #include "rect.h"
 #include "spline.h"
+#include "MemoryArena.h"
+#include "PageAllocator.h"
+#include "SurfaceMesh.h"
 
-struct State {
-    rect rectangle;
-    std::vector<double> surfacePoints;
+// Sample map storage. Maps placed following a PagePolicy are kept apart, see generatePlacedSurfacePoints().
+template <class T>
+using SurfacePointsT = std::vector<T>;
+typedef SurfacePointsT<double> SurfacePoints;
+
+template <class T>
+struct StateT {
+    rectT<T> rectangle;
+    SurfacePointsT<T> surfacePoints;
 };
 
-// Represents a parametric surface that is composed by a grid of splines of which controlpoints are coincident
-class ParametricSurfaceGrid : public IParametricSurface {
+typedef StateT<double> State;
+
+// Represents a parametric surface that is composed by a grid of splines of which controlpoints are coincident.
+// Templated on the scalar type of the splines and of the sample map; ParametricSurfaceGridf stores and evaluates in
+// float, which halves the memory of the map, at errors of about 1e-3 pixel on 4K maps. The map modules built on the
+// grid (tiled, compressed, shared, animation, composition, cache, manager) take the double grid only.
+template <class T>
+class ParametricSurfaceGridT : public IParametricSurfaceT<T> {
 public:
+    typedef tk::basic_spline<T> Spline;
+
     // Intialized the parametric surface using numControlPointsX * numControlPointsY control points.
     // Control points are initialize uniformily spaced, but can be manipulated using setControlPointPosition().
     // \param pixelWidth: the width of the grid, in pixels!
     // \param pixelHeight: the height of the grid, in pixels!
     // \param gridXControlPointResolution: the pixel resolution of controlpoints in between spacing in X axis
     // \param gridYControlPointResolution: the pixel resolution of controlpoints in between spacing in Y axis
-    ParametricSurfaceGrid(const vec2d& pixelOrigin, double pixelWidth, double pixelHeight,
+    ParametricSurfaceGridT(const vec2<T>& pixelOrigin, T pixelWidth, T pixelHeight,
                           int gridXControlPointResolution, int gridYControlPointResolution);
-    virtual vec2d surfacePoint(double u, double v);
-    virtual vec2d surfacePoint(const vec2d& point);
+    // Copies do not share spline storage: the copied splines live on the heap until the copy rebuilds its grid data
+    // into its own arenas. Assignment copies the splines into the inactive arena of this grid and commits them like a
+    // rebuild, which also counts as a layout change of this grid. Declaring these also makes moves copy, as spline
+    // storage cannot leave its arena.
+    ParametricSurfaceGridT(const ParametricSurfaceGridT& other) = default;
+    ParametricSurfaceGridT& operator=(const ParametricSurfaceGridT& other);
+    virtual vec2<T> surfacePoint(T u, T v);
+    virtual vec2<T> surfacePoint(const vec2<T>& point);
+    // Evaluates surfacePoint() at count (u, v) pairs, interleaved in uv, and writes the results interleaved to out in
+    // input order. Points are binned by patch first and evaluated bin after bin, so scattered queries keep the splines
+    // of one patch hot in cache instead of jumping between patches; bins are spread over numThreads threads.
+    void surfacePoints(const T* uv, size_t count, T* out, int numThreads = 1);
+    void surfacePoints(const std::vector<vec2<T>>& uv, std::vector<vec2<T>>& out, int numThreads = 1);
 
     // Regenerate the grid in the given DPI resolution. This affects pixelWidth() and pixelHeight()
     int pixelWidth() { return _state.rectangle.width(); }
     int pixelHeight() { return _state.rectangle.height(); }
+    // Resizing keeps the surface: knots and coefficients of every spline are rescaled analytically, along with the grid
+    // resolution, so the control points stay at the same relative positions and nothing is resampled or refitted. A
+    // shrink that would bring control points closer than Spline::min_point_spacing, or the resolution below
+    // minGridResolution, creates the grid anew for the new size instead.
     void setPixelWidth(int width);
     void setPixelHeight(int height);
     void setPixelSize(int width, int height);
+    // When the current resolution is an integer multiple of the new one, the grid is refined by knot insertion: the
+    // existing splines keep their functions and only the new rows and columns are fitted. Other resolution changes
+    // resample the surface.
     void setGridResolution(int resX, int resY);
     void setGridResolutionX(int resX);
     void setGridResolutionY(int resY);
-    void setControlPointPosition(int row, int col, const vec2d& point);
-    void moveControlPoint(int row, int col, const vec2d& delta);
+    void setControlPointPosition(int row, int col, const vec2<T>& point);
+    void moveControlPoint(int row, int col, const vec2<T>& delta);
+    // Sets all control points at once, numControlPointsY() rows of numControlPointsX() points, and refits every spline
+    // only once instead of once per point. Points closer than Spline::min_point_spacing to their left or upper
+    // neighbour are pushed right or down to that distance.
+    void setControlPointPositions(const std::vector<vec2<T>>& points);
+    void controlPointPositions(std::vector<vec2<T>>& points);
     //
     // Retrieves the control point in local space (relative to pixelOrigin())
-    vec2d controlPointPosition(int row, int col);
+    vec2<T> controlPointPosition(int row, int col);
 
-    vec2d pixelOrigin() { return _state.rectangle.getOrigin(); }
-    void setPixelOrigin(const vec2d& origin) { _state.rectangle.moveTo(origin); }
+    vec2<T> pixelOrigin() { return _state.rectangle.getOrigin(); }
+    void setPixelOrigin(const vec2<T>& origin)
+    {
+        _state.rectangle.moveTo(origin);
+        layoutChanged();
+    }
+    // Control point spacing in pixels. Fractional after a resize, which scales it with the pixel size.
+    T gridResolutionX() { return _gridXControlPointResolution; }
+    T gridResolutionY() { return _gridYControlPointResolution; }
+    // smallest control point spacing the constructor accepts
+    static constexpr int minGridResolution = 5;
     int numControlPointsX() { return _numControlPointsX; }
     int numControlPointsY() { return _numControlPointsY; }
-    tk::spline& rowSpline(int row) { return _splinesAlongY[row]; }
-    tk::spline& colSpline(int col) { return _splinesAlongX[col]; }
-    State& getState() { return _state; }
+    Spline& rowSpline(int row) { return _splinesAlongY[row]; }
+    Spline& colSpline(int col) { return _splinesAlongX[col]; }
+    StateT<T>& getState() { return _state; }
+    // Replaces the whole grid by copies of the given row and column splines, laid out over a pixel rectangle at the
+    // given control point resolution, as read back from another grid. Used to restore snapshots; the sample map is left
+    // as is. Defined here, like everything taking splines, since tk is private to each translation unit.
+    void setGridData(const rectT<T>& rectangle, T gridXRes, T gridYRes, const std::vector<const Spline*>& rowSplines,
+                     const std::vector<const Spline*>& colSplines)
+    {
+        assert(rowSplines.size() >= 2 && colSplines.size() >= 2);
+        MemoryArena& arena = beginGridData();
+        SplineVector splinesAlongX{ArenaAllocator<Spline>(&arena)};
+        SplineVector splinesAlongY{ArenaAllocator<Spline>(&arena)};
+        splinesAlongY.reserve(rowSplines.size());
+        splinesAlongX.reserve(colSplines.size());
+        // assigning into splines constructed on the arena keeps their storage in it
+        for (const Spline* spline : rowSplines) {
+            splinesAlongY.emplace_back(false, &arena);
+            splinesAlongY.back() = *spline;
+        }
+        for (const Spline* spline : colSplines) {
+            splinesAlongX.emplace_back(false, &arena);
+            splinesAlongX.back() = *spline;
+        }
+        _state.rectangle = rectangle;
+        _gridXControlPointResolution = gridXRes;
+        _gridYControlPointResolution = gridYRes;
+        _numControlPointsX = colSplines.size();
+        _numControlPointsY = rowSplines.size();
+        commitGridData(splinesAlongX, splinesAlongY);
+    }
+    // 64 bit hash of everything the sample map depends on: pixel origin and size, grid resolution, control points of
+    // all row and column splines and their linear flags. Equal grids hash equal; use it to detect a changed grid state.
+    uint64_t stateHash();
+    // The data stateHash() hashes, flattened into key, for users that must tell apart states whose hashes collide.
+    void stateKey(std::vector<T>& key);
+    // Revision counters, to find out which part of the sample map changed since it was generated. revision() grows with
+    // every change of the grid. rowRevision() and columnRevision() are the revision of the last change of one row or
+    // column spline, and layoutRevision() the one of the last change of the pixel origin, size or grid resolution,
+    // which affects the whole map. Splines modified directly through rowSpline() or colSpline() are not tracked.
+    uint64_t revision() { return _revision; }
+    uint64_t layoutRevision() { return _layoutRevision; }
+    uint64_t rowRevision(int row) { return _rowRevisions[row]; }
+    uint64_t columnRevision(int col) { return _columnRevisions[col]; }
+    // The pixel rows [y0, y1) of the sample map whose samples depend on row spline row, and the pixel columns [x0, x1)
+    // whose samples depend on column spline col. Empty ranges have y0 == y1 or x0 == x1.
+    void pixelRowsOfRow(int row, int& y0, int& y1);
+    void pixelColumnsOfColumn(int col, int& x0, int& x1);
     // Generates the sample map between the rectangular pixel space and the surface space. Retrieves a vector containing
-    // x,y positions for each pixel of the pixelWidth() x pixelHeight() grid.
-    const std::vector<double>& generateSurfacePoints();
+    // x,y positions for each pixel of the pixelWidth() x pixelHeight() grid. The map is generated in tiles of
+    // generationTileSize pixels, spread over numThreads() threads.
+    const SurfacePointsT<T>& generateSurfacePoints();
+    static const int generationTileSize = 128;
+    int numThreads() { return _numThreads; }
+    // 0 means one thread per hardware thread
+    void setNumThreads(int numThreads) { _numThreads = numThreads; }
+    // Generates the same map as generateSurfacePoints() into a buffer of the grid placed following mapPagePolicy(),
+    // instead of into getState().surfacePoints, which stays a plain std::vector for the modules and callers taking it
+    // as one. Maps of 8K and more span hundreds of megabytes, where huge pages cut TLB misses; with first touch, whole
+    // bands of rows are handed out per thread so each band's pages land on the NUMA node of the worker that generated
+    // it.
+    const PageVector<T>& generatePlacedSurfacePoints();
+    // Setting a policy releases the placed map.
+    void setMapPagePolicy(const PagePolicy& policy) { _placedSurfacePoints = PageVector<T>(PageAllocator<T>(policy)); }
+    PagePolicy mapPagePolicy() const { return _placedSurfacePoints.get_allocator().policy(); }
+    // Generates the tileWidth x tileHeight block of the sample map starting at pixel (x0, y0) into out, using the same
+    // x,y interleaved layout as generateSurfacePoints(). rowStride is the distance between rows of out, in
+    // scalars.
+    // Only reads the grid, so distinct tiles can be generated concurrently.
+    void generateSurfaceTile(int x0, int y0, int tileWidth, int tileHeight, T* out, size_t rowStride);
+    // True when every row and column spline is linear. The surface is then piecewise bilinear and generateSurfaceTile()
+    // switches to a scanline kernel that needs no spline lookups per pixel.
+    bool allSplinesLinear();
+
+    // Tessellates every patch into subdivisions x subdivisions cells of two triangles, with vertices on the surface.
+    void tessellate(int subdivisions, SurfaceMesh& mesh);
+    // Tessellates with the fewest subdivisions, up to maxSubdivisions, whose error is bounded by maxError pixels. The
+    // bound comes from the first and second derivatives of the splines over each patch, not from sampling, and is
+    // recomputed once per revision(). Returns the subdivisions used and stores the bound for them in error; it exceeds
+    // maxError when even maxSubdivisions is too coarse.
+    int tessellateWithinError(double maxError, SurfaceMesh& mesh, int maxSubdivisions = 64, double* error = nullptr);
+    // Approximates generateSurfacePoints() by rasterizing a tessellation within maxError pixels of the surface, for
+    // grids too coarse for the patch kernels of generateSurfaceTile(); below that the exact kernels are faster and the
+    // map is generated by generateSurfacePoints(). So is it when cells of at least 4 pixels cannot meet maxError.
+    const SurfacePointsT<T>& generateSurfacePointsTessellated(double maxError, int numThreads = 1);
 
 
 protected:
+    typedef std::vector<Spline, ArenaAllocator<Spline>> SplineVector;
+
     void createGridData();
-    void rebuildGridData(int gridXRes = 0, int gridYRes = 0, int gridWidth = 0, int gridHeight = 0);
+    // Whether scaling the knots by sx, sy keeps them Spline::min_point_spacing apart and the resolution at least
+    // minGridResolution.
+    bool canScaleGrid(T sx, T sy);
+    void rebuildGridData(T gridXRes = 0, T gridYRes = 0, int gridWidth = 0, int gridHeight = 0);
+    // Refines the grid to the given resolutions by knot insertion. Returns false, leaving the grid untouched, unless
+    // both current resolutions are integer multiples of the new ones.
+    bool refineGridData(T gridXRes, T gridYRes);
+    void changeGridResolution(T gridXRes, T gridYRes);
+    // Spline storage is double buffered between two arenas: new grid data is built in the inactive arena while the
+    // current splines are still readable, then swapped in. The previous arena is reset wholesale on the next rebuild.
+    MemoryArena& beginGridData();
+    void commitGridData(SplineVector& splinesAlongX, SplineVector& splinesAlongY)
+    {
+        // allocators are swapped along with the contents, so the members now point to the new arena
+        _splinesAlongX.swap(splinesAlongX);
+        _splinesAlongY.swap(splinesAlongY);
+        _activeArena = 1 - _activeArena;
+        buildAxisTables();
+        layoutChanged();
+    }
+    // Patch locations of every pixel column and row of the sample map, as surfacePoint() finds them. They only depend
+    // on the pixel size and the grid resolution, so they are rebuilt whenever grid data is committed and shared by all
+    // map generation instead of being recomputed per pixel.
+    struct AxisTable {
+        std::vector<int> i0, i1;
+        std::vector<T> t;
+        void resize(int size)
+        {
+            i0.resize(size);
+            i1.resize(size);
+            t.resize(size);
+        }
+    };
+    void buildAxisTables();
+    // Revision bookkeeping, see revision().
+    void layoutChanged();
+    void splinesChanged(int row, int col);
+    // Locates the patch of (u, v): the bounding row and column control points and the position inside the patch.
+    void locatePatch(T u, T v, int& row, int& row1, int& col, int& col1, T& nu, T& nv);
+    vec2<T> evaluatePatch(int row, int row1, int col, int col1, T nu, T nv);
+    // generateSurfaceTile() for all-linear grids. Evaluates the patch expressions of surfacePoint() with the spline
+    // segments resolved once per scanline span, in a branch free loop the compiler can vectorize. Results are identical
+    // to surfacePoint(); the few samples that fall on a knot are evaluated by surfacePoint() itself.
+    void generateLinearTile(int x0, int y0, int tileWidth, int tileHeight, T* out, size_t rowStride);
+    // generateSurfaceTile() for grids whose control points are at most Span pixels apart, Span being a power of two.
+    // Walks the tile patch by patch: inside a patch the column splines only depend on the pixel row and the row splines
+    // on the pixel column, so each is evaluated once per row or column of the patch instead of once per pixel, and the
+    // per pixel blend runs over fixed size buffers without branches. Results are identical to surfacePoint().
+    static constexpr int maxPatchKernelSpan = 64;
+    template <int Span>
+    void generatePatchTile(int x0, int y0, int tileWidth, int tileHeight, T* out, size_t rowStride);
+    // Generates the map into data, of pixelWidth() x pixelHeight() samples, in bands of rows when firstTouch is set.
+    void generateSurfacePoints(T* data, bool firstTouch);
+    // Pixel coordinates of the tessellation vertices along one axis, subdivisions per patch.
+    void tessellationAxis(int subdivisions, bool alongX, std::vector<double>& coords);
+    // Bound on the distance between the surface and a tessellation of one cell per patch; subdivisions divide it by
+    // their square.
+    double tessellationBound();
 
 protected:
-    State _state;
-    int _gridXControlPointResolution;
-    int _gridYControlPointResolution;
+    StateT<T> _state;
+    PageVector<T> _placedSurfacePoints;
+    T _gridXControlPointResolution;
+    T _gridYControlPointResolution;
     int _numControlPointsX;
     int _numControlPointsY;
-    std::vector<tk::spline> _splinesAlongX;
-    std::vector<tk::spline> _splinesAlongY;
+    int _numThreads;
+    MemoryArena _arenas[2];
+    int _activeArena;
+    SplineVector _splinesAlongX;
+    SplineVector _splinesAlongY;
+    AxisTable _columnTable;
+    AxisTable _rowTable;
+    // most pixels of one row or column of the map that fall in the same patch, see buildAxisTables()
+    int _maxPatchSpan;
+    uint64_t _revision;
+    uint64_t _layoutRevision;
+    std::vector<uint64_t> _rowRevisions;
+    std::vector<uint64_t> _columnRevisions;
+    // scratch of setControlPointPositions(), so that animation frames do not allocate
+    typename Spline::batch_workspace _refitWorkspace;
+    // tessellationBound() of revision _tessellationBoundRevision
+    double _tessellationBound;
+    uint64_t _tessellationBoundRevision;
 };
 
+typedef ParametricSurfaceGridT<double> ParametricSurfaceGrid;
+typedef ParametricSurfaceGridT<float> ParametricSurfaceGridf;
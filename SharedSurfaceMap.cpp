@@ -0,0 +1,274 @@
+#include "SharedSurfaceMap.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ParallelFor.h"
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory sequence numbers must be lock free");
+
+static const char kMagic[8] = {'S', 'P', 'L', 'S', 'H', 'M', '0', '1'};
+static const uint32_t kVersion = 1;
+
+static size_t alignToPage(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (size + page - 1) / page * page;
+}
+
+DirtyRect DirtyRect::united(const DirtyRect& other) const
+{
+    if (isEmpty()) {
+        return other;
+    }
+    if (other.isEmpty()) {
+        return *this;
+    }
+    int x0 = std::min(x, other.x);
+    int y0 = std::min(y, other.y);
+    int x1 = std::max(x + width, other.x + other.width);
+    int y1 = std::max(y + height, other.y + other.height);
+    return DirtyRect(x0, y0, x1 - x0, y1 - y0);
+}
+
+DirtyRect DirtyRect::clipped(int mapWidth, int mapHeight) const
+{
+    int x0 = std::max(0, x);
+    int y0 = std::max(0, y);
+    int x1 = std::min(mapWidth, x + width);
+    int y1 = std::min(mapHeight, y + height);
+    return DirtyRect(x0, y0, std::max(0, x1 - x0), std::max(0, y1 - y0));
+}
+
+SharedSurfaceMapPublisher::SharedSurfaceMapPublisher(const std::string& name, int width, int height, int numSlots)
+    : _name(name), _mapping(nullptr), _mappingSize(0), _header(nullptr)
+{
+    numSlots = std::max(2, std::min<int>(numSlots, SharedSurfaceMapHeader::maxSlots));
+    size_t slotBytes = alignToPage((size_t)width * height * 2 * sizeof(double));
+    size_t dataOffset = alignToPage(sizeof(SharedSurfaceMapHeader));
+    size_t size = dataOffset + numSlots * slotBytes;
+
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        return;
+    }
+    if (ftruncate(fd, size) != 0) {
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return;
+    }
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return;
+    }
+    // the object starts zero filled, so every slot and history entry starts at sequence 0: empty
+    _mapping = mapping;
+    _mappingSize = size;
+    _header = static_cast<SharedSurfaceMapHeader*>(mapping);
+    _header->version = kVersion;
+    _header->numSlots = numSlots;
+    _header->width = width;
+    _header->height = height;
+    _header->slotBytes = slotBytes;
+    _header->dataOffset = dataOffset;
+    // the magic goes last, subscribers check it before trusting the rest of the header
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(_header->magic, kMagic, sizeof(kMagic));
+}
+
+SharedSurfaceMapPublisher::~SharedSurfaceMapPublisher()
+{
+    if (_mapping) {
+        munmap(_mapping, _mappingSize);
+        shm_unlink(_name.c_str());
+    }
+}
+
+template <class WriteRegion>
+uint64_t SharedSurfaceMapPublisher::publishRegion(const DirtyRect& changed, WriteRegion writeRegion)
+{
+    SharedSurfaceMapHeader& header = *_header;
+    int width = header.width;
+    int height = header.height;
+    DirtyRect dirty = changed.clipped(width, height);
+    uint64_t sequence = header.latestSequence.load(std::memory_order_relaxed) + 1;
+    SharedSurfaceMapHeader::Slot& slot = header.slots[sequence % header.numSlots];
+    double* data = reinterpret_cast<double*>(static_cast<char*>(_mapping) + header.dataOffset +
+                                             (sequence % header.numSlots) * header.slotBytes);
+
+    // The slot still holds an older map, so besides this change it misses every change published since then. Those
+    // are in the history; if the slot never held a map or the history does not reach back that far, rewrite it all.
+    uint64_t held = slot.sequence.load(std::memory_order_relaxed);
+    DirtyRect region = dirty;
+    if (held == 0 || sequence - held > SharedSurfaceMapHeader::historySize) {
+        region = DirtyRect(0, 0, width, height);
+    } else {
+        for (uint64_t s = held + 1; s < sequence; ++s) {
+            const SharedSurfaceMapHeader::History& entry = header.history[s % SharedSurfaceMapHeader::historySize];
+            region = region.united(DirtyRect(entry.x, entry.y, entry.width, entry.height));
+        }
+    }
+
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    if (!region.isEmpty()) {
+        writeRegion(region, data);
+    }
+    SharedSurfaceMapHeader::History& entry = header.history[sequence % SharedSurfaceMapHeader::historySize];
+    entry.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    entry.x = dirty.x;
+    entry.y = dirty.y;
+    entry.width = dirty.width;
+    entry.height = dirty.height;
+    entry.sequence.store(sequence, std::memory_order_release);
+    slot.sequence.store(sequence, std::memory_order_release);
+    header.latestSequence.store(sequence, std::memory_order_release);
+    return sequence;
+}
+
+uint64_t SharedSurfaceMapPublisher::publish(ParametricSurfaceGrid& grid, const DirtyRect& dirty)
+{
+    assert(grid.pixelWidth() == (int)_header->width && grid.pixelHeight() == (int)_header->height);
+    size_t rowStride = (size_t)_header->width * 2;
+    return publishRegion(dirty, [&](const DirtyRect& region, double* data) {
+        // generate straight into the slot, there is no intermediate map to copy
+        parallelForTiles(region.width, region.height, ParametricSurfaceGrid::generationTileSize, grid.numThreads(),
+                         [&](int x0, int y0, int w, int h) {
+                             int x = region.x + x0;
+                             int y = region.y + y0;
+                             grid.generateSurfaceTile(x, y, w, h, data + y * rowStride + 2 * x, rowStride);
+                         });
+    });
+}
+
+uint64_t SharedSurfaceMapPublisher::publish(ParametricSurfaceGrid& grid)
+{
+    return publish(grid, DirtyRect(0, 0, _header->width, _header->height));
+}
+
+uint64_t SharedSurfaceMapPublisher::publish(const double* points, const DirtyRect& dirty)
+{
+    size_t rowStride = (size_t)_header->width * 2;
+    return publishRegion(dirty, [&](const DirtyRect& region, double* data) {
+        for (int y = region.y; y < region.y + region.height; ++y) {
+            const double* source = points + y * rowStride + 2 * region.x;
+            std::copy(source, source + 2 * region.width, data + y * rowStride + 2 * region.x);
+        }
+    });
+}
+
+SharedSurfaceMapSubscriber::SharedSurfaceMapSubscriber()
+    : _mapping(nullptr), _mappingSize(0), _header(nullptr), _width(0), _height(0), _numSlots(0), _slotBytes(0),
+      _dataOffset(0), _lastSequence(0)
+{
+}
+
+SharedSurfaceMapSubscriber::~SharedSurfaceMapSubscriber() { close(); }
+
+bool SharedSurfaceMapSubscriber::open(const std::string& name)
+{
+    close();
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SharedSurfaceMapHeader)) {
+        ::close(fd);
+        return false;
+    }
+    void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    const SharedSurfaceMapHeader* header = static_cast<const SharedSurfaceMapHeader*>(mapping);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // read once, then checked: slots must be within the header's slot array, hold a whole map, and fit the mapping
+    uint32_t width = header->width, height = header->height, numSlots = header->numSlots;
+    uint64_t slotBytes = header->slotBytes, dataOffset = header->dataOffset, size = info.st_size;
+    bool valid = std::memcmp(header->magic, kMagic, sizeof(kMagic)) == 0 && header->version == kVersion &&
+                 width <= INT32_MAX && height <= INT32_MAX && numSlots >= 1 &&
+                 numSlots <= SharedSurfaceMapHeader::maxSlots && dataOffset >= sizeof(SharedSurfaceMapHeader) &&
+                 dataOffset <= size && slotBytes <= (size - dataOffset) / numSlots &&
+                 (uint64_t)width * height * 2 * sizeof(double) <= slotBytes;
+    if (!valid) {
+        munmap(mapping, info.st_size);
+        return false;
+    }
+    _mapping = mapping;
+    _mappingSize = info.st_size;
+    _header = header;
+    _width = width;
+    _height = height;
+    _numSlots = numSlots;
+    _slotBytes = slotBytes;
+    _dataOffset = dataOffset;
+    _lastSequence = 0;
+    return true;
+}
+
+void SharedSurfaceMapSubscriber::close()
+{
+    if (_mapping) {
+        munmap(_mapping, _mappingSize);
+    }
+    _mapping = nullptr;
+    _mappingSize = 0;
+    _header = nullptr;
+}
+
+bool SharedSurfaceMapSubscriber::poll(SharedSurfaceMapFrame& frame)
+{
+    uint64_t latest = _header->latestSequence.load(std::memory_order_acquire);
+    if (latest == 0 || latest == _lastSequence) {
+        return false;
+    }
+    int slot = latest % _numSlots;
+    if (_header->slots[slot].sequence.load(std::memory_order_acquire) != latest) {
+        // already being overwritten by a newer publication, which the next poll picks up
+        return false;
+    }
+    DirtyRect full(0, 0, _width, _height);
+    DirtyRect dirty;
+    if (_lastSequence == 0 || latest - _lastSequence > SharedSurfaceMapHeader::historySize) {
+        dirty = full;
+    } else {
+        for (uint64_t s = _lastSequence + 1; s <= latest && !(dirty.width == full.width && dirty.height == full.height);
+             ++s) {
+            const SharedSurfaceMapHeader::History& entry = _header->history[s % SharedSurfaceMapHeader::historySize];
+            if (entry.sequence.load(std::memory_order_acquire) != s) {
+                dirty = full;
+                break;
+            }
+            DirtyRect changed(entry.x, entry.y, entry.width, entry.height);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (entry.sequence.load(std::memory_order_relaxed) != s) {
+                dirty = full;
+                break;
+            }
+            dirty = dirty.united(changed.clipped(_width, _height));
+        }
+    }
+    frame.sequence = latest;
+    frame.data = reinterpret_cast<const double*>(static_cast<const char*>(_mapping) + _dataOffset + slot * _slotBytes);
+    frame.dirty = dirty;
+    _lastSequence = latest;
+    return true;
+}
+
+bool SharedSurfaceMapSubscriber::isValid(const SharedSurfaceMapFrame& frame) const
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return _header->slots[frame.sequence % _numSlots].sequence.load(std::memory_order_relaxed) ==
+           frame.sequence;
+}
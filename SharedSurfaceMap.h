@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ParametricSurfaceGrid.h"
+
+// Region of a sample map, in pixels.
+struct DirtyRect {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+
+    DirtyRect() {}
+    DirtyRect(int x, int y, int width, int height) : x(x), y(y), width(width), height(height) {}
+    bool isEmpty() const { return width <= 0 || height <= 0; }
+    DirtyRect united(const DirtyRect& other) const;
+    DirtyRect clipped(int mapWidth, int mapHeight) const;
+};
+
+// Layout of the shared memory object: the header, then numSlots page aligned map slots. Every slot holds a whole map in
+// the layout of generateSurfacePoints(). Publications are numbered from 1; the map of publication n is in slot
+// n % numSlots and the header remembers which region each of the last historySize publications changed.
+struct SharedSurfaceMapHeader {
+    enum { maxSlots = 8, historySize = 64 };
+
+    struct Slot {
+        // sequence number of the map held by the slot, 0 while it is being written
+        std::atomic<uint64_t> sequence;
+    };
+    struct History {
+        std::atomic<uint64_t> sequence;
+        int32_t x, y, width, height;
+    };
+
+    char magic[8];
+    uint32_t version;
+    uint32_t numSlots;
+    uint32_t width;
+    uint32_t height;
+    uint64_t slotBytes;
+    uint64_t dataOffset;
+    std::atomic<uint64_t> latestSequence;
+    Slot slots[maxSlots];
+    History history[historySize];
+};
+
+// Publishes sample maps into a POSIX shared memory ring that other processes map read only. Only the regions that
+// changed since a slot was last written are regenerated into it, straight from the grid.
+class SharedSurfaceMapPublisher {
+public:
+    // Creates (or recreates) the shared memory object called name, e.g. "/projector0-map". It is unlinked again when
+    // the publisher is destroyed; subscribers that mapped it keep their mapping.
+    SharedSurfaceMapPublisher(const std::string& name, int width, int height, int numSlots = 3);
+    ~SharedSurfaceMapPublisher();
+    SharedSurfaceMapPublisher(const SharedSurfaceMapPublisher&) = delete;
+    SharedSurfaceMapPublisher& operator=(const SharedSurfaceMapPublisher&) = delete;
+
+    bool isOpen() const { return _header != nullptr; }
+    // Publishes the map of grid, which must have the publisher's size, telling subscribers that only dirty changed
+    // since the previous publication. Tiles are generated with the grid's thread count. Returns the sequence number.
+    uint64_t publish(ParametricSurfaceGrid& grid, const DirtyRect& dirty);
+    uint64_t publish(ParametricSurfaceGrid& grid);
+    // Same, copying from an already generated map in the layout of generateSurfacePoints().
+    uint64_t publish(const double* points, const DirtyRect& dirty);
+
+private:
+    template <class WriteRegion>
+    uint64_t publishRegion(const DirtyRect& dirty, WriteRegion writeRegion);
+
+private:
+    std::string _name;
+    void* _mapping;
+    size_t _mappingSize;
+    SharedSurfaceMapHeader* _header;
+};
+
+// A published map as seen by a subscriber. data points into the shared memory and stays readable until the publisher
+// reuses the slot, which SharedSurfaceMapSubscriber::isValid() detects.
+struct SharedSurfaceMapFrame {
+    uint64_t sequence = 0;
+    const double* data = nullptr;
+    // region changed since the frame previously returned by poll(), the whole map for the first one or after a gap
+    // longer than the header history
+    DirtyRect dirty;
+};
+
+class SharedSurfaceMapSubscriber {
+public:
+    SharedSurfaceMapSubscriber();
+    ~SharedSurfaceMapSubscriber();
+    SharedSurfaceMapSubscriber(const SharedSurfaceMapSubscriber&) = delete;
+    SharedSurfaceMapSubscriber& operator=(const SharedSurfaceMapSubscriber&) = delete;
+
+    bool open(const std::string& name);
+    void close();
+    bool isOpen() const { return _header != nullptr; }
+    int width() const { return _width; }
+    int height() const { return _height; }
+
+    // Returns the latest publication if it is newer than the last one returned.
+    bool poll(SharedSurfaceMapFrame& frame);
+    // True while the frame's slot has not been reused; check after reading to make sure the data read was consistent.
+    bool isValid(const SharedSurfaceMapFrame& frame) const;
+
+private:
+    void* _mapping;
+    size_t _mappingSize;
+    const SharedSurfaceMapHeader* _header;
+    // layout checked against the mapping by open(); the header stays writable by the publisher, so it is not read again
+    int _width;
+    int _height;
+    uint32_t _numSlots;
+    uint64_t _slotBytes;
+    uint64_t _dataOffset;
+    uint64_t _lastSequence;
+};
@@ -0,0 +1,197 @@
+#include "SurfaceAnimation.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+void SurfaceAnimation::addKeyframe(double time, const std::vector<vec2d>& controlPoints)
+{
+    assert(_keyframes.empty() || _keyframes.front().controlPoints.size() == controlPoints.size());
+    auto it = std::lower_bound(_keyframes.begin(), _keyframes.end(), time,
+                               [](const Keyframe& keyframe, double t) { return keyframe.time < t; });
+    if (it != _keyframes.end() && it->time == time) {
+        it->controlPoints = controlPoints;
+        return;
+    }
+    _keyframes.insert(it, Keyframe{time, controlPoints});
+}
+
+void SurfaceAnimation::sample(double time, std::vector<vec2d>& controlPoints) const
+{
+    assert(!_keyframes.empty());
+    if (time <= _keyframes.front().time || _keyframes.size() == 1) {
+        controlPoints = _keyframes.front().controlPoints;
+        return;
+    }
+    if (time >= _keyframes.back().time) {
+        controlPoints = _keyframes.back().controlPoints;
+        return;
+    }
+    auto it = std::upper_bound(_keyframes.begin(), _keyframes.end(), time,
+                               [](double t, const Keyframe& keyframe) { return t < keyframe.time; });
+    int k1 = it - _keyframes.begin();
+    int k0 = k1 - 1;
+    const Keyframe& a = _keyframes[k0];
+    const Keyframe& b = _keyframes[k1];
+    double t = (time - a.time) / (b.time - a.time);
+    controlPoints.resize(a.controlPoints.size());
+    if (_interpolation == Linear) {
+        for (size_t i = 0; i < controlPoints.size(); ++i) {
+            controlPoints[i] = a.controlPoints[i] * (1 - t) + b.controlPoints[i] * t;
+        }
+        return;
+    }
+    // cubic Hermite with Catmull-Rom tangents, scaled to the actual keyframe spacing
+    const Keyframe& before = _keyframes[std::max(0, k0 - 1)];
+    const Keyframe& after = _keyframes[std::min<int>(_keyframes.size() - 1, k1 + 1)];
+    double span = b.time - a.time;
+    double t2 = t * t;
+    double t3 = t2 * t;
+    double h00 = 2 * t3 - 3 * t2 + 1;
+    double h10 = t3 - 2 * t2 + t;
+    double h01 = -2 * t3 + 3 * t2;
+    double h11 = t3 - t2;
+    double scale0 = span / std::max(b.time - before.time, 1e-12);
+    double scale1 = span / std::max(after.time - a.time, 1e-12);
+    for (size_t i = 0; i < controlPoints.size(); ++i) {
+        vec2d m0 = (b.controlPoints[i] - before.controlPoints[i]) * scale0;
+        vec2d m1 = (after.controlPoints[i] - a.controlPoints[i]) * scale1;
+        controlPoints[i] = a.controlPoints[i] * h00 + m0 * h10 + b.controlPoints[i] * h01 + m1 * h11;
+    }
+}
+
+void SurfaceAnimationStageStats::record(double ms)
+{
+    lastMs = ms;
+    maxMs = std::max(maxMs, ms);
+    averageMs = (averageMs * frames + ms) / (frames + 1);
+    frames++;
+}
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double elapsedMs(Clock::time_point since)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+}
+
+struct FrameSlot {
+    int slot;
+    int frame;
+    Clock::time_point started;
+};
+
+// blocking queue handing grid slots from one stage to the next
+class SlotQueue {
+public:
+    void push(const FrameSlot& item)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _items.push_back(item);
+        }
+        _condition.notify_one();
+    }
+    // false once the queue is closed, without an item
+    bool pop(FrameSlot& item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _condition.wait(lock, [this]() { return _closed || !_items.empty(); });
+        if (_closed) {
+            return false;
+        }
+        item = _items.front();
+        _items.pop_front();
+        return true;
+    }
+    // wakes the stage waiting on the queue, for stopping the pipeline early
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _closed = true;
+        }
+        _condition.notify_all();
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::deque<FrameSlot> _items;
+    bool _closed = false;
+};
+
+} // namespace
+
+SurfaceAnimationPipeline::SurfaceAnimationPipeline(const ParametricSurfaceGrid& prototype,
+                                                   const SurfaceAnimation& animation)
+    : _animation(animation), _grids(3, prototype)
+{
+}
+
+void SurfaceAnimationPipeline::run(double startTime, double frameTime, int numFrames, const Consumer& consumer)
+{
+    _fitStats = SurfaceAnimationStageStats();
+    _generateStats = SurfaceAnimationStageStats();
+    _consumeStats = SurfaceAnimationStageStats();
+    _latencyStats = SurfaceAnimationStageStats();
+
+    SlotQueue free, fitted, generated;
+    for (int slot = 0; slot < (int)_grids.size(); ++slot) {
+        free.push(FrameSlot{slot, -1, Clock::time_point()});
+    }
+
+    std::thread fitter([&]() {
+        std::vector<vec2d> controlPoints;
+        for (int frame = 0; frame < numFrames; ++frame) {
+            FrameSlot item;
+            if (!free.pop(item)) {
+                return;
+            }
+            item.frame = frame;
+            item.started = Clock::now();
+            _animation.sample(startTime + frame * frameTime, controlPoints);
+            _grids[item.slot].setControlPointPositions(controlPoints);
+            _fitStats.record(elapsedMs(item.started));
+            fitted.push(item);
+        }
+    });
+    std::thread generator([&]() {
+        for (int frame = 0; frame < numFrames; ++frame) {
+            FrameSlot item;
+            if (!fitted.pop(item)) {
+                return;
+            }
+            Clock::time_point start = Clock::now();
+            _grids[item.slot].generateSurfacePoints();
+            _generateStats.record(elapsedMs(start));
+            generated.push(item);
+        }
+    });
+    // the stages are stopped and joined before an exception from consumer leaves, as destroying a joinable thread
+    // terminates
+    try {
+        for (int frame = 0; frame < numFrames; ++frame) {
+            FrameSlot item;
+            generated.pop(item);
+            Clock::time_point start = Clock::now();
+            consumer(item.frame, _grids[item.slot].getState().surfacePoints);
+            _consumeStats.record(elapsedMs(start));
+            _latencyStats.record(elapsedMs(item.started));
+            free.push(item);
+        }
+    } catch (...) {
+        free.close();
+        fitted.close();
+        fitter.join();
+        generator.join();
+        throw;
+    }
+    fitter.join();
+    generator.join();
+}
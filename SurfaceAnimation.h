@@ -0,0 +1,79 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "ParametricSurfaceGrid.h"
+#include "vec2.h"
+
+// Keyframed control point animation of a grid. Every keyframe holds all control points of the grid, in the row-major
+// layout of ParametricSurfaceGrid::setControlPointPositions().
+class SurfaceAnimation {
+public:
+    enum Interpolation {
+        Linear,
+        // passes through every keyframe with a continuous velocity, using the neighbouring keyframes as tangents
+        CatmullRom
+    };
+
+    SurfaceAnimation(Interpolation interpolation = CatmullRom) : _interpolation(interpolation) {}
+
+    // Keyframes may be added in any order; a keyframe at an existing time replaces it.
+    void addKeyframe(double time, const std::vector<vec2d>& controlPoints);
+    void clear() { _keyframes.clear(); }
+    int numKeyframes() const { return _keyframes.size(); }
+    double startTime() const { return _keyframes.empty() ? 0 : _keyframes.front().time; }
+    double endTime() const { return _keyframes.empty() ? 0 : _keyframes.back().time; }
+
+    // Interpolates the control points at time, holding the first and last keyframes outside of the animation range.
+    void sample(double time, std::vector<vec2d>& controlPoints) const;
+
+private:
+    struct Keyframe {
+        double time;
+        std::vector<vec2d> controlPoints;
+    };
+
+    Interpolation _interpolation;
+    std::vector<Keyframe> _keyframes;
+};
+
+struct SurfaceAnimationStageStats {
+    int frames = 0;
+    double lastMs = 0;
+    double averageMs = 0;
+    double maxMs = 0;
+
+    void record(double ms);
+};
+
+// Produces the sample maps of an animation with its stages overlapped: while frame N-1 is handed to the consumer, the
+// map of frame N is generated and the splines of frame N+1 are fitted, each stage on its own thread and grid.
+class SurfaceAnimationPipeline {
+public:
+    typedef std::function<void(int frame, const SurfacePoints& surfacePoints)> Consumer;
+
+    // The pipeline works on copies of prototype, which sets the size, resolution and linear flags of the grid.
+    SurfaceAnimationPipeline(const ParametricSurfaceGrid& prototype, const SurfaceAnimation& animation);
+
+    // Produces numFrames frames, frame i at startTime + i * frameTime, and calls consumer with each map, in frame order
+    // and on the calling thread. The map passed to consumer is only valid during the call. If consumer throws, the
+    // remaining frames are dropped and the exception is rethrown once the other stages have stopped.
+    void run(double startTime, double frameTime, int numFrames, const Consumer& consumer);
+
+    // Time spent per frame in each stage, over the frames of the last run().
+    const SurfaceAnimationStageStats& fitStats() const { return _fitStats; }
+    const SurfaceAnimationStageStats& generateStats() const { return _generateStats; }
+    const SurfaceAnimationStageStats& consumeStats() const { return _consumeStats; }
+    // Time from the start of fitting a frame to the end of its consumption.
+    const SurfaceAnimationStageStats& frameLatencyStats() const { return _latencyStats; }
+
+private:
+    const SurfaceAnimation& _animation;
+    // one grid per frame in flight: fitting, generating and consuming
+    std::vector<ParametricSurfaceGrid> _grids;
+    SurfaceAnimationStageStats _fitStats;
+    SurfaceAnimationStageStats _generateStats;
+    SurfaceAnimationStageStats _consumeStats;
+    SurfaceAnimationStageStats _latencyStats;
+};
@@ -0,0 +1,53 @@
+#include "SurfaceComposition.h"
+
+#include "ParallelFor.h"
+
+static vec2d applySurface(ParametricSurfaceGrid& surface, double x, double y)
+{
+    vec2d origin = surface.pixelOrigin();
+    vec2d point = surface.surfacePoint((x - origin.x) / surface.pixelWidth(), (y - origin.y) / surface.pixelHeight());
+    return point + origin;
+}
+
+vec2d SurfaceComposition::mapPixel(const vec2d& pixel) const
+{
+    assert(!_surfaces.empty());
+    ParametricSurfaceGrid& first = *_surfaces.front();
+    vec2d point = first.surfacePoint(pixel.x / first.pixelWidth(), pixel.y / first.pixelHeight()) + first.pixelOrigin();
+    for (size_t i = 1; i < _surfaces.size(); ++i) {
+        point = applySurface(*_surfaces[i], point.x, point.y);
+    }
+    return point;
+}
+
+void SurfaceComposition::generateSurfaceTile(int x0, int y0, int tileWidth, int tileHeight, double* out,
+                                             size_t rowStride) const
+{
+    assert(!_surfaces.empty());
+    _surfaces.front()->generateSurfaceTile(x0, y0, tileWidth, tileHeight, out, rowStride);
+    // the following surfaces transform the tile in place while it is still in cache
+    for (size_t i = 1; i < _surfaces.size(); ++i) {
+        for (int y = 0; y < tileHeight; ++y) {
+            double* row = out + y * rowStride;
+            for (int x = 0; x < tileWidth; ++x) {
+                vec2d point = applySurface(*_surfaces[i], row[2 * x], row[2 * x + 1]);
+                row[2 * x] = point.x;
+                row[2 * x + 1] = point.y;
+            }
+        }
+    }
+}
+
+void SurfaceComposition::generateSurfacePoints(std::vector<double>& points) const
+{
+    assert(!_surfaces.empty());
+    ParametricSurfaceGrid& first = *_surfaces.front();
+    int width = first.pixelWidth();
+    int height = first.pixelHeight();
+    points.resize((size_t)width * height * 2);
+    double* data = points.data();
+    parallelForTiles(width, height, ParametricSurfaceGrid::generationTileSize, first.numThreads(),
+                     [&](int x0, int y0, int w, int h) {
+                         generateSurfaceTile(x0, y0, w, h, data + ((size_t)y0 * width + x0) * 2, (size_t)width * 2);
+                     });
+}
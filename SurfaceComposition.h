@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+
+#include "ParametricSurfaceGrid.h"
+#include "vec2.h"
+
+// Chain of surfaces applied one after the other, e.g. lens correction, then keystone, then an artistic deformation.
+// The map of the chain is produced in one pass: every pixel of the first surface is mapped through it and then through
+// each following surface, without generating the intermediate maps.
+//
+// Surfaces chain in pixel space: a point p produced by one surface is fed to the next surface s at
+// u = (p.x - s.pixelOrigin().x) / s.pixelWidth(), v = (p.y - s.pixelOrigin().y) / s.pixelHeight(), and the result is
+// offset by s.pixelOrigin() again, as in generateSurfacePoints(). Points leaving a surface's rectangle extrapolate its
+// border patches.
+class SurfaceComposition {
+public:
+    // surfaces are given in application order and must outlive the composition
+    SurfaceComposition(const std::vector<ParametricSurfaceGrid*>& surfaces = std::vector<ParametricSurfaceGrid*>())
+        : _surfaces(surfaces)
+    {
+    }
+    void addSurface(ParametricSurfaceGrid* surface) { _surfaces.push_back(surface); }
+    int numSurfaces() const { return _surfaces.size(); }
+
+    // Maps a pixel of the first surface through the whole chain.
+    vec2d mapPixel(const vec2d& pixel) const;
+    // Same as ParametricSurfaceGrid::generateSurfaceTile(), for the composed map.
+    void generateSurfaceTile(int x0, int y0, int tileWidth, int tileHeight, double* out, size_t rowStride) const;
+    // Generates the composed map over the pixels of the first surface, tiled and threaded like generateSurfacePoints()
+    // and with the thread count of the first surface.
+    void generateSurfacePoints(std::vector<double>& points) const;
+
+private:
+    std::vector<ParametricSurfaceGrid*> _surfaces;
+};
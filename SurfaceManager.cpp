@@ -0,0 +1,368 @@
+#include "SurfaceManager.h"
+
+#include <algorithm>
+#include <climits>
+
+static const int64_t kNoDeadline = INT64_MAX;
+
+struct SurfaceManager::Surface {
+    std::mutex mutex;
+    ParametricSurfaceGrid grid;
+    // read by the scheduler without the surface lock
+    std::atomic<int> priority;
+    std::atomic<int64_t> deadline;
+    // waiting in the pending list, being regenerated, and edited since the last regeneration started
+    bool queued;
+    bool running;
+    bool edited;
+    Clock::time_point editedSince;
+    SurfacePoints front;
+    SurfacePoints back;
+    uint64_t sequence;
+    SurfaceLatencyStats latency;
+
+    Surface(const ParametricSurfaceGrid& grid, int priority)
+        : grid(grid), priority(priority), deadline(kNoDeadline), queued(false), running(false), edited(false),
+          sequence(0)
+    {
+        // maps are generated into front and back, never into the grid; dropping the caller's maps keeps every job's
+        // copy of the grid small
+        SurfacePoints().swap(this->grid.getState().surfacePoints);
+        this->grid.setMapPagePolicy(grid.mapPagePolicy());
+    }
+};
+
+struct SurfaceManager::Job {
+    Surface* surface;
+    // the grid as it was when the regeneration started, so the surface can be edited meanwhile
+    std::unique_ptr<ParametricSurfaceGrid> grid;
+    int priority;
+    int width;
+    int height;
+    int tilesX;
+    int numTiles;
+    std::atomic<int> remaining;
+    Clock::time_point editedSince;
+    int64_t deadline;
+};
+
+void SurfaceLatencyStats::record(double ms)
+{
+    lastMs = ms;
+    maxMs = std::max(maxMs, ms);
+    averageMs = (averageMs * maps + ms) / (maps + 1);
+    maps++;
+}
+
+SurfaceManager::SurfaceManager(int numThreads)
+    : _numPending(0), _queuedTasks(0), _activeJobs(0), _stop(false), _statsStart(Clock::now())
+{
+    if (numThreads <= 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (int i = 0; i < numThreads; ++i) {
+        _workers.emplace_back(new Worker);
+    }
+    for (int i = 0; i < numThreads; ++i) {
+        _workers[i]->thread = std::thread(&SurfaceManager::work, this, i);
+    }
+}
+
+SurfaceManager::~SurfaceManager()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (auto& worker : _workers) {
+        worker->thread.join();
+    }
+}
+
+int SurfaceManager::addSurface(const ParametricSurfaceGrid& grid, int priority)
+{
+    int id;
+    Surface* added = new Surface(grid, priority);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        id = _surfaces.size();
+        _surfaces.emplace_back(added);
+    }
+    edit(id, Edit());
+    return id;
+}
+
+int SurfaceManager::numSurfaces()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _surfaces.size();
+}
+
+SurfaceManager::Surface& SurfaceManager::surface(int id)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    assert(id >= 0 && id < (int)_surfaces.size());
+    return *_surfaces[id];
+}
+
+void SurfaceManager::setPriority(int id, int priority)
+{
+    surface(id).priority = priority;
+}
+
+void SurfaceManager::edit(int id, const Edit& edit, double deadlineMs)
+{
+    Surface& s = surface(id);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (edit) {
+        edit(s.grid);
+    }
+    Clock::time_point now = Clock::now();
+    int64_t deadline = kNoDeadline;
+    if (deadlineMs > 0) {
+        deadline = (now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(
+                                deadlineMs))).time_since_epoch().count();
+    }
+    if (s.edited) {
+        s.latency.coalescedEdits++;
+        s.deadline = std::min<int64_t>(s.deadline, deadline);
+    } else {
+        s.edited = true;
+        s.editedSince = now;
+        s.deadline = deadline;
+    }
+    schedule(s);
+}
+
+void SurfaceManager::schedule(Surface& s)
+{
+    // called with the surface locked; a surface being regenerated is queued again when it finishes
+    if (s.queued || s.running) {
+        return;
+    }
+    s.queued = true;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending.push_back(&s);
+        _numPending++;
+        _activeJobs++;
+    }
+    _wake.notify_one();
+}
+
+uint64_t SurfaceManager::readMap(int id, const Reader& read)
+{
+    Surface& s = surface(id);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.sequence > 0) {
+        read(s.front, s.sequence);
+    }
+    return s.sequence;
+}
+
+uint64_t SurfaceManager::mapSequence(int id)
+{
+    Surface& s = surface(id);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.sequence;
+}
+
+void SurfaceManager::waitIdle()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle.wait(lock, [&]() { return _activeJobs == 0; });
+}
+
+SurfaceManagerStats SurfaceManager::stats()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    SurfaceManagerStats stats = _stats;
+    stats.seconds = std::chrono::duration<double>(Clock::now() - _statsStart).count();
+    return stats;
+}
+
+SurfaceLatencyStats SurfaceManager::latencyStats(int id)
+{
+    Surface& s = surface(id);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.latency;
+}
+
+void SurfaceManager::resetStats()
+{
+    std::vector<Surface*> surfaces;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stats = SurfaceManagerStats();
+        _statsStart = Clock::now();
+        for (auto& s : _surfaces) {
+            surfaces.push_back(s.get());
+        }
+    }
+    for (Surface* s : surfaces) {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        s->latency = SurfaceLatencyStats();
+    }
+}
+
+void SurfaceManager::work(int index)
+{
+    for (;;) {
+        Task task;
+        if (nextTask(index, task)) {
+            runTask(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        _wake.wait(lock, [&]() { return _stop || (_numPending > 0) || _queuedTasks > 0; });
+        // tiles already handed out are finished even when stopping, their jobs own memory
+        if (_stop && _queuedTasks == 0) {
+            return;
+        }
+    }
+}
+
+bool SurfaceManager::nextTask(int index, Task& task)
+{
+    Worker& self = *_workers[index];
+    int localPriority = INT_MIN;
+    {
+        std::lock_guard<std::mutex> lock(self.mutex);
+        if (!self.tasks.empty()) {
+            localPriority = self.tasks.back().job->priority;
+        }
+    }
+    // a pending surface that outranks the local tiles is started first, its tiles go on top of them
+    if (_numPending > 0) {
+        startJob(index, localPriority);
+    }
+    {
+        std::lock_guard<std::mutex> lock(self.mutex);
+        if (!self.tasks.empty()) {
+            task = self.tasks.back();
+            self.tasks.pop_back();
+            _queuedTasks--;
+            return true;
+        }
+    }
+    for (size_t k = 1; k < _workers.size(); ++k) {
+        Worker& victim = *_workers[(index + k) % _workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            _queuedTasks--;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SurfaceManager::startJob(int index, int outranking)
+{
+    Surface* s = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_stop || _pending.empty()) {
+            return false;
+        }
+        // dozens of surfaces at most, a scan is cheaper than keeping a heap ordered while priorities and
+        // deadlines change
+        auto best = _pending.begin();
+        for (auto it = _pending.begin() + 1; it != _pending.end(); ++it) {
+            int p = (*it)->priority, bestP = (*best)->priority;
+            if (p > bestP || (p == bestP && (*it)->deadline < (*best)->deadline)) {
+                best = it;
+            }
+        }
+        if (outranking != INT_MIN && (*best)->priority <= outranking) {
+            return false;
+        }
+        s = *best;
+        _pending.erase(best);
+        _numPending--;
+    }
+
+    Job* job = new Job;
+    job->surface = s;
+    {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        job->grid.reset(new ParametricSurfaceGrid(s->grid));
+        job->priority = s->priority;
+        job->editedSince = s->editedSince;
+        job->deadline = s->deadline;
+        s->edited = false;
+        s->queued = false;
+        s->running = true;
+    }
+    int tileSize = ParametricSurfaceGrid::generationTileSize;
+    job->width = job->grid->pixelWidth();
+    job->height = job->grid->pixelHeight();
+    job->tilesX = (job->width + tileSize - 1) / tileSize;
+    job->numTiles = job->tilesX * ((job->height + tileSize - 1) / tileSize);
+    job->remaining = job->numTiles;
+    // only the running job touches the back buffer
+    s->back.resize((size_t)job->width * job->height * 2);
+
+    Worker& self = *_workers[index];
+    {
+        std::lock_guard<std::mutex> lock(self.mutex);
+        // pushed last to first, so the owner works from the top of the map while thieves take the bottom
+        for (int tile = job->numTiles - 1; tile >= 0; --tile) {
+            self.tasks.push_back(Task{job, tile});
+        }
+        _queuedTasks += job->numTiles;
+    }
+    {
+        // a worker about to sleep checks _queuedTasks under _mutex, taking it here makes sure it sees the new tiles or
+        // is already waiting for the notification
+        std::lock_guard<std::mutex> lock(_mutex);
+    }
+    _wake.notify_all();
+    return true;
+}
+
+void SurfaceManager::runTask(const Task& task)
+{
+    Job* job = task.job;
+    int tileSize = ParametricSurfaceGrid::generationTileSize;
+    int x0 = (task.tile % job->tilesX) * tileSize;
+    int y0 = (task.tile / job->tilesX) * tileSize;
+    int w = std::min(tileSize, job->width - x0);
+    int h = std::min(tileSize, job->height - y0);
+    job->grid->generateSurfaceTile(x0, y0, w, h, job->surface->back.data() + ((size_t)y0 * job->width + x0) * 2,
+                                   (size_t)job->width * 2);
+    if (--job->remaining == 0) {
+        finishJob(job);
+    }
+}
+
+void SurfaceManager::finishJob(Job* job)
+{
+    Surface& s = *job->surface;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.front.swap(s.back);
+        s.sequence++;
+        s.running = false;
+        Clock::time_point now = Clock::now();
+        s.latency.record(std::chrono::duration<double, std::milli>(now - job->editedSince).count());
+        if (now.time_since_epoch().count() > job->deadline) {
+            s.latency.deadlineMisses++;
+        }
+        if (s.edited) {
+            schedule(s);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stats.maps++;
+        _stats.tiles += job->numTiles;
+        _stats.pixels += (uint64_t)job->width * job->height;
+        if (--_activeJobs == 0) {
+            _idle.notify_all();
+        }
+    }
+    delete job;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ParametricSurfaceGrid.h"
+
+struct SurfaceLatencyStats {
+    int maps = 0;
+    // time from the first edit a map includes to the map being published
+    double lastMs = 0;
+    double averageMs = 0;
+    double maxMs = 0;
+    // maps published after the deadline of one of their edits
+    int deadlineMisses = 0;
+    // edits folded into a regeneration that was already pending
+    uint64_t coalescedEdits = 0;
+
+    void record(double ms);
+};
+
+struct SurfaceManagerStats {
+    uint64_t maps = 0;
+    uint64_t tiles = 0;
+    uint64_t pixels = 0;
+    // wall time since the manager was created or its stats were reset
+    double seconds = 0;
+    double pixelsPerSecond() const { return seconds > 0 ? pixels / seconds : 0; }
+};
+
+// Owns many surfaces, e.g. one per projector or camera channel, and regenerates their sample maps on one shared pool of
+// worker threads instead of one set of threads per surface.
+//
+// Every regeneration is split in tiles of ParametricSurfaceGrid::generationTileSize pixels. A worker that runs out of
+// work starts the most urgent pending surface and pushes its tiles on its own deque; idle workers steal tiles from the
+// other end of busy workers' deques, so one large surface spreads over the whole pool while small ones stay on a
+// single thread. Pending surfaces are started by priority, then by earliest deadline, and outrank the remaining tiles
+// of less urgent ones.
+//
+// Maps are double buffered: edits go to the surface's grid while the last started regeneration renders from a copy of
+// it, and readers see the last published map.
+class SurfaceManager {
+public:
+    typedef std::function<void(ParametricSurfaceGrid& grid)> Edit;
+    typedef std::function<void(const SurfacePoints& map, uint64_t sequence)> Reader;
+
+    // numThreads <= 0 means one worker per hardware thread
+    explicit SurfaceManager(int numThreads = 0);
+    ~SurfaceManager();
+    SurfaceManager(const SurfaceManager&) = delete;
+    SurfaceManager& operator=(const SurfaceManager&) = delete;
+
+    // Adds a copy of grid, without its sample map, higher priorities being served first, and schedules its first map.
+    // Returns its id.
+    int addSurface(const ParametricSurfaceGrid& grid, int priority = 0);
+    int numSurfaces();
+    void setPriority(int id, int priority);
+
+    // Applies edit to the grid of surface id and schedules the regeneration of its map, due within deadlineMs
+    // milliseconds, 0 meaning no deadline. Edits made before the regeneration starts share it, with the earliest of
+    // their deadlines.
+    void edit(int id, const Edit& edit, double deadlineMs = 0);
+    // Calls read with the last published map of surface id and its sequence number, which counts the maps published
+    // from 1. The map stays unchanged during the call. Returns the sequence number, 0 while there is no map yet.
+    uint64_t readMap(int id, const Reader& read);
+    uint64_t mapSequence(int id);
+    // Blocks until no regeneration is pending or running.
+    void waitIdle();
+
+    SurfaceManagerStats stats();
+    SurfaceLatencyStats latencyStats(int id);
+    void resetStats();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    struct Job;
+    struct Surface;
+    struct Task {
+        Job* job;
+        int tile;
+    };
+    struct Worker {
+        std::mutex mutex;
+        // the owner pushes and pops at the back, thieves take from the front
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    Surface& surface(int id);
+    void schedule(Surface& surface);
+    void work(int index);
+    bool nextTask(int index, Task& task);
+    bool startJob(int index, int outranking);
+    void runTask(const Task& task);
+    void finishJob(Job* job);
+
+private:
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::vector<std::unique_ptr<Surface>> _surfaces;
+    // guards the surface list, the pending list and the counters below
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _idle;
+    // surfaces waiting for a worker to start their regeneration
+    std::vector<Surface*> _pending;
+    std::atomic<int> _numPending;
+    std::atomic<int> _queuedTasks;
+    int _activeJobs;
+    bool _stop;
+    SurfaceManagerStats _stats;
+    Clock::time_point _statsStart;
+};
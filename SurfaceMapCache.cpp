@@ -0,0 +1,236 @@
+#include "SurfaceMapCache.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char kMagic[8] = {'S', 'P', 'L', 'C', 'A', 'C', '0', '1'};
+
+struct SpillFileHeader {
+    char magic[8];
+    uint64_t stateHash;
+    uint32_t width;
+    uint32_t height;
+};
+
+static bool writeAll(int fd, const void* data, size_t size)
+{
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t written = ::write(fd, bytes, size);
+        if (written <= 0) {
+            return false;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void* data, size_t size)
+{
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t read = ::read(fd, bytes, size);
+        if (read <= 0) {
+            return false;
+        }
+        bytes += read;
+        size -= read;
+    }
+    return true;
+}
+
+SurfaceMapCache::SurfaceMapCache(const SurfaceMapCacheOptions& options) : _options(options) {}
+
+SurfaceMapCache::~SurfaceMapCache()
+{
+    clear();
+}
+
+const SurfacePoints& SurfaceMapCache::generateSurfacePoints(ParametricSurfaceGrid& grid)
+{
+    SurfacePoints& points = grid.getState().surfacePoints;
+    if (find(grid, points)) {
+        return points;
+    }
+    _stats.misses++;
+    grid.generateSurfacePoints();
+    insert(grid, points);
+    return points;
+}
+
+SurfaceMapCache::EntryIterator SurfaceMapCache::findEntry(ParametricSurfaceGrid& grid, uint64_t stateHash)
+{
+    grid.stateKey(_key);
+    auto found = _index.find(stateHash);
+    if (found == _index.end() || found->second->stateKey != _key) {
+        return _entries.end();
+    }
+    return found->second;
+}
+
+bool SurfaceMapCache::contains(ParametricSurfaceGrid& grid)
+{
+    return findEntry(grid, grid.stateHash()) != _entries.end();
+}
+
+bool SurfaceMapCache::find(ParametricSurfaceGrid& grid, SurfacePoints& points)
+{
+    EntryIterator entry = findEntry(grid, grid.stateHash());
+    if (entry == _entries.end()) {
+        return false;
+    }
+    if (entry->spillPath.empty()) {
+        _stats.hits++;
+    } else if (load(*entry)) {
+        _stats.diskHits++;
+    } else {
+        // the spill file went missing or is damaged, forget the map
+        erase(entry);
+        return false;
+    }
+    points.assign(entry->points.begin(), entry->points.end());
+    touch(entry);
+    enforceBudgets();
+    return true;
+}
+
+void SurfaceMapCache::insert(ParametricSurfaceGrid& grid, const SurfacePoints& points)
+{
+    int width = grid.pixelWidth(), height = grid.pixelHeight();
+    assert(points.size() == (size_t)width * height * 2);
+    uint64_t stateHash = grid.stateHash();
+    auto found = _index.find(stateHash);
+    if (found != _index.end()) {
+        erase(found->second);
+    }
+    grid.stateKey(_key);
+    _entries.push_front(Entry{stateHash, _key, width, height, points, std::string()});
+    _index[stateHash] = _entries.begin();
+    _stats.memoryBytes += mapBytes(_entries.front());
+    enforceBudgets();
+}
+
+void SurfaceMapCache::clear()
+{
+    while (!_entries.empty()) {
+        erase(_entries.begin());
+    }
+}
+
+void SurfaceMapCache::resetStats()
+{
+    SurfaceMapCacheStats stats;
+    stats.memoryBytes = _stats.memoryBytes;
+    stats.diskBytes = _stats.diskBytes;
+    _stats = stats;
+}
+
+void SurfaceMapCache::touch(EntryIterator entry)
+{
+    _entries.splice(_entries.begin(), _entries, entry);
+}
+
+bool SurfaceMapCache::load(Entry& entry)
+{
+    int fd = ::open(entry.spillPath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    SpillFileHeader header;
+    bool ok = readAll(fd, &header, sizeof(header)) && std::memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 &&
+              header.stateHash == entry.stateHash && (int)header.width == entry.width &&
+              (int)header.height == entry.height;
+    if (ok) {
+        entry.points.resize((size_t)entry.width * entry.height * 2);
+        ok = readAll(fd, entry.points.data(), mapBytes(entry));
+    }
+    ::close(fd);
+    if (!ok) {
+        SurfacePoints().swap(entry.points);
+        return false;
+    }
+    _stats.memoryBytes += mapBytes(entry);
+    removeSpillFile(entry);
+    return true;
+}
+
+bool SurfaceMapCache::spill(Entry& entry)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%016llx.map", (unsigned long long)entry.stateHash);
+    std::string path = _options.spillDirectory + name;
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    SpillFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.stateHash = entry.stateHash;
+    header.width = entry.width;
+    header.height = entry.height;
+    bool ok = writeAll(fd, &header, sizeof(header)) && writeAll(fd, entry.points.data(), mapBytes(entry));
+    ::close(fd);
+    if (!ok) {
+        ::unlink(path.c_str());
+        return false;
+    }
+    entry.spillPath = path;
+    _stats.spills++;
+    _stats.diskBytes += mapBytes(entry);
+    return true;
+}
+
+void SurfaceMapCache::removeSpillFile(Entry& entry)
+{
+    if (!entry.spillPath.empty()) {
+        ::unlink(entry.spillPath.c_str());
+        entry.spillPath.clear();
+        _stats.diskBytes -= mapBytes(entry);
+    }
+}
+
+void SurfaceMapCache::erase(EntryIterator entry)
+{
+    if (entry->spillPath.empty()) {
+        _stats.memoryBytes -= mapBytes(*entry);
+    }
+    removeSpillFile(*entry);
+    _index.erase(entry->stateHash);
+    _entries.erase(entry);
+}
+
+void SurfaceMapCache::enforceBudgets()
+{
+    // walk from the least recently used end; the budgets are in bytes of whole maps, so there are few entries to visit
+    for (auto entry = _entries.end(); _stats.memoryBytes > _options.memoryBudget && entry != _entries.begin();) {
+        --entry;
+        if (!entry->spillPath.empty()) {
+            continue;
+        }
+        _stats.evictions++;
+        if (_options.spillDirectory.empty() || !spill(*entry)) {
+            EntryIterator next = std::next(entry);
+            erase(entry);
+            entry = next;
+            continue;
+        }
+        _stats.memoryBytes -= mapBytes(*entry);
+        SurfacePoints().swap(entry->points);
+    }
+    for (auto entry = _entries.end(); _stats.diskBytes > _options.diskBudget && entry != _entries.begin();) {
+        --entry;
+        if (entry->spillPath.empty()) {
+            continue;
+        }
+        EntryIterator next = std::next(entry);
+        erase(entry);
+        entry = next;
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ParametricSurfaceGrid.h"
+
+struct SurfaceMapCacheOptions {
+    // Upper bound, in bytes, on the maps kept in memory. Least recently used maps beyond it are spilled to disk, or
+    // dropped when spilling is disabled.
+    size_t memoryBudget = 512 * 1024 * 1024;
+    // Directory spilled maps are written to, one file per map. Empty disables spilling.
+    std::string spillDirectory;
+    // Upper bound, in bytes, on the spilled maps. Least recently used files beyond it are deleted.
+    size_t diskBudget = (size_t)4 * 1024 * 1024 * 1024;
+};
+
+struct SurfaceMapCacheStats {
+    // lookups served from memory
+    uint64_t hits = 0;
+    // lookups served from a spill file
+    uint64_t diskHits = 0;
+    // lookups that had to generate the map
+    uint64_t misses = 0;
+    // maps removed from memory to stay within the memory budget, spilled or not
+    uint64_t evictions = 0;
+    // maps written to a spill file
+    uint64_t spills = 0;
+    size_t memoryBytes = 0;
+    size_t diskBytes = 0;
+};
+
+// Content addressed cache of sample maps, keyed by the state of the grid they were generated for. Switching a grid back
+// to a state it had before, e.g. when toggling between saved warp configurations, restores the map generated for it
+// then instead of generating it again. Maps are looked up by ParametricSurfaceGrid::stateHash(), and a hit is only
+// taken after the whole state, ParametricSurfaceGrid::stateKey(), compared equal; a state whose hash collides with a
+// cached one replaces it.
+class SurfaceMapCache {
+public:
+    explicit SurfaceMapCache(const SurfaceMapCacheOptions& options = SurfaceMapCacheOptions());
+    // Deletes the spill files of the cache.
+    ~SurfaceMapCache();
+    SurfaceMapCache(const SurfaceMapCache&) = delete;
+    SurfaceMapCache& operator=(const SurfaceMapCache&) = delete;
+
+    // Like grid.generateSurfacePoints(): leaves the sample map of the grid's current state in grid.getState() and
+    // returns it. The map is copied from the cache when the state was seen before, otherwise it is generated and
+    // added to the cache.
+    const SurfacePoints& generateSurfacePoints(ParametricSurfaceGrid& grid);
+
+    // Copies the cached map of the current state of grid to points. Returns false if it is not cached.
+    bool find(ParametricSurfaceGrid& grid, SurfacePoints& points);
+    // Adds a map, in the layout of generateSurfacePoints(), for the current state of grid.
+    void insert(ParametricSurfaceGrid& grid, const SurfacePoints& points);
+    bool contains(ParametricSurfaceGrid& grid);
+    // Removes every map, in memory and on disk.
+    void clear();
+
+    const SurfaceMapCacheOptions& options() const { return _options; }
+    const SurfaceMapCacheStats& stats() const { return _stats; }
+    // Resets the counters, the byte totals are kept.
+    void resetStats();
+
+private:
+    // A map is either in memory or, with a spillPath, in its spill file, so both budgets add up to the capacity of the
+    // cache. Reading a spilled map back deletes the file.
+    struct Entry {
+        uint64_t stateHash;
+        std::vector<double> stateKey;
+        int width;
+        int height;
+        SurfacePoints points;
+        std::string spillPath;
+    };
+    typedef std::list<Entry>::iterator EntryIterator;
+
+    // the entry of the grid's state, or _entries.end(); the grid's key is left in _key
+    EntryIterator findEntry(ParametricSurfaceGrid& grid, uint64_t stateHash);
+
+    size_t mapBytes(const Entry& entry) const { return (size_t)entry.width * entry.height * 2 * sizeof(double); }
+    void touch(EntryIterator entry);
+    bool load(Entry& entry);
+    bool spill(Entry& entry);
+    void removeSpillFile(Entry& entry);
+    void erase(EntryIterator entry);
+    void enforceBudgets();
+
+private:
+    SurfaceMapCacheOptions _options;
+    SurfaceMapCacheStats _stats;
+    // most recently used first
+    std::list<Entry> _entries;
+    std::unordered_map<uint64_t, EntryIterator> _index;
+    // scratch for the key of the grid looked up
+    std::vector<double> _key;
+};
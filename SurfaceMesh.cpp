@@ -0,0 +1,149 @@
+#include "SurfaceMesh.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "ParallelFor.h"
+
+namespace {
+
+struct Point {
+    double x, y;
+};
+
+// top-left rule for triangles with positive signed area in pixel coordinates, y pointing down: their top edges run
+// towards +x and their left edges towards -y. Exactly one of the two triangles sharing an edge owns it.
+bool ownsEdge(const Point& a, const Point& b)
+{
+    double dy = b.y - a.y;
+    return dy < 0 || (dy == 0 && b.x > a.x);
+}
+
+// x where the edge crosses the scanline y. Always computed with the endpoints in the same order, so that the two
+// triangles sharing an edge get the very same value and split the samples on it exactly.
+double edgeCrossing(const Point& a, const Point& b, double y)
+{
+    if (a.y > b.y) {
+        return edgeCrossing(b, a, y);
+    }
+    return a.x + (y - a.y) * (b.x - a.x) / (b.y - a.y);
+}
+
+struct Triangle {
+    Point p[3];
+    bool owns[3];
+    double attribute[3][2];
+    // gradient of the interpolated surface point, per channel
+    double gx[2], gy[2];
+    double minY, maxY;
+};
+
+bool setupTriangle(const SurfaceMesh& mesh, size_t t, Triangle& triangle)
+{
+    for (int k = 0; k < 3; ++k) {
+        const double* v = &mesh.vertices[4 * mesh.indices[3 * t + k]];
+        triangle.p[k] = Point{v[0], v[1]};
+        triangle.attribute[k][0] = v[2];
+        triangle.attribute[k][1] = v[3];
+    }
+    Point& p0 = triangle.p[0];
+    double e1x = triangle.p[1].x - p0.x, e1y = triangle.p[1].y - p0.y;
+    double e2x = triangle.p[2].x - p0.x, e2y = triangle.p[2].y - p0.y;
+    double area = e1x * e2y - e1y * e2x;
+    if (area == 0) {
+        return false;
+    }
+    if (area < 0) {
+        std::swap(triangle.p[1], triangle.p[2]);
+        std::swap(triangle.attribute[1], triangle.attribute[2]);
+        std::swap(e1x, e2x);
+        std::swap(e1y, e2y);
+        area = -area;
+    }
+    for (int c = 0; c < 2; ++c) {
+        double d1 = triangle.attribute[1][c] - triangle.attribute[0][c];
+        double d2 = triangle.attribute[2][c] - triangle.attribute[0][c];
+        triangle.gx[c] = (d1 * e2y - d2 * e1y) / area;
+        triangle.gy[c] = (d2 * e1x - d1 * e2x) / area;
+    }
+    for (int e = 0; e < 3; ++e) {
+        triangle.owns[e] = ownsEdge(triangle.p[e], triangle.p[(e + 1) % 3]);
+    }
+    triangle.minY = std::min({triangle.p[0].y, triangle.p[1].y, triangle.p[2].y});
+    triangle.maxY = std::max({triangle.p[0].y, triangle.p[1].y, triangle.p[2].y});
+    return true;
+}
+
+template <class T>
+void rasterizeTriangle(const Triangle& triangle, int width, int y0, int y1, T* out, size_t rowStride)
+{
+    int yStart = std::max<int>(y0, std::ceil(triangle.minY));
+    int yEnd = std::min<int>(y1 - 1, std::floor(triangle.maxY));
+    const Point& p0 = triangle.p[0];
+    for (int y = yStart; y <= yEnd; ++y) {
+        // span of the scanline inside the triangle: edges going up bound it on the left, edges going down on the right.
+        // A sample exactly on an edge belongs to the triangle only if it owns the edge.
+        int xl = 0, xr = width - 1;
+        for (int e = 0; e < 3; ++e) {
+            const Point& a = triangle.p[e];
+            const Point& b = triangle.p[(e + 1) % 3];
+            if (a.y == b.y) {
+                // horizontal edges only matter for the scanline they lie on
+                if (y == a.y && !triangle.owns[e]) {
+                    xr = -1;
+                }
+                continue;
+            }
+            double x = edgeCrossing(a, b, y);
+            if (b.y < a.y) {
+                xl = std::max<int>(xl, triangle.owns[e] ? std::ceil(x) : std::floor(x) + 1);
+            } else {
+                xr = std::min<int>(xr, triangle.owns[e] ? std::floor(x) : std::ceil(x) - 1);
+            }
+        }
+        T* row = out + (y - y0) * rowStride;
+        double baseX = triangle.attribute[0][0] + (y - p0.y) * triangle.gy[0] - p0.x * triangle.gx[0];
+        double baseY = triangle.attribute[0][1] + (y - p0.y) * triangle.gy[1] - p0.x * triangle.gx[1];
+        for (int x = xl; x <= xr; ++x) {
+            row[2 * x + 0] = baseX + x * triangle.gx[0];
+            row[2 * x + 1] = baseY + x * triangle.gx[1];
+        }
+    }
+}
+
+} // namespace
+
+template <class T>
+void rasterizeSurfaceMesh(const SurfaceMesh& mesh, T* out, size_t rowStride, int numThreads)
+{
+    std::vector<Triangle> triangles;
+    triangles.reserve(mesh.numTriangles());
+    for (size_t t = 0; t < mesh.numTriangles(); ++t) {
+        Triangle triangle;
+        if (setupTriangle(mesh, t, triangle)) {
+            triangles.push_back(triangle);
+        }
+    }
+
+    // split the output in bands of rows, each band rasterizes the triangles overlapping it
+    const int bandHeight = 64;
+    int numBands = (mesh.height + bandHeight - 1) / bandHeight;
+    std::vector<std::vector<uint32_t>> bands(numBands);
+    for (size_t t = 0; t < triangles.size(); ++t) {
+        int first = std::max(0, (int)std::ceil(triangles[t].minY) / bandHeight);
+        int last = std::min(numBands - 1, (int)std::floor(triangles[t].maxY) / bandHeight);
+        for (int band = first; band <= last; ++band) {
+            bands[band].push_back(t);
+        }
+    }
+    parallelFor(numBands, numThreads, [&](int band) {
+        int y0 = band * bandHeight;
+        int y1 = std::min(mesh.height, y0 + bandHeight);
+        for (uint32_t t : bands[band]) {
+            rasterizeTriangle(triangles[t], mesh.width, y0, y1, out + y0 * rowStride, rowStride);
+        }
+    });
+}
+
+template void rasterizeSurfaceMesh<float>(const SurfaceMesh& mesh, float* out, size_t rowStride, int numThreads);
+template void rasterizeSurfaceMesh<double>(const SurfaceMesh& mesh, double* out, size_t rowStride, int numThreads);
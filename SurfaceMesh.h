@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Triangle mesh approximating the sample map of a surface. Vertices are interleaved as x, y, sx, sy: the pixel position
+// of the vertex in the map and the surface point there, pixel origin included as in generateSurfacePoints().
+struct SurfaceMesh {
+    int width = 0;
+    int height = 0;
+    std::vector<double> vertices;
+    std::vector<uint32_t> indices;
+
+    size_t numVertices() const { return vertices.size() / 4; }
+    size_t numTriangles() const { return indices.size() / 3; }
+};
+
+// Fills the mesh.width x mesh.height sample map in out, in the layout of generateSurfacePoints() with rowStride
+// scalars between rows, by scanline rasterization of the mesh with barycentric interpolation of the surface points.
+// Samples are taken at integer pixel positions, like generateSurfacePoints() does. Shared edges are filled once, by
+// the triangle that owns them under a top-left rule; samples outside the mesh are left untouched.
+// Instantiated for float and double maps; the interpolation itself is done in double.
+template <class T>
+void rasterizeSurfaceMesh(const SurfaceMesh& mesh, T* out, size_t rowStride, int numThreads = 1);
@@ -0,0 +1,270 @@
+#include "TiledSurfaceMap.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ParallelFor.h"
+
+static const char kMagic[8] = {'S', 'P', 'L', 'M', 'A', 'P', '0', '1'};
+static const uint32_t kVersion = 1;
+
+static size_t alignToPage(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (size + page - 1) / page * page;
+}
+
+static void syncRange(void* address, size_t size)
+{
+    // msync needs a page aligned start address
+    size_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = reinterpret_cast<uintptr_t>(address) / page * page;
+    uintptr_t end = reinterpret_cast<uintptr_t>(address) + size;
+    msync(reinterpret_cast<void*>(start), end - start, MS_SYNC);
+}
+
+static bool headerMatches(const TiledSurfaceMapHeader& a, const TiledSurfaceMapHeader& b)
+{
+    return std::memcmp(a.magic, b.magic, sizeof(a.magic)) == 0 && a.version == b.version &&
+           a.tileWidth == b.tileWidth && a.tileHeight == b.tileHeight && a.width == b.width && a.height == b.height &&
+           a.stateHash == b.stateHash && a.tileBytes == b.tileBytes && a.dataOffset == b.dataOffset;
+}
+
+// Fills in the fields of layout that follow from its map and tile size.
+static void completeLayout(TiledSurfaceMapHeader& layout)
+{
+    layout.tilesX = (layout.width + layout.tileWidth - 1) / layout.tileWidth;
+    layout.tilesY = (layout.height + layout.tileHeight - 1) / layout.tileHeight;
+    layout.tileBytes = alignToPage((size_t)layout.tileWidth * layout.tileHeight * 2 * sizeof(double));
+    size_t numTiles = (size_t)layout.tilesX * layout.tilesY;
+    layout.dataOffset = alignToPage(sizeof(TiledSurfaceMapHeader) + numTiles * sizeof(TiledSurfaceMapTile));
+}
+
+// Index entry of tile index under layout, not completed yet.
+static TiledSurfaceMapTile tileEntry(const TiledSurfaceMapHeader& layout, size_t index)
+{
+    uint64_t tileX = index % layout.tilesX;
+    uint64_t tileY = index / layout.tilesX;
+    TiledSurfaceMapTile tile;
+    tile.offset = layout.dataOffset + index * layout.tileBytes;
+    tile.width = std::min<uint64_t>(layout.tileWidth, layout.width - tileX * layout.tileWidth);
+    tile.height = std::min<uint64_t>(layout.tileHeight, layout.height - tileY * layout.tileHeight);
+    tile.completed = 0;
+    tile.reserved = 0;
+    return tile;
+}
+
+static bool tilesMatch(const TiledSurfaceMapHeader& layout, const TiledSurfaceMapTile* tiles)
+{
+    for (size_t i = 0; i < (size_t)layout.tilesX * layout.tilesY; ++i) {
+        TiledSurfaceMapTile expected = tileEntry(layout, i);
+        if (tiles[i].offset != expected.offset || tiles[i].width != expected.width ||
+            tiles[i].height != expected.height || tiles[i].completed > 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether header describes the layout generate() writes for its map and tile size, in a file of exactly fileSize bytes.
+// The header may come from any file, so every size is checked to fit before it is computed.
+static bool layoutMatches(const TiledSurfaceMapHeader& header, uint64_t fileSize)
+{
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion ||
+        header.tileWidth == 0 || header.tileHeight == 0 || header.width > INT_MAX || header.height > INT_MAX ||
+        fileSize < sizeof(TiledSurfaceMapHeader)) {
+        return false;
+    }
+    if ((uint64_t)header.tileWidth * header.tileHeight > (UINT64_MAX - alignToPage(1)) / (2 * sizeof(double))) {
+        return false;
+    }
+    // below 2^62 tiles, as the width and height are below 2^31
+    uint64_t numTiles = ((header.width + header.tileWidth - 1) / header.tileWidth) *
+                        ((header.height + header.tileHeight - 1) / header.tileHeight);
+    if (numTiles > (fileSize - sizeof(TiledSurfaceMapHeader)) / sizeof(TiledSurfaceMapTile)) {
+        return false;
+    }
+    TiledSurfaceMapHeader layout = header;
+    completeLayout(layout);
+    if (layout.tilesX != header.tilesX || layout.tilesY != header.tilesY || layout.tileBytes != header.tileBytes ||
+        layout.dataOffset != header.dataOffset || layout.dataOffset > fileSize ||
+        numTiles > (fileSize - layout.dataOffset) / layout.tileBytes) {
+        return false;
+    }
+    return layout.dataOffset + numTiles * layout.tileBytes == fileSize;
+}
+
+int TiledSurfaceMap::generate(ParametricSurfaceGrid& grid, const std::string& path,
+                              const TiledSurfaceMapOptions& options)
+{
+    TiledSurfaceMapHeader layout;
+    std::memset(&layout, 0, sizeof(layout));
+    std::memcpy(layout.magic, kMagic, sizeof(kMagic));
+    layout.version = kVersion;
+    layout.tileWidth = std::max(1, options.tileWidth);
+    layout.tileHeight = std::max(1, options.tileHeight);
+    // a tile is mapped whole, so one larger than the budget is cut down to fit: fewer rows first, then fewer columns
+    size_t pixelBytes = 2 * sizeof(double);
+    size_t budget = options.memoryBudget / alignToPage(1) * alignToPage(1);
+    if (budget < pixelBytes) {
+        return -1;
+    }
+    if ((size_t)layout.tileWidth * layout.tileHeight * pixelBytes > budget) {
+        layout.tileHeight = std::max<size_t>(1, budget / ((size_t)layout.tileWidth * pixelBytes));
+        layout.tileWidth = std::min<size_t>(layout.tileWidth, budget / pixelBytes);
+    }
+    layout.width = grid.pixelWidth();
+    layout.height = grid.pixelHeight();
+    layout.stateHash = grid.stateHash();
+    completeLayout(layout);
+    size_t numTiles = (size_t)layout.tilesX * layout.tilesY;
+    size_t headerBytes = sizeof(TiledSurfaceMapHeader) + numTiles * sizeof(TiledSurfaceMapTile);
+    size_t fileSize = layout.dataOffset + numTiles * layout.tileBytes;
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat info;
+    bool resume = false;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size == fileSize) {
+        TiledSurfaceMapHeader existing;
+        resume = pread(fd, &existing, sizeof(existing), 0) == sizeof(existing) && headerMatches(existing, layout);
+    }
+    // a new file is sparse, tile slots only take disk space once they are written
+    if (!resume && (ftruncate(fd, 0) != 0 || ftruncate(fd, fileSize) != 0)) {
+        ::close(fd);
+        return -1;
+    }
+    void* headerMapping = mmap(nullptr, layout.dataOffset, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (headerMapping == MAP_FAILED) {
+        ::close(fd);
+        return -1;
+    }
+    TiledSurfaceMapHeader* header = static_cast<TiledSurfaceMapHeader*>(headerMapping);
+    TiledSurfaceMapTile* tiles = reinterpret_cast<TiledSurfaceMapTile*>(header + 1);
+    // a damaged index is started over, its tiles could point anywhere
+    if (!resume || !tilesMatch(layout, tiles)) {
+        *header = layout;
+        for (size_t i = 0; i < numTiles; ++i) {
+            tiles[i] = tileEntry(layout, i);
+        }
+        syncRange(headerMapping, headerBytes);
+    }
+
+    std::vector<int> pending;
+    for (size_t i = 0; i < numTiles; ++i) {
+        if (!tiles[i].completed) {
+            pending.push_back(i);
+        }
+    }
+    int numThreads = options.numThreads > 0 ? options.numThreads : std::max(1u, std::thread::hardware_concurrency());
+    numThreads = std::max<size_t>(1, std::min<size_t>(numThreads, options.memoryBudget / layout.tileBytes));
+
+    std::atomic<int> generated(0);
+    std::atomic<bool> failed(false);
+    parallelFor(pending.size(), numThreads, [&](int i) {
+        if (failed) {
+            return;
+        }
+        int index = pending[i];
+        TiledSurfaceMapTile& tile = tiles[index];
+        void* data = mmap(nullptr, layout.tileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, tile.offset);
+        if (data == MAP_FAILED) {
+            // the tile stays incomplete, so a later call picks it up again
+            failed = true;
+            return;
+        }
+        int tileX = index % layout.tilesX;
+        int tileY = index / layout.tilesX;
+        grid.generateSurfaceTile(tileX * layout.tileWidth, tileY * layout.tileHeight, tile.width, tile.height,
+                                 static_cast<double*>(data), (size_t)tile.width * 2);
+        // flush and unmap right away, so resident memory stays within the budget
+        msync(data, layout.tileBytes, MS_SYNC);
+        munmap(data, layout.tileBytes);
+        tile.completed = 1;
+        syncRange(&tile, sizeof(tile));
+        generated++;
+    });
+
+    munmap(headerMapping, layout.dataOffset);
+    ::close(fd);
+    return failed ? -1 : (int)generated;
+}
+
+TiledSurfaceMap::TiledSurfaceMap() : _mapping(nullptr), _mappingSize(0), _header(nullptr), _tiles(nullptr) {}
+
+TiledSurfaceMap::~TiledSurfaceMap() { close(); }
+
+bool TiledSurfaceMap::open(const std::string& path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(TiledSurfaceMapHeader)) {
+        ::close(fd);
+        return false;
+    }
+    void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    // the header and every index entry must be the ones generate() writes, so that all tiles lie inside the file
+    const TiledSurfaceMapHeader* header = static_cast<const TiledSurfaceMapHeader*>(mapping);
+    if (!layoutMatches(*header, info.st_size) ||
+        !tilesMatch(*header, reinterpret_cast<const TiledSurfaceMapTile*>(header + 1))) {
+        munmap(mapping, info.st_size);
+        return false;
+    }
+    _mapping = mapping;
+    _mappingSize = info.st_size;
+    _header = header;
+    _tiles = reinterpret_cast<const TiledSurfaceMapTile*>(header + 1);
+    return true;
+}
+
+void TiledSurfaceMap::close()
+{
+    if (_mapping) {
+        munmap(_mapping, _mappingSize);
+    }
+    _mapping = nullptr;
+    _mappingSize = 0;
+    _header = nullptr;
+    _tiles = nullptr;
+}
+
+bool TiledSurfaceMap::isComplete() const
+{
+    for (uint32_t i = 0; i < _header->tilesX * _header->tilesY; ++i) {
+        if (!_tiles[i].completed) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const double* TiledSurfaceMap::tileData(int tileX, int tileY) const
+{
+    return reinterpret_cast<const double*>(static_cast<const char*>(_mapping) + tile(tileX, tileY).offset);
+}
+
+vec2d TiledSurfaceMap::at(int x, int y) const
+{
+    int tileX = x / _header->tileWidth;
+    int tileY = y / _header->tileHeight;
+    const double* data = tileData(tileX, tileY);
+    size_t index =
+        (size_t)(y - tileY * _header->tileHeight) * tile(tileX, tileY).width + (x - tileX * _header->tileWidth);
+    return vec2d(data[2 * index], data[2 * index + 1]);
+}
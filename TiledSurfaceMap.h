@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "ParametricSurfaceGrid.h"
+#include "vec2.h"
+
+struct TiledSurfaceMapOptions {
+    int tileWidth = 512;
+    int tileHeight = 512;
+    // Upper bound, in bytes, on the tile buffers mapped at the same time. Every worker maps one tile at a time, so this
+    // also caps the number of worker threads, and tiles that would not fit on their own are made smaller.
+    size_t memoryBudget = 256 * 1024 * 1024;
+    // 0 means one worker per hardware thread, within the memory budget
+    int numThreads = 0;
+};
+
+// On-disk layout: a header and the tile index at the start of the file, then one page aligned slot per tile. A tile
+// holds its width x height pixels as x,y interleaved doubles, row-major, like generateSurfacePoints() does for the
+// whole map.
+struct TiledSurfaceMapHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t tileWidth;
+    uint32_t tileHeight;
+    uint32_t tilesX;
+    uint32_t tilesY;
+    uint32_t reserved;
+    uint64_t width;
+    uint64_t height;
+    uint64_t stateHash;
+    uint64_t tileBytes;
+    uint64_t dataOffset;
+};
+
+struct TiledSurfaceMapTile {
+    uint64_t offset;
+    uint32_t width;
+    uint32_t height;
+    // set only after the tile data has been flushed to the file, so an interrupted generation can resume from it
+    uint32_t completed;
+    uint32_t reserved;
+};
+
+// Sample map of a ParametricSurfaceGrid stored out of core, in a tiled memory mapped file. Used for outputs that are
+// too large for State::surfacePoints.
+class TiledSurfaceMap {
+public:
+    TiledSurfaceMap();
+    ~TiledSurfaceMap();
+    TiledSurfaceMap(const TiledSurfaceMap&) = delete;
+    TiledSurfaceMap& operator=(const TiledSurfaceMap&) = delete;
+
+    // Generates the sample map of grid into the file at path, in parallel across tiles. If the file already holds a
+    // partial map of the same grid state and tile layout, only the tiles not completed yet are generated.
+    // Returns the number of tiles generated by this call, or -1 if the file could not be created or mapped, a tile
+    // could not be mapped, or the memory budget does not hold a single pixel. Tiles completed before a failure are
+    // kept. A file whose tile index does not match its layout is generated anew.
+    static int generate(ParametricSurfaceGrid& grid, const std::string& path,
+                        const TiledSurfaceMapOptions& options = TiledSurfaceMapOptions());
+
+    // Maps a generated file read only. Pages are loaded on demand, so opening does not read the map. Returns false if
+    // the header or tile index differs from the layout generate() writes for the map and tile size it records.
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return _header != nullptr; }
+    bool isComplete() const;
+
+    int width() const { return _header->width; }
+    int height() const { return _header->height; }
+    int tileWidth() const { return _header->tileWidth; }
+    int tileHeight() const { return _header->tileHeight; }
+    int tilesX() const { return _header->tilesX; }
+    int tilesY() const { return _header->tilesY; }
+    const TiledSurfaceMapTile& tile(int tileX, int tileY) const { return _tiles[tileY * _header->tilesX + tileX]; }
+    // Pixel data of a tile, with tile(tileX, tileY).width x,y pairs per row
+    const double* tileData(int tileX, int tileY) const;
+    vec2d at(int x, int y) const;
+
+private:
+    void* _mapping;
+    size_t _mappingSize;
+    const TiledSurfaceMapHeader* _header;
+    const TiledSurfaceMapTile* _tiles;
+};
@@ -5,58 +5,62 @@
 
 #include <cmath>
 
-class rect {
+template <class T>
+class rectT {
 
 public:
-    rect() {
+    rectT() {
         // empty
     }
 
-    rect(const vec2d& origin, double width, double height) {
+    rectT(const vec2<T>& origin, T width, T height) {
         this->_origin = origin;
-        this->_size = vec2d(width, height);
+        this->_size = vec2<T>(width, height);
     }
 
-    rect(double x, double y, double width, double height) {
-        this->_origin = vec2d(x, y);
-        this->_size = vec2d(width, height);
+    rectT(T x, T y, T width, T height) {
+        this->_origin = vec2<T>(x, y);
+        this->_size = vec2<T>(width, height);
     }
 
-    void moveTo(const vec2d& pos) {
+    void moveTo(const vec2<T>& pos) {
         this->_origin = pos;
     }
 
-    void moveTo(double x, double y) {
-        this->_origin = vec2d(x, y);
+    void moveTo(T x, T y) {
+        this->_origin = vec2<T>(x, y);
     }
 
-    void setWidth(double width) {
+    void setWidth(T width) {
         this->_size.x = width;
     }
 
-    void setHeight(double height) {
+    void setHeight(T height) {
         this->_size.y = height;
     }
 
-    double width() {
+    T width() {
         return this->_size.x;
     }
 
-    double height() {
+    T height() {
         return this->_size.y;
     }
 
-    void setSize(double width, double height) {
-        this->_size = vec2d(width, height);
+    void setSize(T width, T height) {
+        this->_size = vec2<T>(width, height);
     }
 
-    const vec2d& getOrigin() {
+    const vec2<T>& getOrigin() {
         return this->_origin;
     }
 
 private:
-    vec2d _origin;
-    vec2d _size;
+    vec2<T> _origin;
+    vec2<T> _size;
 };
 
+typedef rectT<double> rect;
+typedef rectT<float> rectf;
+
 #endif
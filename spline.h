@@ -32,6 +32,10 @@
 #include <vector>
 #include <algorithm>
 #include <cfloat>
+#include <limits>
+#include <cmath>
+
+#include "MemoryArena.h"
 
 // unnamed namespace only because the implementation is in this
 // header file and we don't want to export symbols to the obj files
@@ -41,43 +45,67 @@ namespace
 namespace tk
 {
 
+// storage used by the solver and the splines, optionally drawn from a MemoryArena
+template<class T>
+using arena_vector = std::vector<T, ArenaAllocator<T> >;
+typedef arena_vector<double> dvector;
+
 // band matrix solver
-class band_matrix
+template<class T>
+class basic_band_matrix
 {
 private:
-    std::vector< std::vector<double> > m_upper;  // upper band
-    std::vector< std::vector<double> > m_lower;  // lower band
+    // all bands in one block: the n_u+1 upper bands (diagonal first)
+    // followed by the n_l+1 lower bands (saved diagonal first)
+    arena_vector<T> m_bands;
+    int     m_dim, m_num_upper, m_num_lower;
 public:
-    band_matrix() {};                             // constructor
-    band_matrix(int dim, int n_u, int n_l);       // constructor
-    ~band_matrix() {};                            // destructor
+    basic_band_matrix(MemoryArena* arena=nullptr)       // constructor
+        : m_bands(ArenaAllocator<T>(arena)), m_dim(0), m_num_upper(0), m_num_lower(0) {};
+    basic_band_matrix(int dim, int n_u, int n_l, MemoryArena* arena=nullptr);  // constructor
+    ~basic_band_matrix() {};                            // destructor
     void resize(int dim, int n_u, int n_l);      // init with dim,n_u,n_l
+    // frees the storage, resize() has to be called before further use
+    void clear()
+    {
+        arena_vector<T>(m_bands.get_allocator()).swap(m_bands);
+        m_dim=0;
+    }
+    size_t memory_size() const
+    {
+        return m_bands.capacity()*sizeof(T);
+    }
     int dim() const;                             // matrix dimension
     int num_upper() const
     {
-        return m_upper.size()-1;
+        return m_num_upper;
     }
     int num_lower() const
     {
-        return m_lower.size()-1;
+        return m_num_lower;
     }
     // access operator
-    double & operator () (int i, int j);            // write
-    double   operator () (int i, int j) const;      // read
+    T & operator () (int i, int j);            // write
+    T   operator () (int i, int j) const;      // read
     // we can store an additional diogonal (in m_lower)
-    double& saved_diag(int i);
-    double  saved_diag(int i) const;
+    T& saved_diag(int i);
+    T  saved_diag(int i) const;
     void lu_decompose();
-    std::vector<double> r_solve(const std::vector<double>& b) const;
-    std::vector<double> l_solve(const std::vector<double>& b) const;
-    std::vector<double> lu_solve(const std::vector<double>& b,
+    std::vector<T> r_solve(const std::vector<T>& b) const;
+    std::vector<T> l_solve(const std::vector<T>& b) const;
+    std::vector<T> lu_solve(const std::vector<T>& b,
                                  bool is_lu_decomposed=false);
+    // in place variants, b has dim() entries and is overwritten by the solution
+    void l_solve_inplace(T* b) const;
+    void r_solve_inplace(T* b) const;
+    void lu_solve_inplace(T* b, bool is_lu_decomposed=false);
 
 };
 
 
-// spline interpolation
-class spline
+// spline interpolation, templated on the scalar type
+template<class T>
+class basic_spline
 {
 public:
     enum bd_type {
@@ -86,19 +114,26 @@ public:
     };
 
 private:
-    std::vector<double> m_x,m_y;            // x,y coordinates of points
+    arena_vector<T> m_x,m_y;                        // x,y coordinates of points
     // interpolation parameters
     // f(x) = a*(x-x_i)^3 + b*(x-x_i)^2 + c*(x-x_i) + y_i
-    std::vector<double> m_a,m_b,m_c;        // spline coefficients
-    double  m_b0, m_c0;                     // for left extrapol
+    arena_vector<T> m_a,m_b,m_c;                    // spline coefficients
+    basic_band_matrix<T> m_A;                        // solver workspace, kept to avoid reallocating on every refit
+    T  m_b0, m_c0;                     // for left extrapol
     bd_type m_left, m_right;
-    double  m_left_value, m_right_value;
+    T  m_left_value, m_right_value;
     bool    m_force_linear_extrapolation;
     bool _linear;
 
 public:
     // set default boundary condition to be zero curvature at both ends
-    spline(bool linear=false): m_left(second_deriv), m_right(second_deriv),
+    // if an arena is given, all point, coefficient and solver storage is allocated from it
+    basic_spline(bool linear=false, MemoryArena* arena=nullptr):
+        m_x(ArenaAllocator<T>(arena)), m_y(ArenaAllocator<T>(arena)),
+        m_a(ArenaAllocator<T>(arena)), m_b(ArenaAllocator<T>(arena)),
+        m_c(ArenaAllocator<T>(arena)), m_A(arena),
+        m_b0(0.0), m_c0(0.0),
+        m_left(second_deriv), m_right(second_deriv),
         m_left_value(0.0), m_right_value(0.0),
         m_force_linear_extrapolation(false)
     {
@@ -108,30 +143,94 @@ public:
     void setLinear(bool value)
     {
         _linear = value;
-        set_points(m_x, m_y);
+        set_points(m_x.data(), m_y.data(), m_x.size());
     }
-    void getPoints(std::vector<double>& x, std::vector<double>& y);
+    void getPoints(std::vector<T>& x, std::vector<T>& y);
     unsigned int getNumPoints() { return m_x.size(); }
-    void get_point(int i, double& x, double& y);
-    void set_point(int i, double x, double y, bool regenerateSpline = true);
-    void move_point(int i, double deltax, double deltay, bool regenerateSpline = true);
+    void get_point(int i, T& x, T& y);
+    // set_point() clamps x to keep it at least min_point_spacing from its neighbours
+    static constexpr T min_point_spacing = 3;
+    void set_point(int i, T x, T y, bool regenerateSpline = true);
+    void move_point(int i, T deltax, T deltay, bool regenerateSpline = true);
+    // sets point i as given, without clamping or refitting, for callers that set many points and keep x ascending
+    void store_point(int i, T x, T y)
+    {
+        m_x[i] = x;
+        m_y[i] = y;
+    }
+    // regenerates the spline after points were changed with regenerateSpline=false
+    void refit()
+    {
+        set_points(m_x.data(), m_y.data(), m_x.size());
+    }
+    // scratch storage of refit_batch(), kept by the caller so that repeated batches do not allocate once it has grown
+    // to their size; a copy starts empty
+    struct batch_workspace {
+        std::vector<basic_spline*> cubic;
+        std::vector<T> work;
+        batch_workspace() {}
+        batch_workspace(const batch_workspace&) {}
+        batch_workspace& operator=(const batch_workspace&) { return *this; }
+    };
+    // refit() of the count splines starting at splines: the tridiagonal systems of up to 8 cubic splines with the same
+    // number of points are interleaved and solved together, so the solver loops run across splines and vectorize.
+    // Boundary conditions may differ between splines. The coefficients are identical to the ones refit() computes.
+    static void refit_batch(basic_spline* splines, int count, batch_workspace& workspace);
     // optional, but if called it has to come be before set_points()
-    void set_boundary(bd_type left, double left_value,
-                      bd_type right, double right_value,
+    void set_boundary(bd_type left, T left_value,
+                      bd_type right, T right_value,
                       bool force_linear_extrapolation=false);
-    void set_points(const std::vector<double>& x,
-                    const std::vector<double>& y, bool cubic_spline=true);
-    double operator() (double x) const;
-    double getParameter(double x){
+    void set_points(const std::vector<T>& x,
+                    const std::vector<T>& y, bool cubic_spline=true);
+    void set_points(const T* x, const T* y, int n,
+                    bool cubic_spline=true);
+    T operator() (T x) const;
+    T getParameter(T x){
         return (x-m_x.front())/(m_x.back() - m_x.front());
     }
-    double interpolateX(double t) const {
+    T interpolateX(T t) const {
         return m_x.front() * (1-t) + m_x.back() * t;
     }
-    double eval(double t) const {
+    T eval(T t) const {
       return (*this)(interpolateX(t));
     }
-    double deriv(int order, double x) const;
+    T deriv(int order, T x) const;
+    // maps the spline to the one of the data scaled by sx along x and sy along y, by rescaling knots and coefficients
+    // analytically; equivalent to refitting the scaled points, without solving
+    void scale(T sx, T sy);
+    // adds count knots at the sorted positions x, strictly inside the range of the knots and not on one of them. A
+    // cubic spline that passes through its own values at the new knots is the same function, so the coefficients of
+    // the split segments follow from a Taylor shift of the old ones and nothing needs to be solved.
+    void insert_knots(const T* x, int count);
+    // bytes of point, coefficient and solver storage
+    size_t memory_size() const
+    {
+        return (m_x.capacity()+m_y.capacity()+m_a.capacity()+m_b.capacity()+m_c.capacity())*sizeof(T)+
+               m_A.memory_size();
+    }
+    // frees the solver workspace, for splines that are kept but not refitted; the next fit allocates it again
+    void release_workspace()
+    {
+        m_A.clear();
+    }
+    // exact range [lo, hi] of the spline values, or of its first derivative, over [x0, x1], following the extrapolation
+    // of operator() outside the knots; the extremes of each piece are at its ends or where its derivative has a root
+    void value_range(T x0, T x1, T& lo, T& hi) const;
+    void deriv_range(T x0, T x1, T& lo, T& hi) const;
+    // range of the second derivative of the pieces; the slope jumps of linear splines at their knots are not included
+    void second_deriv_range(T x0, T x1, T& lo, T& hi) const;
+
+private:
+    // coefficients of piece i, f(x) = a*h^3 + b*h^2 + c*h + y with h = x - xi, also for linear splines: segment i
+    // for 0 <= i < n-1, the left extrapolation for i = -1 and the right one for i = n-1, anchored at the first and last
+    // knot
+    void piece(int i, T& xi, T& y, T& a, T& b, T& c) const;
+    // pieces crossed by [x0, x1], and the part of [x0, x1] in piece i relative to its anchor
+    void piece_span(T x0, T x1, int& first, int& last) const;
+    void piece_interval(int i, T x0, T x1, T xi, T& h0, T& h1) const;
+    int segment_index(T x) const;
+    // extrapolation coefficients and the last segment, once a[], b[] and c[] are fitted
+    void set_extrapolation();
 };
 
 
@@ -144,78 +243,80 @@ public:
 // band_matrix implementation
 // -------------------------
 
-band_matrix::band_matrix(int dim, int n_u, int n_l)
+template<class T>
+basic_band_matrix<T>::basic_band_matrix(int dim, int n_u, int n_l, MemoryArena* arena)
+    : m_bands(ArenaAllocator<T>(arena))
 {
     resize(dim, n_u, n_l);
 }
-void band_matrix::resize(int dim, int n_u, int n_l)
+template<class T>
+void basic_band_matrix<T>::resize(int dim, int n_u, int n_l)
 {
     assert(dim>0);
     assert(n_u>=0);
     assert(n_l>=0);
-    m_upper.resize(n_u+1);
-    m_lower.resize(n_l+1);
-    for(size_t i=0; i<m_upper.size(); i++) {
-        m_upper[i].resize(dim);
-    }
-    for(size_t i=0; i<m_lower.size(); i++) {
-        m_lower[i].resize(dim);
-    }
+    m_dim=dim;
+    m_num_upper=n_u;
+    m_num_lower=n_l;
+    // assign() only reallocates when growing, so refits of the same size reuse the storage
+    m_bands.assign((n_u+1+n_l+1)*dim, 0.0);
 }
-int band_matrix::dim() const
+template<class T>
+int basic_band_matrix<T>::dim() const
 {
-    if(m_upper.size()>0) {
-        return m_upper[0].size();
-    } else {
-        return 0;
-    }
+    return m_dim;
 }
 
 
 // defines the new operator (), so that we can access the elements
 // by A(i,j), index going from i=0,...,dim()-1
-double & band_matrix::operator () (int i, int j)
+template<class T>
+T & basic_band_matrix<T>::operator () (int i, int j)
 {
     int k=j-i;       // what band is the entry
     assert( (i>=0) && (i<dim()) && (j>=0) && (j<dim()) );
     assert( (-num_lower()<=k) && (k<=num_upper()) );
     // k=0 -> diogonal, k<0 lower left part, k>0 upper right part
-    if(k>=0)   return m_upper[k][i];
-    else	    return m_lower[-k][i];
+    if(k>=0)   return m_bands[k*m_dim+i];
+    else	    return m_bands[(m_num_upper+1-k)*m_dim+i];
 }
-double band_matrix::operator () (int i, int j) const
+template<class T>
+T basic_band_matrix<T>::operator () (int i, int j) const
 {
     int k=j-i;       // what band is the entry
     assert( (i>=0) && (i<dim()) && (j>=0) && (j<dim()) );
     assert( (-num_lower()<=k) && (k<=num_upper()) );
     // k=0 -> diogonal, k<0 lower left part, k>0 upper right part
-    if(k>=0)   return m_upper[k][i];
-    else	    return m_lower[-k][i];
+    if(k>=0)   return m_bands[k*m_dim+i];
+    else	    return m_bands[(m_num_upper+1-k)*m_dim+i];
 }
 // second diag (used in LU decomposition), saved in m_lower
-double band_matrix::saved_diag(int i) const
+template<class T>
+T basic_band_matrix<T>::saved_diag(int i) const
 {
     assert( (i>=0) && (i<dim()) );
-    return m_lower[0][i];
+    return m_bands[(m_num_upper+1)*m_dim+i];
 }
-double & band_matrix::saved_diag(int i)
+template<class T>
+T & basic_band_matrix<T>::saved_diag(int i)
 {
     assert( (i>=0) && (i<dim()) );
-    return m_lower[0][i];
+    return m_bands[(m_num_upper+1)*m_dim+i];
 }
 
 // LR-Decomposition of a band matrix
-void band_matrix::lu_decompose()
+template<class T>
+void basic_band_matrix<T>::lu_decompose()
 {
     int  i_max,j_max;
     int  j_min;
-    double x;
+    T x;
 
     // preconditioning
     // normalize column i so that a_ii=1
     for(int i=0; i<this->dim(); i++) {
         assert(this->operator()(i,i)!=0.0);
-        this->saved_diag(i)=1.0/this->operator()(i,i);
+        this->saved_diag(i)=T(1.0)/this->operator()(i,i);
         j_min=std::max(0,i-this->num_lower());
         j_max=std::min(this->dim()-1,i+this->num_upper());
         for(int j=j_min; j<=j_max; j++) {
@@ -240,12 +341,13 @@ void band_matrix::lu_decompose()
     }
 }
 // solves Ly=b
-std::vector<double> band_matrix::l_solve(const std::vector<double>& b) const
+template<class T>
+std::vector<T> basic_band_matrix<T>::l_solve(const std::vector<T>& b) const
 {
     assert( this->dim()==(int)b.size() );
-    std::vector<double> x(this->dim());
+    std::vector<T> x(this->dim());
     int j_start;
-    double sum;
+    T sum;
     for(int i=0; i<this->dim(); i++) {
         sum=0;
         j_start=std::max(0,i-this->num_lower());
@@ -255,12 +357,13 @@ std::vector<double> band_matrix::l_solve(const std::vector<double>& b) const
     return x;
 }
 // solves Rx=y
-std::vector<double> band_matrix::r_solve(const std::vector<double>& b) const
+template<class T>
+std::vector<T> basic_band_matrix<T>::r_solve(const std::vector<T>& b) const
 {
     assert( this->dim()==(int)b.size() );
-    std::vector<double> x(this->dim());
+    std::vector<T> x(this->dim());
     int j_stop;
-    double sum;
+    T sum;
     for(int i=this->dim()-1; i>=0; i--) {
         sum=0;
         j_stop=std::min(this->dim()-1,i+this->num_upper());
@@ -270,11 +373,12 @@ std::vector<double> band_matrix::r_solve(const std::vector<double>& b) const
     return x;
 }
 
-std::vector<double> band_matrix::lu_solve(const std::vector<double>& b,
+template<class T>
+std::vector<T> basic_band_matrix<T>::lu_solve(const std::vector<T>& b,
         bool is_lu_decomposed)
 {
     assert( this->dim()==(int)b.size() );
-    std::vector<double>  x,y;
+    std::vector<T>  x,y;
     if(is_lu_decomposed==false) {
         this->lu_decompose();
     }
@@ -283,50 +387,90 @@ std::vector<double> band_matrix::lu_solve(const std::vector<double>& b,
     return x;
 }
 
+// same as l_solve(), but overwrites b with x, which is possible because
+// x[i] only depends on b[i] and the already computed x[j], j<i
+template<class T>
+void basic_band_matrix<T>::l_solve_inplace(T* b) const
+{
+    int j_start;
+    T sum;
+    for(int i=0; i<this->dim(); i++) {
+        sum=0;
+        j_start=std::max(0,i-this->num_lower());
+        for(int j=j_start; j<i; j++) sum += this->operator()(i,j)*b[j];
+        b[i]=(b[i]*this->saved_diag(i)) - sum;
+    }
+}
+template<class T>
+void basic_band_matrix<T>::r_solve_inplace(T* b) const
+{
+    int j_stop;
+    T sum;
+    for(int i=this->dim()-1; i>=0; i--) {
+        sum=0;
+        j_stop=std::min(this->dim()-1,i+this->num_upper());
+        for(int j=i+1; j<=j_stop; j++) sum += this->operator()(i,j)*b[j];
+        b[i]=( b[i] - sum ) / this->operator()(i,i);
+    }
+}
+template<class T>
+void basic_band_matrix<T>::lu_solve_inplace(T* b, bool is_lu_decomposed)
+{
+    if(is_lu_decomposed==false) {
+        this->lu_decompose();
+    }
+    this->l_solve_inplace(b);
+    this->r_solve_inplace(b);
+}
+
 
 
 
 // spline implementation
 // -----------------------
 
-void spline::move_point(int i, double deltax, double deltay, bool regenerateSpline)
+template<class T>
+void basic_spline<T>::move_point(int i, T deltax, T deltay, bool regenerateSpline)
 {
-    set_point(i, m_x[i] + deltax, m_y[i] + deltay);
+    set_point(i, m_x[i] + deltax, m_y[i] + deltay, regenerateSpline);
 }
 
-void spline::getPoints(std::vector<double>& x, std::vector<double>& y)
+template<class T>
+void basic_spline<T>::getPoints(std::vector<T>& x, std::vector<T>& y)
 {
-    x = m_x;
-    y = m_y;
+    x.assign(m_x.begin(), m_x.end());
+    y.assign(m_y.begin(), m_y.end());
 }
-void spline::get_point(int i, double& x, double& y)
+template<class T>
+void basic_spline<T>::get_point(int i, T& x, T& y)
 {
     x = m_x[i];
     y = m_y[i];
 }
 
-void spline::set_point(int i, double x, double y, bool regenerateSpline)
+template<class T>
+void basic_spline<T>::set_point(int i, T x, T y, bool regenerateSpline)
 {
-    static const double controlPointOffset = 3;
-    double minVal = -DBL_MAX;
-    double maxVal = DBL_MAX;
+    T minVal = -std::numeric_limits<T>::max();
+    T maxVal = std::numeric_limits<T>::max();
     if(i > 0) {
-        minVal = m_x[i-1] + controlPointOffset;
+        minVal = m_x[i-1] + min_point_spacing;
     }
 
-    if(i < m_x.size()-1) {
-        maxVal = m_x[i+1] - controlPointOffset;
+    if(i < (int)m_x.size()-1) {
+        maxVal = m_x[i+1] - min_point_spacing;
     }
     m_x[i] = std::max(minVal, std::min(maxVal, x));
     m_y[i] = y;
     if(regenerateSpline)
     {
-        set_points(m_x, m_y);
+        set_points(m_x.data(), m_y.data(), m_x.size());
     }
 }
 
-void spline::set_boundary(spline::bd_type left, double left_value,
-                          spline::bd_type right, double right_value,
+template<class T>
+void basic_spline<T>::set_boundary(bd_type left, T left_value,
+                          bd_type right, T right_value,
                           bool force_linear_extrapolation)
 {
     assert(m_x.size()==0);          // set_points() must not have happened yet
@@ -338,14 +482,26 @@ void spline::set_boundary(spline::bd_type left, double left_value,
 }
 
 
-void spline::set_points(const std::vector<double>& x,
-                        const std::vector<double>& y, bool cubic_spline)
+template<class T>
+void basic_spline<T>::set_points(const std::vector<T>& x,
+                        const std::vector<T>& y, bool cubic_spline)
 {
     assert(x.size()==y.size());
-    assert(x.size()>2);
-    m_x=x;
-    m_y=y;
-    int   n=x.size();
+    set_points(x.data(), y.data(), x.size(), cubic_spline);
+}
+
+template<class T>
+void basic_spline<T>::set_points(const T* x, const T* y, int n,
+                        bool cubic_spline)
+{
+    assert(n>2);
+    // x and y may alias our own storage when refitting after point edits
+    if(x!=m_x.data()) {
+        m_x.assign(x, x+n);
+    }
+    if(y!=m_y.data()) {
+        m_y.assign(y, y+n);
+    }
     // TODO: maybe sort x and y, rather than returning an error
     for(int i=0; i<n-1; i++) {
         assert(m_x[i]<m_x[i+1]);
@@ -357,55 +513,58 @@ void spline::set_points(const std::vector<double>& x,
     if(cubic_spline==true) { // cubic spline interpolation
         // setting up the matrix and right hand side of the equation system
         // for the parameters b[]
-        band_matrix A(n,1,1);
-        std::vector<double>  rhs(n);
+        // the right hand side is assembled in m_b and solved in place
+        basic_band_matrix<T>& A=m_A;
+        A.resize(n,1,1);
+        arena_vector<T>& rhs=m_b;
+        rhs.resize(n);
         for(int i=1; i<n-1; i++) {
-            A(i,i-1)=1.0/3.0*(x[i]-x[i-1]);
-            A(i,i)=2.0/3.0*(x[i+1]-x[i-1]);
-            A(i,i+1)=1.0/3.0*(x[i+1]-x[i]);
+            A(i,i-1)=T(1.0/3.0)*(x[i]-x[i-1]);
+            A(i,i)=T(2.0/3.0)*(x[i+1]-x[i-1]);
+            A(i,i+1)=T(1.0/3.0)*(x[i+1]-x[i]);
             rhs[i]=(y[i+1]-y[i])/(x[i+1]-x[i]) - (y[i]-y[i-1])/(x[i]-x[i-1]);
         }
         // boundary conditions
-        if(m_left == spline::second_deriv) {
+        if(m_left == second_deriv) {
             // 2*b[0] = f''
             A(0,0)=2.0;
             A(0,1)=0.0;
             rhs[0]=m_left_value;
-        } else if(m_left == spline::first_deriv) {
+        } else if(m_left == first_deriv) {
             // c[0] = f', needs to be re-expressed in terms of b:
             // (2b[0]+b[1])(x[1]-x[0]) = 3 ((y[1]-y[0])/(x[1]-x[0]) - f')
-            A(0,0)=2.0*(x[1]-x[0]);
-            A(0,1)=1.0*(x[1]-x[0]);
-            rhs[0]=3.0*((y[1]-y[0])/(x[1]-x[0])-m_left_value);
+            A(0,0)=T(2.0)*(x[1]-x[0]);
+            A(0,1)=T(1.0)*(x[1]-x[0]);
+            rhs[0]=T(3.0)*((y[1]-y[0])/(x[1]-x[0])-m_left_value);
         } else {
             assert(false);
         }
-        if(m_right == spline::second_deriv) {
+        if(m_right == second_deriv) {
             // 2*b[n-1] = f''
             A(n-1,n-1)=2.0;
             A(n-1,n-2)=0.0;
             rhs[n-1]=m_right_value;
-        } else if(m_right == spline::first_deriv) {
+        } else if(m_right == first_deriv) {
             // c[n-1] = f', needs to be re-expressed in terms of b:
             // (b[n-2]+2b[n-1])(x[n-1]-x[n-2])
             // = 3 (f' - (y[n-1]-y[n-2])/(x[n-1]-x[n-2]))
-            A(n-1,n-1)=2.0*(x[n-1]-x[n-2]);
-            A(n-1,n-2)=1.0*(x[n-1]-x[n-2]);
-            rhs[n-1]=3.0*(m_right_value-(y[n-1]-y[n-2])/(x[n-1]-x[n-2]));
+            A(n-1,n-1)=T(2.0)*(x[n-1]-x[n-2]);
+            A(n-1,n-2)=T(1.0)*(x[n-1]-x[n-2]);
+            rhs[n-1]=T(3.0)*(m_right_value-(y[n-1]-y[n-2])/(x[n-1]-x[n-2]));
         } else {
             assert(false);
         }
 
         // solve the equation system to obtain the parameters b[]
-        m_b=A.lu_solve(rhs);
+        A.lu_solve_inplace(rhs.data());
 
         // calculate parameters a[] and c[] based on b[]
         m_a.resize(n);
         m_c.resize(n);
         for(int i=0; i<n-1; i++) {
-            m_a[i]=1.0/3.0*(m_b[i+1]-m_b[i])/(x[i+1]-x[i]);
+            m_a[i]=T(1.0/3.0)*(m_b[i+1]-m_b[i])/(x[i+1]-x[i]);
             m_c[i]=(y[i+1]-y[i])/(x[i+1]-x[i])
-                   - 1.0/3.0*(2.0*m_b[i]+m_b[i+1])*(x[i+1]-x[i]);
+                   - T(1.0/3.0)*(T(2.0)*m_b[i]+m_b[i+1])*(x[i+1]-x[i]);
         }
     } else { // linear interpolation
         m_a.resize(n);
@@ -418,30 +577,198 @@ void spline::set_points(const std::vector<double>& x,
         }
     }
 
+    set_extrapolation();
+}
+
+template<class T>
+void basic_spline<T>::set_extrapolation()
+{
+    int n=m_x.size();
     // for left extrapolation coefficients
     m_b0 = (m_force_linear_extrapolation==false) ? m_b[0] : 0.0;
     m_c0 = m_c[0];
 
     // for the right extrapolation coefficients
     // f_{n-1}(x) = b*(x-x_{n-1})^2 + c*(x-x_{n-1}) + y_{n-1}
-    double h=x[n-1]-x[n-2];
+    T h=m_x[n-1]-m_x[n-2];
     // m_b[n-1] is determined by the boundary condition
     m_a[n-1]=0.0;
-    m_c[n-1]=3.0*m_a[n-2]*h*h+2.0*m_b[n-2]*h+m_c[n-2];   // = f'_{n-2}(x_{n-1})
+    m_c[n-1]=T(3.0)*m_a[n-2]*h*h+T(2.0)*m_b[n-2]*h+m_c[n-2];   // = f'_{n-2}(x_{n-1})
     if(m_force_linear_extrapolation==true)
         m_b[n-1]=0.0;
 }
 
-double spline::operator() (double x) const
+template<class T>
+void basic_spline<T>::refit_batch(basic_spline* splines, int count, batch_workspace& workspace)
+{
+    const int lanes=8;
+    // cubic splines are solved in groups of the same size, linear ones need no solving
+    std::vector<basic_spline*>& cubic=workspace.cubic;
+    cubic.clear();
+    for(int s=0; s<count; s++) {
+        if(splines[s]._linear) {
+            splines[s].refit();
+        } else {
+            cubic.push_back(&splines[s]);
+        }
+    }
+    // std::sort, unlike std::stable_sort, needs no buffer; the order within a size does not change the coefficients
+    std::sort(cubic.begin(), cubic.end(), [](const basic_spline* a, const basic_spline* b) {
+        return a->m_x.size()<b->m_x.size();
+    });
+
+    std::vector<T>& work=workspace.work;
+    for(size_t first=0; first<cubic.size(); ) {
+        int n=cubic[first]->m_x.size();
+        assert(n>2);
+        size_t last=first+1;
+        while(last<cubic.size() && last-first<(size_t)lanes && (int)cubic[last]->m_x.size()==n) {
+            last++;
+        }
+        // a partial group repeats its last spline in the spare lanes, so every loop runs over all lanes
+        basic_spline* group[lanes];
+        for(int l=0; l<lanes; l++) {
+            group[l]=cubic[std::min(first+l, last-1)];
+        }
+
+        // the tridiagonal systems of the group side by side, entry i of lane l at i*lanes+l
+        size_t size=(size_t)n*lanes;
+        work.assign(7*size, T(0.0));
+        T* x=work.data();
+        T* y=x+size;
+        T* lower=y+size;
+        T* diag=lower+size;
+        T* upper=diag+size;
+        T* rhs=upper+size;
+        T* saved=rhs+size;
+        for(int l=0; l<lanes; l++) {
+            const basic_spline& s=*group[l];
+            for(int i=0; i<n; i++) {
+                x[i*lanes+l]=s.m_x[i];
+                y[i*lanes+l]=s.m_y[i];
+            }
+            for(int i=0; i<n-1; i++) {
+                assert(s.m_x[i]<s.m_x[i+1]);
+            }
+        }
+
+        // set_points() and basic_band_matrix::lu_solve_inplace() step by step, with the same operations in the same
+        // order, so the coefficients come out identical
+        for(int i=1; i<n-1; i++) {
+            for(int l=0; l<lanes; l++) {
+                int k=i*lanes+l;
+                lower[k]=T(1.0/3.0)*(x[k]-x[k-lanes]);
+                diag[k]=T(2.0/3.0)*(x[k+lanes]-x[k-lanes]);
+                upper[k]=T(1.0/3.0)*(x[k+lanes]-x[k]);
+                rhs[k]=(y[k+lanes]-y[k])/(x[k+lanes]-x[k]) - (y[k]-y[k-lanes])/(x[k]-x[k-lanes]);
+            }
+        }
+        for(int l=0; l<lanes; l++) {
+            const basic_spline& s=*group[l];
+            int k0=l, k1=l+lanes, km=(n-2)*lanes+l, kn=(n-1)*lanes+l;
+            if(s.m_left == second_deriv) {
+                diag[k0]=2.0;
+                upper[k0]=0.0;
+                rhs[k0]=s.m_left_value;
+            } else if(s.m_left == first_deriv) {
+                diag[k0]=T(2.0)*(x[k1]-x[k0]);
+                upper[k0]=T(1.0)*(x[k1]-x[k0]);
+                rhs[k0]=T(3.0)*((y[k1]-y[k0])/(x[k1]-x[k0])-s.m_left_value);
+            } else {
+                assert(false);
+            }
+            if(s.m_right == second_deriv) {
+                diag[kn]=2.0;
+                lower[kn]=0.0;
+                rhs[kn]=s.m_right_value;
+            } else if(s.m_right == first_deriv) {
+                diag[kn]=T(2.0)*(x[kn]-x[km]);
+                lower[kn]=T(1.0)*(x[kn]-x[km]);
+                rhs[kn]=T(3.0)*(s.m_right_value-(y[kn]-y[km])/(x[kn]-x[km]));
+            } else {
+                assert(false);
+            }
+        }
+        // preconditioning, lower[0] and upper[n-1] lie outside the matrix and stay 0
+        for(size_t k=0; k<size; k++) {
+            assert(diag[k]!=0.0);
+            saved[k]=T(1.0)/diag[k];
+            lower[k]*=saved[k];
+            upper[k]*=saved[k];
+            diag[k]=1.0;
+        }
+        // Gauss LR-decomposition
+        for(int i=1; i<n; i++) {
+            for(int l=0; l<lanes; l++) {
+                int k=i*lanes+l;
+                T f=-lower[k]/diag[k-lanes];
+                lower[k]=-f;
+                diag[k]=diag[k]+f*upper[k-lanes];
+            }
+        }
+        // solves Ly=b, then Rx=y
+        for(int l=0; l<lanes; l++) {
+            rhs[l]=(rhs[l]*saved[l]) - T(0.0);
+        }
+        for(int i=1; i<n; i++) {
+            for(int l=0; l<lanes; l++) {
+                int k=i*lanes+l;
+                T sum=0;
+                sum+=lower[k]*rhs[k-lanes];
+                rhs[k]=(rhs[k]*saved[k]) - sum;
+            }
+        }
+        for(int l=0; l<lanes; l++) {
+            int k=(n-1)*lanes+l;
+            rhs[k]=(rhs[k] - T(0.0))/diag[k];
+        }
+        for(int i=n-2; i>=0; i--) {
+            for(int l=0; l<lanes; l++) {
+                int k=i*lanes+l;
+                T sum=0;
+                sum+=upper[k]*rhs[k+lanes];
+                rhs[k]=(rhs[k] - sum)/diag[k];
+            }
+        }
+        // parameters a[] and c[], into the storage of the solved matrix
+        T* a=lower;
+        T* c=upper;
+        for(int i=0; i<n-1; i++) {
+            for(int l=0; l<lanes; l++) {
+                int k=i*lanes+l;
+                a[k]=T(1.0/3.0)*(rhs[k+lanes]-rhs[k])/(x[k+lanes]-x[k]);
+                c[k]=(y[k+lanes]-y[k])/(x[k+lanes]-x[k])
+                     - T(1.0/3.0)*(T(2.0)*rhs[k]+rhs[k+lanes])*(x[k+lanes]-x[k]);
+            }
+        }
+
+        for(size_t l=0; l<last-first; l++) {
+            basic_spline& s=*group[l];
+            s.m_a.resize(n);
+            s.m_b.resize(n);
+            s.m_c.resize(n);
+            for(int i=0; i<n; i++) {
+                s.m_a[i]=a[i*lanes+l];
+                s.m_b[i]=rhs[i*lanes+l];
+                s.m_c[i]=c[i*lanes+l];
+            }
+            s.set_extrapolation();
+        }
+        first=last;
+    }
+}
+
+template<class T>
+T basic_spline<T>::operator() (T x) const
 {
     size_t n=m_x.size();
     // find the closest point m_x[idx] < x, idx=0 even if x<m_x[0]
-    std::vector<double>::const_iterator it;
+    typename arena_vector<T>::const_iterator it;
     it=std::lower_bound(m_x.begin(),m_x.end(),x);
     int idx=std::max( int(it-m_x.begin())-1, 0);
 
-    double h=x-m_x[idx];
-    double interpol;
+    T h=x-m_x[idx];
+    T interpol;
     if(x<m_x[0]) {
         // extrapolation to the left
         if(_linear) {
@@ -464,26 +791,109 @@ double spline::operator() (double x) const
     return interpol;
 }
 
-double spline::deriv(int order, double x) const
+template<class T>
+void basic_spline<T>::scale(T sx, T sy)
+{
+    for(size_t i=0; i<m_x.size(); i++) {
+        m_x[i]*=sx;
+        m_y[i]*=sy;
+    }
+    if(_linear) {
+        // linear splines only use their points, the coefficients are not maintained
+        return;
+    }
+    // f'(x) = sy f(x/sx): every derivative gains a factor sy/sx^k
+    T s1=sy/sx, s2=s1/sx, s3=s2/sx;
+    for(size_t i=0; i<m_a.size(); i++) {
+        m_a[i]*=s3;
+        m_b[i]*=s2;
+        m_c[i]*=s1;
+    }
+    m_b0*=s2;
+    m_c0*=s1;
+    m_left_value*=(m_left==second_deriv) ? s2 : s1;
+    m_right_value*=(m_right==second_deriv) ? s2 : s1;
+}
+
+template<class T>
+void basic_spline<T>::insert_knots(const T* x, int count)
+{
+    int n=m_x.size();
+    assert(n>1);
+    assert(count==0 || (x[0]>m_x[0] && x[count-1]<m_x[n-1]));
+    bool cubic=!_linear;
+    m_x.resize(n+count);
+    m_y.resize(n+count);
+    if(cubic) {
+        m_a.resize(n+count);
+        m_b.resize(n+count);
+        m_c.resize(n+count);
+    }
+    // merge from the back, so that the old segment i is still in place when its new knots are written
+    int k=count-1, w=n+count-1;
+    for(int i=n-1; i>=0; i--) {
+        T xi=m_x[i], yi=m_y[i];
+        T ai=0, bi=0, ci=0, slope=0;
+        if(cubic) {
+            ai=m_a[i];
+            bi=m_b[i];
+            ci=m_c[i];
+        } else if(k>=0 && x[k]>xi) {
+            slope=(m_y[i+1]-m_y[i])/(m_x[i+1]-m_x[i]);
+        }
+        for(; k>=0 && x[k]>xi; k--, w--) {
+            assert(i<n-1);
+            assert(x[k]<m_x[w+1]);
+            // the same expressions as operator() evaluates
+            T h=x[k]-xi;
+            m_x[w]=x[k];
+            if(cubic) {
+                m_y[w]=((ai*h + bi)*h + ci)*h + yi;
+                m_a[w]=ai;
+                m_b[w]=T(3.0)*ai*h + bi;
+                m_c[w]=(T(3.0)*ai*h + T(2.0)*bi)*h + ci;
+            } else {
+                m_y[w]=slope*h + yi;
+            }
+        }
+        m_x[w]=xi;
+        m_y[w]=yi;
+        if(cubic) {
+            m_a[w]=ai;
+            m_b[w]=bi;
+            m_c[w]=ci;
+        }
+        w--;
+    }
+    assert(k<0 && w<0);
+}
+
+template<class T>
+T basic_spline<T>::deriv(int order, T x) const
 {
     assert(order>0);
 
     size_t n=m_x.size();
     // find the closest point m_x[idx] < x, idx=0 even if x<m_x[0]
-    std::vector<double>::const_iterator it;
+    typename arena_vector<T>::const_iterator it;
     it=std::lower_bound(m_x.begin(),m_x.end(),x);
     int idx=std::max( int(it-m_x.begin())-1, 0);
 
-    double h=x-m_x[idx];
-    double interpol;
+    T h=x-m_x[idx];
+    T interpol;
+    if(_linear) {
+        // linear splines extrapolate their first and last segment, like operator() does
+        idx=std::min<int>(idx, n-2);
+        return order==1 ? (m_y[idx+1]-m_y[idx])/(m_x[idx+1]-m_x[idx]) : T(0.0);
+    }
     if(x<m_x[0]) {
         // extrapolation to the left
         switch(order) {
         case 1:
-            interpol=2.0*m_b0*h + m_c0;
+            interpol=T(2.0)*m_b0*h + m_c0;
             break;
         case 2:
-            interpol=2.0*m_b0*h;
+            interpol=T(2.0)*m_b0*h;
             break;
         default:
             interpol=0.0;
@@ -493,10 +903,10 @@ double spline::deriv(int order, double x) const
         // extrapolation to the right
         switch(order) {
         case 1:
-            interpol=2.0*m_b[n-1]*h + m_c[n-1];
+            interpol=T(2.0)*m_b[n-1]*h + m_c[n-1];
             break;
         case 2:
-            interpol=2.0*m_b[n-1];
+            interpol=T(2.0)*m_b[n-1];
             break;
         default:
             interpol=0.0;
@@ -506,13 +916,13 @@ double spline::deriv(int order, double x) const
         // interpolation
         switch(order) {
         case 1:
-            interpol=(3.0*m_a[idx]*h + 2.0*m_b[idx])*h + m_c[idx];
+            interpol=(T(3.0)*m_a[idx]*h + T(2.0)*m_b[idx])*h + m_c[idx];
             break;
         case 2:
-            interpol=6.0*m_a[idx]*h + 2.0*m_b[idx];
+            interpol=T(6.0)*m_a[idx]*h + T(2.0)*m_b[idx];
             break;
         case 3:
-            interpol=6.0*m_a[idx];
+            interpol=T(6.0)*m_a[idx];
             break;
         default:
             interpol=0.0;
@@ -522,7 +932,136 @@ double spline::deriv(int order, double x) const
     return interpol;
 }
 
+template<class T>
+int basic_spline<T>::segment_index(T x) const
+{
+    int n=m_x.size();
+    int idx=int(std::upper_bound(m_x.begin(),m_x.end(),x)-m_x.begin())-1;
+    return std::max(0, std::min(idx, n-2));
+}
+
+template<class T>
+void basic_spline<T>::piece(int i, T& xi, T& y, T& a, T& b, T& c) const
+{
+    int n=m_x.size();
+    if(_linear) {
+        // linear splines extrapolate their first and last segment
+        int k=std::max(0, std::min(i, n-2));
+        a=0.0;
+        b=0.0;
+        c=(m_y[k+1]-m_y[k])/(m_x[k+1]-m_x[k]);
+    } else if(i<0) {
+        a=0.0;
+        b=m_b0;
+        c=m_c0;
+    } else {
+        // m_a[n-1] is 0, so the last entries are the right extrapolation
+        a=m_a[i];
+        b=m_b[i];
+        c=m_c[i];
+    }
+    int k=std::max(i, 0);
+    xi=m_x[k];
+    y=m_y[k];
+}
+
+template<class T>
+void basic_spline<T>::piece_span(T x0, T x1, int& first, int& last) const
+{
+    int n=m_x.size();
+    first = x0<m_x[0] ? -1 : x0>m_x[n-1] ? n-1 : segment_index(x0);
+    last = x1>m_x[n-1] ? n-1 : x1<m_x[0] ? -1 : segment_index(x1);
+}
+
+template<class T>
+void basic_spline<T>::piece_interval(int i, T x0, T x1, T xi, T& h0, T& h1) const
+{
+    int n=m_x.size();
+    h0=(i<0 ? x0 : std::max(x0, m_x[i]))-xi;
+    h1=(i>=n-1 ? x1 : std::min(x1, m_x[i+1]))-xi;
+}
+
+template<class T>
+void basic_spline<T>::value_range(T x0, T x1, T& lo, T& hi) const
+{
+    assert(m_x.size()>1 && x0<=x1);
+    lo=std::numeric_limits<T>::max();
+    hi=-std::numeric_limits<T>::max();
+    int first,last;
+    piece_span(x0,x1,first,last);
+    for(int i=first; i<=last; i++) {
+        T xi,y,a,b,c,h0,h1;
+        piece(i,xi,y,a,b,c);
+        piece_interval(i,x0,x1,xi,h0,h1);
+        T h[4]={h0, h1, h0, h0};
+        int count=2;
+        // roots of the derivative 3a*h^2 + 2b*h + c
+        if(a!=0.0) {
+            T d=b*b-T(3.0)*a*c;
+            if(d>=0.0) {
+                T r=std::sqrt(d);
+                h[count++]=(-b-r)/(T(3.0)*a);
+                h[count++]=(-b+r)/(T(3.0)*a);
+            }
+        } else if(b!=0.0) {
+            h[count++]=-c/(T(2.0)*b);
+        }
+        for(int k=0; k<count; k++) {
+            if(h[k]<h0 || h[k]>h1) continue;
+            T v=((a*h[k]+b)*h[k]+c)*h[k]+y;
+            lo=std::min(lo,v);
+            hi=std::max(hi,v);
+        }
+    }
+}
+
+template<class T>
+void basic_spline<T>::deriv_range(T x0, T x1, T& lo, T& hi) const
+{
+    assert(m_x.size()>1 && x0<=x1);
+    lo=std::numeric_limits<T>::max();
+    hi=-std::numeric_limits<T>::max();
+    int first,last;
+    piece_span(x0,x1,first,last);
+    for(int i=first; i<=last; i++) {
+        T xi,y,a,b,c,h0,h1;
+        piece(i,xi,y,a,b,c);
+        piece_interval(i,x0,x1,xi,h0,h1);
+        // the derivative 3a*h^2 + 2b*h + c is extreme at the ends or at its vertex
+        T h[3]={h0, h1, h0};
+        if(a!=0.0) h[2]=-b/(T(3.0)*a);
+        for(int k=0; k<3; k++) {
+            if(h[k]<h0 || h[k]>h1) continue;
+            T v=(T(3.0)*a*h[k]+T(2.0)*b)*h[k]+c;
+            lo=std::min(lo,v);
+            hi=std::max(hi,v);
+        }
+    }
+}
+
+template<class T>
+void basic_spline<T>::second_deriv_range(T x0, T x1, T& lo, T& hi) const
+{
+    assert(m_x.size()>1 && x0<=x1);
+    lo=std::numeric_limits<T>::max();
+    hi=-std::numeric_limits<T>::max();
+    int first,last;
+    piece_span(x0,x1,first,last);
+    for(int i=first; i<=last; i++) {
+        T xi,y,a,b,c,h0,h1;
+        piece(i,xi,y,a,b,c);
+        piece_interval(i,x0,x1,xi,h0,h1);
+        // the second derivative 6a*h + 2b is linear, so extreme at the ends
+        T v0=T(6.0)*a*h0+T(2.0)*b;
+        T v1=T(6.0)*a*h1+T(2.0)*b;
+        lo=std::min(lo,std::min(v0,v1));
+        hi=std::max(hi,std::max(v0,v1));
+    }
+}
 
+typedef basic_band_matrix<double> band_matrix;
+typedef basic_spline<double> spline;
+typedef basic_spline<float> splinef;
 
 } // namespace tk
 
@@ -0,0 +1,141 @@
+#include "../CompressedSurfaceMap.h"
+
+#include <cmath>
+#include <cstring>
+
+#include "Test.h"
+
+static CompressedSurfaceMap encodeEditedGrid(std::vector<double>& points)
+{
+    ParametricSurfaceGrid grid(vec2d(-4, 7), 150, 90, 15, 15);
+    grid.moveControlPoint(2, 3, vec2d(6, -3));
+    grid.moveControlPoint(5, 1, vec2d(-2, 4));
+    const SurfacePoints& map = grid.generateSurfacePoints();
+    points.assign(map.begin(), map.end());
+    CompressedSurfaceMapOptions options;
+    options.tileSize = 32;
+    options.numThreads = 2;
+    return CompressedSurfaceMap::encode(grid, options);
+}
+
+TEST(compressedMapRoundTrips)
+{
+    std::vector<double> points;
+    CompressedSurfaceMap map = encodeEditedGrid(points);
+    std::vector<uint8_t> bytes = map.serialize();
+    CompressedSurfaceMap copy;
+    CHECK(CompressedSurfaceMap::deserialize(bytes.data(), bytes.size(), copy));
+    CHECK(copy.width() == 150 && copy.height() == 90 && copy.tilesX() == 5 && copy.tilesY() == 3);
+    std::vector<double> decoded;
+    CHECK(copy.decode(decoded, 2));
+    CHECK(decoded.size() == points.size());
+    double maxError = 0;
+    for (size_t i = 0; i < points.size(); ++i) {
+        maxError = std::max(maxError, std::abs(decoded[i] - points[i]));
+    }
+    CHECK(maxError <= map.quantizationStep() / 2 + 1e-9);
+}
+
+TEST(compressedMapRejectsBadStep)
+{
+    std::vector<double> points(8 * 8 * 2, 0.0);
+    CompressedSurfaceMapOptions options;
+    for (double step : {0.0, -1.0, std::nan("")}) {
+        options.quantizationStep = step;
+        CompressedSurfaceMap map = CompressedSurfaceMap::encode(points.data(), 8, 8, vec2d(0, 0), options);
+        CHECK(map.width() == 0 && map.height() == 0 && map.compressedSize() == 0);
+    }
+}
+
+TEST(compressedMapRejectsCorruptBuffers)
+{
+    std::vector<double> points;
+    std::vector<uint8_t> bytes = encodeEditedGrid(points).serialize();
+    CompressedSurfaceMap map;
+
+    // every truncation breaks the size the index ends with
+    for (size_t size = 0; size < bytes.size(); ++size) {
+        CHECK(!CompressedSurfaceMap::deserialize(bytes.data(), size, map));
+    }
+    CHECK(map.width() == 0);
+
+    // the index sits after the 40 byte header, one offset per tile plus the end
+    const size_t indexOffset = 40;
+    const size_t numTiles = 15;
+    CHECK(bytes.size() == indexOffset + (numTiles + 1) * sizeof(uint64_t) + encodeEditedGrid(points).compressedSize());
+    uint64_t offsets[numTiles + 1];
+    memcpy(offsets, bytes.data() + indexOffset, sizeof(offsets));
+    std::vector<uint8_t> swapped = bytes;
+    std::swap(offsets[3], offsets[4]);
+    memcpy(swapped.data() + indexOffset, offsets, sizeof(offsets));
+    CHECK(offsets[3] != offsets[4]);
+    CHECK(!CompressedSurfaceMap::deserialize(swapped.data(), swapped.size(), map));
+
+    std::vector<uint8_t> huge = bytes;
+    uint64_t past = bytes.size() * 2;
+    memcpy(huge.data() + indexOffset + 7 * sizeof(uint64_t), &past, sizeof(past));
+    CHECK(!CompressedSurfaceMap::deserialize(huge.data(), huge.size(), map));
+
+    // a header claiming more tiles than the buffer has room for
+    std::vector<uint8_t> wide = bytes;
+    int32_t width = 1 << 30;
+    memcpy(wide.data() + 4, &width, sizeof(width));
+    CHECK(!CompressedSurfaceMap::deserialize(wide.data(), wide.size(), map));
+    width = INT32_MAX;
+    memcpy(wide.data() + 4, &width, sizeof(width));
+    CHECK(!CompressedSurfaceMap::deserialize(wide.data(), wide.size(), map));
+
+    // a varint running to the end of its tile
+    std::vector<uint8_t> unterminated = bytes;
+    size_t dataOffset = indexOffset + sizeof(offsets);
+    for (uint64_t i = offsets[0]; i < offsets[1]; ++i) {
+        unterminated[dataOffset + i] = 0xff;
+    }
+    CHECK(CompressedSurfaceMap::deserialize(unterminated.data(), unterminated.size(), map));
+    std::vector<double> tile(32 * 32 * 2);
+    CHECK(!map.decodeTile(0, 0, tile.data(), 32 * 2));
+    CHECK(map.decodeTile(1, 0, tile.data(), 32 * 2));
+    std::vector<double> decoded;
+    CHECK(!map.decode(decoded));
+
+    // flipped bits in the tile data may decode to garbage but must stay within the buffer
+    for (size_t i = dataOffset; i < bytes.size(); i += 7) {
+        std::vector<uint8_t> flipped = bytes;
+        flipped[i] ^= 0x80;
+        CHECK(CompressedSurfaceMap::deserialize(flipped.data(), flipped.size(), map));
+        map.decode(decoded, 1);
+    }
+}
+
+// Prediction errors of the largest magnitude a token holds, whose sums leave the range of int64_t, decode without
+// overflow (checked under -fsanitize=undefined).
+TEST(compressedMapDecodesExtremeErrors)
+{
+    std::vector<double> points(3 * 2 * 2, 0.0);
+    CompressedSurfaceMapOptions options;
+    options.tileSize = 3;
+    std::vector<uint8_t> bytes = CompressedSurfaceMap::encode(points.data(), 3, 2, vec2d(0, 0), options).serialize();
+    // six errors of 2^62 - 1 in the first channel, zigzag coded with a clear token bit, and a run of six zeros in the
+    // second
+    std::vector<uint8_t> data;
+    for (int i = 0; i < 6; ++i) {
+        for (uint64_t token = ~(uint64_t)3; token != 0; token >>= 7) {
+            data.push_back((uint8_t)(token | (token >= 0x80 ? 0x80 : 0)));
+        }
+    }
+    data.push_back(6 << 1 | 1);
+    const size_t indexOffset = 40;
+    uint64_t offsets[2] = {0, data.size()};
+    bytes.resize(indexOffset);
+    bytes.insert(bytes.end(), (const uint8_t*)offsets, (const uint8_t*)(offsets + 2));
+    bytes.insert(bytes.end(), data.begin(), data.end());
+
+    CompressedSurfaceMap map;
+    CHECK(CompressedSurfaceMap::deserialize(bytes.data(), bytes.size(), map));
+    std::vector<double> decoded;
+    CHECK(map.decode(decoded, 1));
+    CHECK(decoded.size() == points.size() && std::all_of(decoded.begin(), decoded.end(), [](double value) {
+              return std::isfinite(value);
+          }));
+}
+
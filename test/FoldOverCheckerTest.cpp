@@ -0,0 +1,118 @@
+#include "../FoldOverChecker.h"
+
+#include <random>
+#include <set>
+
+#include "Test.h"
+
+// Patches holding a pixel whose finite difference Jacobian of the generated map is not positive.
+static std::set<std::pair<int, int>> foldedPatches(ParametricSurfaceGrid& grid)
+{
+    ParametricSurfaceGrid copy = grid;
+    const SurfacePoints& map = copy.generateSurfacePoints();
+    int width = grid.pixelWidth(), height = grid.pixelHeight();
+    std::set<std::pair<int, int>> patches;
+    for (int y = 0; y + 1 < height; ++y) {
+        for (int x = 0; x + 1 < width; ++x) {
+            const double* p = &map[2 * ((size_t)y * width + x)];
+            const double* px = p + 2;
+            const double* py = p + 2 * width;
+            double jacobian = (px[0] - p[0]) * (py[1] - p[1]) - (py[0] - p[0]) * (px[1] - p[1]);
+            if (jacobian <= 0) {
+                patches.insert({(int)(y / grid.gridResolutionY()), (int)(x / grid.gridResolutionX())});
+            }
+        }
+    }
+    return patches;
+}
+
+// The ranges hold every sampled value and slope, inside the knots and on both extrapolated ends.
+TEST(splineRangesCoverExtrapolation)
+{
+    for (bool linear : {false, true}) {
+        ParametricSurfaceGrid grid(vec2d(0, 0), 200, 150, 25, 25);
+        // pull the end knots of row 2 inward, so [0, 200] reaches past them on both sides
+        grid.moveControlPoint(2, 0, vec2d(20, 6));
+        grid.moveControlPoint(2, grid.numControlPointsX() - 1, vec2d(-20, -9));
+        grid.moveControlPoint(2, 3, vec2d(4, 5));
+        auto& spline = grid.rowSpline(2);
+        spline.setLinear(linear);
+        for (double x0 : {-30.0, 0.0, 10.0, 60.0, 185.0, 230.0}) {
+            for (double x1 : {x0, x0 + 15.0, 200.0, 260.0}) {
+                if (x1 < x0) {
+                    continue;
+                }
+                double lo, hi, slopeLo, slopeHi;
+                spline.value_range(x0, x1, lo, hi);
+                spline.deriv_range(x0, x1, slopeLo, slopeHi);
+                double sampledLo = 1e300, sampledHi = -1e300, sampledSlopeLo = 1e300, sampledSlopeHi = -1e300;
+                // the extremes of linear splines are on the knots, so those are sampled as well
+                std::vector<double> xs;
+                for (int i = 0; i <= 2000; ++i) {
+                    xs.push_back(x0 + (x1 - x0) * i / 2000);
+                }
+                for (int col = 0; col < grid.numControlPointsX(); ++col) {
+                    double knot = grid.controlPointPosition(2, col).x;
+                    if (knot >= x0 && knot <= x1) {
+                        xs.push_back(knot);
+                    }
+                }
+                for (double x : xs) {
+                    double value = spline(x), slope = spline.deriv(1, x);
+                    sampledLo = std::min(sampledLo, value);
+                    sampledHi = std::max(sampledHi, value);
+                    sampledSlopeLo = std::min(sampledSlopeLo, slope);
+                    sampledSlopeHi = std::max(sampledSlopeHi, slope);
+                }
+                CHECK(lo <= sampledLo + 1e-9 && sampledHi <= hi + 1e-9);
+                CHECK(slopeLo <= sampledSlopeLo + 1e-9 && sampledSlopeHi <= slopeHi + 1e-9);
+                // exact, not merely a bound; the slope of a linear spline jumps at the knots, where the range holds
+                // both sides while deriv() gives the left one
+                CHECK_NEAR(lo, sampledLo, 1e-3);
+                CHECK_NEAR(hi, sampledHi, 1e-3);
+                if (!linear) {
+                    CHECK_NEAR(slopeLo, sampledSlopeLo, 1e-3);
+                    CHECK_NEAR(slopeHi, sampledSlopeHi, 1e-3);
+                }
+            }
+        }
+    }
+}
+
+// Over random drags, every patch where the generated map folds over is reported, and so is every patch the checker
+// proves folded.
+TEST(foldOverCheckerMatchesFiniteDifferences)
+{
+    for (bool linear : {false, true}) {
+        ParametricSurfaceGrid grid(vec2d(0, 0), 1030, 770, 40, 40);
+        if (linear) {
+            for (int row = 0; row < grid.numControlPointsY(); ++row) {
+                grid.rowSpline(row).setLinear(true);
+            }
+            for (int col = 0; col < grid.numControlPointsX(); ++col) {
+                grid.colSpline(col).setLinear(true);
+            }
+            grid.setPixelOrigin(vec2d(0, 0));
+        }
+        FoldOverChecker checker(grid);
+        CHECK(checker.isValid(1));
+        std::mt19937 random(5);
+        for (int drag = 0; drag < 12; ++drag) {
+            int row = 1 + random() % (grid.numControlPointsY() - 2);
+            int col = 1 + random() % (grid.numControlPointsX() - 2);
+            std::uniform_real_distribution<double> offset(drag < 6 ? -15 : -60, drag < 6 ? 15 : 60);
+            grid.moveControlPoint(row, col, vec2d(offset(random), offset(random)));
+            const std::vector<FoldOver>& foldOvers = checker.check(drag % 2 ? 1 : 3);
+            std::set<std::pair<int, int>> folded = foldedPatches(grid);
+            std::set<std::pair<int, int>> flagged;
+            for (const FoldOver& foldOver : foldOvers) {
+                flagged.insert({foldOver.row, foldOver.col});
+                CHECK(foldOver.minJacobian > 0 || folded.count({foldOver.row, foldOver.col}));
+            }
+            for (const std::pair<int, int>& patch : folded) {
+                CHECK(flagged.count(patch));
+            }
+        }
+        CHECK(!checker.isValid(1));
+    }
+}
@@ -0,0 +1,112 @@
+#include "../GridSnapshot.h"
+
+#include "Test.h"
+
+static std::vector<double> stateKey(ParametricSurfaceGrid& grid)
+{
+    std::vector<double> key;
+    grid.stateKey(key);
+    return key;
+}
+
+static bool sameMap(const SurfacePoints& a, const SurfacePoints& b)
+{
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+}
+
+// Undo and redo walk back and forth through the committed states, maps included, and committing after an undo drops
+// the states ahead.
+TEST(historyRestoresEveryStep)
+{
+    ParametricSurfaceGrid grid(vec2d(0, 0), 640, 480, 32, 32);
+    grid.generateSurfacePoints();
+    GridHistory history(grid, true, 64);
+    CHECK(!history.canUndo() && !history.canRedo());
+    history.commit();
+    std::vector<std::vector<double>> keys = {stateKey(grid)};
+    std::vector<SurfacePoints> maps = {grid.generateSurfacePoints()};
+    for (int step = 1; step <= 8; ++step) {
+        grid.moveControlPoint(1 + step % 13, 1 + (step * 5) % 18, vec2d(3, -2));
+        if (step == 4) {
+            grid.setPixelSize(600, 500);
+        }
+        maps.push_back(grid.generateSurfacePoints());
+        keys.push_back(stateKey(grid));
+        history.commit();
+    }
+    CHECK(history.numSteps() == 9 && history.currentStep() == 8);
+
+    auto matches = [&](int step) {
+        if (stateKey(grid) != keys[step] || !sameMap(grid.getState().surfacePoints, maps[step])) {
+            return false;
+        }
+        // the restored splines generate the restored map
+        ParametricSurfaceGrid copy = grid;
+        return sameMap(copy.generateSurfacePoints(), maps[step]);
+    };
+    while (history.canUndo()) {
+        CHECK(history.undo());
+        CHECK(matches(history.currentStep()));
+    }
+    CHECK(!history.undo() && history.currentStep() == 0);
+    for (int step = 1; step <= 5; ++step) {
+        CHECK(history.redo());
+        CHECK(matches(step));
+    }
+
+    grid.moveControlPoint(5, 5, vec2d(1, 1));
+    SurfacePoints branch = grid.generateSurfacePoints();
+    history.commit();
+    CHECK(history.numSteps() == 7 && !history.canRedo());
+    CHECK(history.undo() && matches(5));
+    CHECK(history.redo() && sameMap(grid.getState().surfacePoints, branch));
+    history.clear();
+    CHECK(history.numSteps() == 0 && history.memoryBytes() == 0);
+}
+
+// A capture on top of a base shares what did not change, and a restored snapshot serves as base for the next capture.
+TEST(snapshotsShareUnchangedState)
+{
+    ParametricSurfaceGrid grid(vec2d(0, 0), 640, 480, 32, 32);
+    SurfacePoints firstMap = grid.generateSurfacePoints();
+    GridSnapshot first = GridSnapshot::capture(grid, nullptr, true, 64);
+    size_t firstBytes = GridSnapshot::memoryBytes({first});
+    CHECK(first.hasMap() && first.pixelWidth() == 640 && first.pixelHeight() == 480);
+    CHECK(firstBytes > 640 * 480 * 2 * sizeof(double));
+    CHECK(GridSnapshot::memoryBytes({first, first}) == firstBytes);
+    CHECK(GridSnapshot::memoryBytes({first, GridSnapshot::capture(grid, nullptr, true, 64)}) == 2 * firstBytes);
+
+    grid.moveControlPoint(7, 9, vec2d(2, 3));
+    SurfacePoints secondMap = grid.generateSurfacePoints();
+    GridSnapshot second = GridSnapshot::capture(grid, &first, true, 64);
+    size_t secondBytes = GridSnapshot::memoryBytes({first, second}) - firstBytes;
+    CHECK(secondBytes > 0 && secondBytes < firstBytes / 2);
+    CHECK(GridSnapshot::memoryBytes({second}) >= firstBytes);
+
+    // without the map only the splines of the moved point are new
+    GridSnapshot noMap = GridSnapshot::capture(grid);
+    grid.moveControlPoint(3, 4, vec2d(-1, 2));
+    GridSnapshot nextNoMap = GridSnapshot::capture(grid, &noMap);
+    CHECK(!noMap.hasMap());
+    CHECK(GridSnapshot::memoryBytes({noMap, nextNoMap}) - GridSnapshot::memoryBytes({noMap}) <
+          GridSnapshot::memoryBytes({noMap}) / 4);
+
+    GridSnapshot rebased = first.restore(grid);
+    CHECK(sameMap(grid.getState().surfacePoints, firstMap));
+    grid.moveControlPoint(2, 2, vec2d(1, -1));
+    SurfacePoints thirdMap = grid.generateSurfacePoints();
+    std::vector<double> thirdKey = stateKey(grid);
+    GridSnapshot third = GridSnapshot::capture(grid, &rebased, true, 64);
+    size_t thirdBytes = GridSnapshot::memoryBytes({first, third}) - firstBytes;
+    CHECK(thirdBytes > 0 && thirdBytes < firstBytes / 2);
+
+    // restoring into another grid works as well, and a base taken from another grid shares nothing
+    ParametricSurfaceGrid other(vec2d(5, 5), 100, 100, 20, 20);
+    second.restore(other);
+    CHECK(sameMap(other.getState().surfacePoints, secondMap));
+    third.restore(other);
+    CHECK(stateKey(other) == thirdKey && sameMap(other.getState().surfacePoints, thirdMap));
+    GridSnapshot fromOther = GridSnapshot::capture(other, &third, true, 64);
+    CHECK(GridSnapshot::memoryBytes({third, fromOther}) ==
+          GridSnapshot::memoryBytes({third}) + GridSnapshot::memoryBytes({fromOther}));
+}
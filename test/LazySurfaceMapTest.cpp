@@ -0,0 +1,87 @@
+#include "../LazySurfaceMap.h"
+
+#include <cstring>
+#include <thread>
+
+#include "Test.h"
+
+// Number of rows of the lazy map that differ from a full generation of the grid, read with copyRow().
+static int mismatchedRows(LazySurfaceMap& map, ParametricSurfaceGrid& grid)
+{
+    ParametricSurfaceGrid copy = grid;
+    const SurfacePoints& expected = copy.generateSurfacePoints();
+    std::vector<double> row(2 * map.width());
+    int mismatches = 0;
+    for (int y = 0; y < map.height(); ++y) {
+        map.copyRow(0, y, map.width(), row.data());
+        mismatches += memcmp(row.data(), &expected[2 * (size_t)y * map.width()], row.size() * sizeof(double)) != 0;
+    }
+    return mismatches;
+}
+
+// Tiles are generated on first access only, and update() regenerates just the tiles a control point move reaches.
+TEST(lazyMapGeneratesOnDemand)
+{
+    ParametricSurfaceGrid grid(vec2d(3, 5), 300, 200, 20, 20);
+    LazySurfaceMap map(grid, 32);
+    CHECK(map.tilesX() == 10 && map.tilesY() == 7);
+    CHECK(map.numTilesGenerated() == 0);
+    vec2d point = map.at(150, 100);
+    CHECK(map.numTilesGenerated() == 1 && map.isTileReady(4, 3) && !map.isTileReady(0, 0));
+    vec2d expected = grid.surfacePoint(150.0 / 300, 100.0 / 200) + vec2d(3, 5);
+    CHECK_NEAR(point.x, expected.x, 1e-9);
+    CHECK_NEAR(point.y, expected.y, 1e-9);
+    CHECK(mismatchedRows(map, grid) == 0);
+    CHECK(map.numTilesGenerated() == 70);
+
+    grid.moveControlPoint(3, 4, vec2d(2, -1));
+    map.update();
+    CHECK(!map.isTileReady(3, 3));
+    CHECK(map.isTileReady(0, 0) && map.isTileReady(9, 6));
+    CHECK(mismatchedRows(map, grid) == 0);
+    uint64_t regenerated = map.numTilesGenerated() - 70;
+    CHECK(regenerated > 0 && regenerated < 70);
+
+    grid.setPixelOrigin(vec2d(1, 1));
+    map.update();
+    CHECK(!map.isTileReady(0, 0) && !map.isTileReady(9, 6));
+    CHECK(mismatchedRows(map, grid) == 0);
+    grid.setPixelSize(250, 180);
+    map.update();
+    CHECK(map.width() == 250 && map.height() == 180);
+    CHECK(mismatchedRows(map, grid) == 0);
+    grid.setGridResolution(10, 15);
+    map.update();
+    CHECK(mismatchedRows(map, grid) == 0);
+}
+
+// Readers racing for the same tiles all see complete data, and each tile is generated once.
+TEST(lazyMapServesConcurrentReaders)
+{
+    ParametricSurfaceGrid grid(vec2d(0, 0), 400, 300, 20, 20);
+    grid.moveControlPoint(5, 6, vec2d(-3, 4));
+    ParametricSurfaceGrid copy = grid;
+    const SurfacePoints& expected = copy.generateSurfacePoints();
+    LazySurfaceMap map(grid, 48);
+    const int numThreads = 6;
+    std::atomic<int> mismatches(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; ++t) {
+        threads.emplace_back([&, t]() {
+            std::vector<double> row(2 * map.width());
+            // every thread reads the whole map, starting at a different row
+            for (int i = 0; i < map.height(); ++i) {
+                int y = (i + t * 37) % map.height();
+                map.copyRow(0, y, map.width(), row.data());
+                if (memcmp(row.data(), &expected[2 * (size_t)y * map.width()], row.size() * sizeof(double)) != 0) {
+                    mismatches++;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    CHECK(mismatches == 0);
+    CHECK(map.numTilesGenerated() == (uint64_t)map.tilesX() * map.tilesY());
+}
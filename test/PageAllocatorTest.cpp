@@ -0,0 +1,84 @@
+#include "../PageAllocator.h"
+
+#include <cstring>
+
+#include "../ParametricSurfaceGrid.h"
+#include "Test.h"
+
+static bool isHugePageAligned(const void* p)
+{
+    return reinterpret_cast<uintptr_t>(p) % (2 * 1024 * 1024) == 0;
+}
+
+// Small buffers and the default policy go through the global allocator, large ones under a huge page policy are
+// mapped on huge page boundaries instead.
+TEST(pageAllocatorFollowsPolicy)
+{
+    PagePolicy policy;
+    CHECK(policy == PagePolicy() && PageAllocator<double>() == PageAllocator<float>());
+    size_t before = allocationCount();
+    void* p = allocatePages(8 * 1024 * 1024, policy);
+    CHECK(allocationCount() == before + 1);
+    freePages(p, 8 * 1024 * 1024, policy);
+
+    for (PagePolicy::HugePages hugePages : {PagePolicy::TransparentHugePages, PagePolicy::ExplicitHugePages}) {
+        policy.hugePages = hugePages;
+        policy.minHugePageBytes = 1024 * 1024;
+        before = allocationCount();
+        p = allocatePages(512 * 1024, policy);
+        CHECK(allocationCount() == before + 1);
+        freePages(p, 512 * 1024, policy);
+
+        // not a multiple of the huge page size, the mapping is rounded up
+        size_t bytes = 3 * 1024 * 1024 + 12345;
+        before = allocationCount();
+        p = allocatePages(bytes, policy);
+        CHECK(allocationCount() == before);
+        CHECK(isHugePageAligned(p));
+        memset(p, 0x5a, bytes);
+        CHECK(static_cast<unsigned char*>(p)[bytes - 1] == 0x5a);
+        freePages(p, bytes, policy);
+    }
+    CHECK(PageAllocator<double>(policy) != PageAllocator<double>());
+}
+
+// Placed maps follow the policy of the grid and hold the same samples as the map of its state, which stays a plain
+// vector under any policy.
+TEST(mapPagePolicyKeepsSamples)
+{
+    ParametricSurfaceGrid grid(vec2d(0, 0), 640, 480, 32, 32);
+    grid.moveControlPoint(4, 5, vec2d(3, -2));
+    const std::vector<double>& map = grid.generateSurfacePoints();
+    std::vector<double> expected(map.begin(), map.end());
+
+    PagePolicy policy;
+    policy.hugePages = PagePolicy::TransparentHugePages;
+    policy.minHugePageBytes = 1024 * 1024;
+    for (bool firstTouch : {false, true}) {
+        policy.firstTouch = firstTouch;
+        for (int numThreads : {1, 4}) {
+            grid.setNumThreads(numThreads);
+            grid.setMapPagePolicy(policy);
+            CHECK(grid.mapPagePolicy() == policy);
+            const PageVector<double>& placed = grid.generatePlacedSurfacePoints();
+            CHECK(placed.get_allocator() == PageAllocator<double>(policy));
+            CHECK(isHugePageAligned(placed.data()));
+            CHECK(std::equal(expected.begin(), expected.end(), placed.begin(), placed.end()));
+            CHECK(&grid.generateSurfacePoints() == &map && map == expected);
+        }
+    }
+
+    // growing a first touch map reallocates it, and every new sample is still generated
+    grid.setPixelSize(800, 600);
+    const PageVector<double>& grown = grid.generatePlacedSurfacePoints();
+    ParametricSurfaceGrid reference = grid;
+    reference.setMapPagePolicy(PagePolicy());
+    CHECK(grown.size() == (size_t)800 * 600 * 2);
+    CHECK(std::equal(grown.begin(), grown.end(), reference.generateSurfacePoints().begin()));
+
+    // the policy and the placed map move with the grid
+    ParametricSurfaceGrid copy = grid;
+    CHECK(copy.mapPagePolicy() == policy && isHugePageAligned(copy.generatePlacedSurfacePoints().data()));
+    copy = reference;
+    CHECK(copy.mapPagePolicy() == PagePolicy());
+}
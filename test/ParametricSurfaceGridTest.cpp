@@ -0,0 +1,395 @@
+#include "../ParametricSurfaceGrid.h"
+
+#include <random>
+
+#include "Test.h"
+
+template <class T>
+static void editGrid(ParametricSurfaceGridT<T>& grid)
+{
+    std::mt19937 random(7);
+    std::uniform_real_distribution<T> offset(-4, 4);
+    for (int row = 1; row < grid.numControlPointsY() - 1; ++row) {
+        for (int col = 1; col < grid.numControlPointsX() - 1; ++col) {
+            grid.moveControlPoint(row, col, vec2<T>(offset(random), offset(random)));
+        }
+    }
+}
+
+// Pixels of the generated map that differ from surfacePoint() at the same pixel, in any bit.
+template <class T>
+static int mapMismatches(ParametricSurfaceGridT<T>& grid)
+{
+    const SurfacePointsT<T>& map = grid.generateSurfacePoints();
+    int width = grid.pixelWidth(), height = grid.pixelHeight();
+    vec2<T> origin = grid.pixelOrigin();
+    int mismatches = 0;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            vec2<T> point = grid.surfacePoint(x / (T)width, y / (T)height);
+            size_t index = ((size_t)y * width + x) * 2;
+            mismatches += map[index] != point.x + origin.x || map[index + 1] != point.y + origin.y;
+        }
+    }
+    return mismatches;
+}
+
+// Binning by patch only changes the order of evaluation, never the result.
+TEST(batchSurfacePointsMatchSurfacePoint)
+{
+    ParametricSurfaceGrid grid(vec2d(3, -2), 170, 130, 20, 20);
+    editGrid(grid);
+    std::mt19937 random(11);
+    std::uniform_real_distribution<double> unit(0, 1);
+    std::vector<vec2d> uv;
+    for (int i = 0; i < 5000; ++i) {
+        uv.push_back(vec2d(unit(random), unit(random)));
+    }
+    // corners and points on the knots
+    for (int i = 0; i <= 10; ++i) {
+        uv.push_back(vec2d(i / 10.0, 0));
+        uv.push_back(vec2d(1, i / 10.0));
+        uv.push_back(vec2d(i / 10.0, i / 10.0));
+    }
+    for (int numThreads : {1, 4}) {
+        std::vector<vec2d> out;
+        grid.surfacePoints(uv, out, numThreads);
+        CHECK(out.size() == uv.size());
+        int mismatches = 0;
+        for (size_t i = 0; i < uv.size(); ++i) {
+            vec2d expected = grid.surfacePoint(uv[i]);
+            mismatches += out[i].x != expected.x || out[i].y != expected.y;
+        }
+        CHECK(mismatches == 0);
+    }
+}
+
+// Largest distance between the rasterized mesh and the map of the grid.
+static double meshDistance(ParametricSurfaceGrid& grid, const SurfaceMesh& mesh)
+{
+    const SurfacePoints& exact = grid.generateSurfacePoints();
+    std::vector<double> rasterized(exact.size());
+    rasterizeSurfaceMesh(mesh, rasterized.data(), (size_t)mesh.width * 2, 2);
+    double distance = 0;
+    for (size_t i = 0; i < exact.size(); i += 2) {
+        distance = std::max(distance, std::hypot(exact[i] - rasterized[i], exact[i + 1] - rasterized[i + 1]));
+    }
+    return distance;
+}
+
+// The bound holds for the rasterized mesh without being far off, a coarser level would miss it, and it follows edits.
+TEST(tessellationBoundsItsError)
+{
+    for (bool linear : {false, true}) {
+        ParametricSurfaceGrid grid(vec2d(4, -3), 321, 257, 32, 32);
+        if (linear) {
+            for (int row = 0; row < grid.numControlPointsY(); ++row) {
+                grid.rowSpline(row).setLinear(true);
+            }
+            for (int col = 0; col < grid.numControlPointsX(); ++col) {
+                grid.colSpline(col).setLinear(true);
+            }
+        }
+        editGrid(grid);
+
+        SurfaceMesh mesh;
+        double error = -1;
+        int subdivisions = grid.tessellateWithinError(0.05, mesh, 64, &error);
+        CHECK(error > 0 && error <= 0.05);
+        CHECK(subdivisions > 1 && subdivisions < 64);
+        double distance = meshDistance(grid, mesh);
+        CHECK(distance <= error && distance > error / 10);
+        double coarserError;
+        CHECK(grid.tessellateWithinError(0, mesh, subdivisions - 1, &coarserError) == subdivisions - 1);
+        CHECK(coarserError > 0.05 && meshDistance(grid, mesh) <= coarserError);
+
+        double missedError;
+        CHECK(grid.tessellateWithinError(1e-9, mesh, 6, &missedError) == 6);
+        CHECK(missedError > 1e-9);
+
+        // a steeper drag needs finer cells
+        grid.moveControlPoint(4, 4, vec2d(20, -16));
+        double editedError;
+        grid.tessellateWithinError(0, mesh, subdivisions, &editedError);
+        CHECK(editedError > error && meshDistance(grid, mesh) <= editedError);
+    }
+}
+
+// Only grids beyond the patch kernels get a rasterized map, within the error asked for; a bound the cells cannot meet
+// and finer grids give the exact map.
+TEST(tessellatedMapsOnlyForCoarseGrids)
+{
+    for (int resolution : {32, 80}) {
+        ParametricSurfaceGrid grid(vec2d(4, -3), 401, 337, resolution, resolution);
+        editGrid(grid);
+        const SurfacePoints& exactMap = grid.generateSurfacePoints();
+        std::vector<double> exact(exactMap.begin(), exactMap.end());
+        double distance = 0;
+        const SurfacePoints& map = grid.generateSurfacePointsTessellated(0.5, 2);
+        for (size_t i = 0; i < exact.size(); i += 2) {
+            distance = std::max(distance, std::hypot(map[i] - exact[i], map[i + 1] - exact[i + 1]));
+        }
+        CHECK(resolution > 64 ? distance > 0 && distance <= 0.5 : distance == 0);
+        CHECK(std::equal(exact.begin(), exact.end(), grid.generateSurfacePointsTessellated(1e-9, 2).begin()));
+    }
+}
+
+static bool splinesHoldPoints(ParametricSurfaceGrid& grid, const std::vector<vec2d>& points)
+{
+    bool same = true;
+    for (int row = 0; row < grid.numControlPointsY(); ++row) {
+        for (int col = 0; col < grid.numControlPointsX(); ++col) {
+            const vec2d& point = points[row * grid.numControlPointsX() + col];
+            double x, y;
+            grid.rowSpline(row).get_point(col, x, y);
+            same = same && x == point.x && y == point.y;
+            grid.colSpline(col).get_point(row, y, x);
+            same = same && x == point.x && y == point.y;
+        }
+    }
+    return same;
+}
+
+// Every point is held against its new neighbours, so moving the whole grid keeps it intact.
+TEST(setControlPointPositionsMovesWholeGrid)
+{
+    ParametricSurfaceGrid grid(vec2d(0, 0), 100, 100, 10, 10);
+    std::vector<vec2d> points;
+    grid.controlPointPositions(points);
+    for (vec2d& point : points) {
+        point.x += 25;
+    }
+    grid.setControlPointPositions(points);
+    CHECK(splinesHoldPoints(grid, points));
+    double x, y;
+    grid.rowSpline(4).get_point(0, x, y);
+    CHECK(x == 25);
+    grid.rowSpline(4).get_point(1, x, y);
+    CHECK(x == 35);
+
+    // the surface is the one per point edits give
+    ParametricSurfaceGrid edited(vec2d(0, 0), 100, 100, 10, 10);
+    for (int row = 0; row < edited.numControlPointsY(); ++row) {
+        for (int col = edited.numControlPointsX() - 1; col >= 0; --col) {
+            edited.moveControlPoint(row, col, vec2d(25, 0));
+        }
+    }
+    CHECK(splinesHoldPoints(edited, points));
+    vec2d p = grid.surfacePoint(0.37, 0.61), q = edited.surfacePoint(0.37, 0.61);
+    CHECK_NEAR(p.x, q.x, 1e-9);
+    CHECK_NEAR(p.y, q.y, 1e-9);
+
+    // points too close are pushed apart along both axes, the same in the row and the column splines
+    for (vec2d& point : points) {
+        point = vec2d(50, 50);
+    }
+    grid.setControlPointPositions(points);
+    std::vector<vec2d> clamped;
+    grid.controlPointPositions(clamped);
+    CHECK(splinesHoldPoints(grid, clamped));
+    CHECK(clamped[0].x == 50 && clamped[0].y == 50);
+    CHECK(clamped[1].x == 50 + ParametricSurfaceGrid::Spline::min_point_spacing && clamped[1].y == 50);
+    CHECK(clamped[grid.numControlPointsX()].x == 50 &&
+          clamped[grid.numControlPointsX()].y == 50 + ParametricSurfaceGrid::Spline::min_point_spacing);
+}
+
+// Once its refit scratch has grown, moving the whole grid does not allocate, as an animation does every frame.
+TEST(setControlPointPositionsDoesNotAllocate)
+{
+    ParametricSurfaceGrid grid(vec2d(0, 0), 640, 480, 32, 32);
+    grid.rowSpline(3).setLinear(true);
+    std::vector<vec2d> points;
+    grid.controlPointPositions(points);
+    for (int frame = 0; frame < 3; ++frame) {
+        for (vec2d& point : points) {
+            point += vec2d(0.5, -0.25);
+        }
+        size_t before = allocationCount();
+        grid.setControlPointPositions(points);
+        CHECK(frame == 0 || allocationCount() == before);
+        CHECK(splinesHoldPoints(grid, points));
+    }
+}
+
+// Clamped single point edits leave the row and the column spline of the point agreeing on where it is.
+TEST(clampedPointEditsKeepSplinesInAgreement)
+{
+    ParametricSurfaceGrid grid(vec2d(0, 0), 100, 100, 10, 10);
+    grid.moveControlPoint(4, 4, vec2d(8, 9));
+    grid.moveControlPoint(4, 5, vec2d(-4, -3));
+    grid.moveControlPoint(10, 10, vec2d(-30, -30));
+    grid.setControlPointPosition(0, 3, vec2d(-50, 200));
+    std::vector<vec2d> points;
+    grid.controlPointPositions(points);
+    CHECK(splinesHoldPoints(grid, points));
+    const double spacing = ParametricSurfaceGrid::Spline::min_point_spacing;
+    CHECK(points[4 * 11 + 4].x == 50 - spacing && points[4 * 11 + 4].y == 50 - spacing);
+    CHECK(points[4 * 11 + 5].x == 50 && points[4 * 11 + 5].y == 37);
+    CHECK(points[10 * 11 + 10].x == 90 + spacing && points[10 * 11 + 10].y == 90 + spacing);
+    CHECK(points[3].x == 20 + spacing && points[3].y == 10 - spacing);
+}
+
+// The float grid follows the double one within the rounding error of its map coordinates.
+TEST(floatGridStaysCloseToDouble)
+{
+    ParametricSurfaceGrid grid(vec2d(10, -20), 1024, 768, 64, 64);
+    ParametricSurfaceGridf gridf(vec2f(10, -20), 1024, 768, 64, 64);
+    std::mt19937 random(5);
+    std::uniform_real_distribution<double> offset(-8, 8);
+    for (int row = 1; row < grid.numControlPointsY() - 1; ++row) {
+        for (int col = 1; col < grid.numControlPointsX() - 1; ++col) {
+            vec2d delta(offset(random), offset(random));
+            grid.moveControlPoint(row, col, delta);
+            gridf.moveControlPoint(row, col, vec2f(delta.x, delta.y));
+        }
+    }
+    const SurfacePoints& map = grid.generateSurfacePoints();
+    const SurfacePointsT<float>& mapf = gridf.generateSurfacePoints();
+    CHECK(map.size() == mapf.size());
+    double maxError = 0, sumError = 0;
+    for (size_t i = 0; i < map.size(); ++i) {
+        double error = std::fabs(map[i] - mapf[i]);
+        maxError = std::max(maxError, error);
+        sumError += error;
+    }
+    // float carries 24 bits, about 6e-5 pixel at 1024; the fits and evaluations add a few of those
+    CHECK(maxError < 1e-3);
+    CHECK(sumError / map.size() < 1e-4);
+}
+
+// The bilinear scanline kernel reproduces surfacePoint() exactly, knots included.
+TEST(linearKernelMatchesSurfacePoint)
+{
+    ParametricSurfaceGrid grid(vec2d(-3, 5), 203, 151, 16, 12);
+    editGrid(grid);
+    for (int row = 0; row < grid.numControlPointsY(); ++row) {
+        grid.rowSpline(row).setLinear(true);
+    }
+    for (int col = 0; col < grid.numControlPointsX(); ++col) {
+        grid.colSpline(col).setLinear(true);
+    }
+    CHECK(grid.allSplinesLinear());
+    CHECK(mapMismatches(grid) == 0);
+    grid.setNumThreads(3);
+    CHECK(mapMismatches(grid) == 0);
+
+    // a tile wider than the generation tiles gives the same samples, and no tile allocates
+    const SurfacePoints& map = grid.generateSurfacePoints();
+    int width = grid.pixelWidth();
+    std::vector<double> wide((size_t)width * 9 * 2);
+    size_t before = allocationCount();
+    grid.generateSurfaceTile(0, 40, width, 9, wide.data(), (size_t)width * 2);
+    CHECK(allocationCount() == before);
+    CHECK(std::equal(wide.begin(), wide.end(), map.begin() + (size_t)40 * width * 2));
+
+    grid.rowSpline(2).setLinear(false);
+    CHECK(!grid.allSplinesLinear());
+}
+
+// The axis tables are rebuilt with every layout change, so the map keeps locating pixels like surfacePoint().
+TEST(axisTablesFollowLayoutChanges)
+{
+    ParametricSurfaceGrid grid(vec2d(4, 4), 300, 220, 80, 70);
+    editGrid(grid);
+    CHECK(mapMismatches(grid) == 0);
+    grid.setPixelSize(350, 181);
+    CHECK(mapMismatches(grid) == 0);
+    grid.setGridResolution(100, 90);
+    CHECK(mapMismatches(grid) == 0);
+    grid.setPixelWidth(257);
+    CHECK(mapMismatches(grid) == 0);
+}
+
+template <class T>
+static void checkPatchKernels()
+{
+    for (int resolution : {12, 16, 24, 32, 48, 64}) {
+        ParametricSurfaceGridT<T> grid(vec2<T>(2, -3), 301, 227, resolution, resolution);
+        editGrid(grid);
+        CHECK(mapMismatches(grid) == 0);
+        // stretching and shrinking leave fractional resolutions, and patches one pixel wider or narrower
+        grid.setPixelSize(337, 301);
+        CHECK(mapMismatches(grid) == 0);
+        grid.setPixelSize(290, 200);
+        CHECK(mapMismatches(grid) == 0);
+    }
+}
+
+// Every patch kernel reproduces surfacePoint() exactly, also once a resize leaves the resolution fractional.
+TEST(patchKernelsMatchSurfacePoint)
+{
+    checkPatchKernels<double>();
+    checkPatchKernels<float>();
+}
+
+struct RebuildableGrid : ParametricSurfaceGrid {
+    using ParametricSurfaceGrid::ParametricSurfaceGrid;
+    void rebuild(int resX, int resY) { rebuildGridData(resX, resY); }
+};
+
+static double maxDifference(const SurfacePoints& a, const SurfacePoints& b)
+{
+    double difference = a.size() == b.size() ? 0 : INFINITY;
+    for (size_t i = 0; i < a.size() && i < b.size(); ++i) {
+        difference = std::max(difference, std::fabs(a[i] - b[i]));
+    }
+    return difference;
+}
+
+// Resizing rescales the fits instead of refitting, and refining inserts knots instead of resampling; both give the
+// surface the refit or the resampling would.
+TEST(resizeAndRefineMatchRefitting)
+{
+    ParametricSurfaceGrid grid(vec2d(5, 7), 640, 480, 32, 32);
+    editGrid(grid);
+    grid.moveControlPoint(0, 3, vec2d(-2, 3));
+    std::vector<vec2d> points;
+    grid.controlPointPositions(points);
+    grid.setPixelSize(960, 600);
+    CHECK(grid.gridResolutionX() == 48 && grid.gridResolutionY() == 40);
+    ParametricSurfaceGrid refit(vec2d(5, 7), 960, 600, 48, 40);
+    for (vec2d& point : points) {
+        point.x *= 1.5;
+        point.y *= 1.25;
+    }
+    refit.setControlPointPositions(points);
+    CHECK(maxDifference(grid.generateSurfacePoints(), refit.generateSurfacePoints()) < 1e-9);
+
+    const int cases[][6] = {{640, 480, 32, 32, 16, 8}, {650, 490, 40, 30, 10, 15}, {203, 151, 16, 12, 8, 6}};
+    for (const int* c : cases) {
+        RebuildableGrid refined(vec2d(5, 7), c[0], c[1], c[2], c[3]);
+        editGrid(refined);
+        refined.moveControlPoint(refined.numControlPointsY() - 1, 2, vec2d(1, -4));
+        RebuildableGrid rebuilt = refined;
+        refined.setGridResolution(c[4], c[5]);
+        rebuilt.rebuild(c[4], c[5]);
+        CHECK(refined.numControlPointsX() == rebuilt.numControlPointsX());
+        CHECK(refined.numControlPointsY() == rebuilt.numControlPointsY());
+        CHECK(maxDifference(refined.generateSurfacePoints(), rebuilt.generateSurfacePoints()) < 1e-9);
+    }
+}
+
+// A shrink that would squeeze the knots below their minimum spacing creates a valid grid for the new size instead.
+TEST(shrinkingBelowPointSpacingRecreatesGrid)
+{
+    ParametricSurfaceGrid grid(vec2d(0, 0), 1000, 1000, 10, 10);
+    grid.setPixelSize(100, 100);
+    CHECK(grid.gridResolutionX() >= ParametricSurfaceGrid::minGridResolution);
+    CHECK(grid.gridResolutionY() >= ParametricSurfaceGrid::minGridResolution);
+    std::vector<vec2d> points;
+    grid.controlPointPositions(points);
+    CHECK(splinesHoldPoints(grid, points));
+    for (int row = 0; row < grid.numControlPointsY(); ++row) {
+        for (int col = 0; col + 1 < grid.numControlPointsX(); ++col) {
+            CHECK(points[row * grid.numControlPointsX() + col + 1].x - points[row * grid.numControlPointsX() + col].x >=
+                  ParametricSurfaceGrid::Spline::min_point_spacing);
+        }
+    }
+    grid.moveControlPoint(5, 5, vec2d(0, 0));
+    CHECK(mapMismatches(grid) == 0);
+
+    // a shrink that keeps the spacing still rescales
+    ParametricSurfaceGrid scaled(vec2d(0, 0), 1000, 1000, 40, 40);
+    scaled.setPixelSize(500, 800);
+    CHECK(scaled.gridResolutionX() == 20 && scaled.gridResolutionY() == 32);
+}
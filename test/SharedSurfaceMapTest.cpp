@@ -0,0 +1,109 @@
+#include "../SharedSurfaceMap.h"
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Test.h"
+
+static std::string shmName(const char* name)
+{
+    return std::string("/") + name + "." + std::to_string(getpid());
+}
+
+static bool frameMatches(const SharedSurfaceMapFrame& frame, const SurfacePoints& expected)
+{
+    return std::equal(expected.begin(), expected.end(), frame.data);
+}
+
+// A subscriber in another process sees each publication, with the region it changed.
+TEST(sharedMapReachesForkedSubscriber)
+{
+    std::string name = shmName("shared_map");
+    ParametricSurfaceGrid grid(vec2d(0, 0), 96, 64, 16, 16);
+    SharedSurfaceMapPublisher publisher(name, 96, 64, 3);
+    CHECK(publisher.isOpen());
+    CHECK(publisher.publish(grid) == 1);
+
+    int toChild[2], toParent[2];
+    CHECK(pipe(toChild) == 0 && pipe(toParent) == 0);
+    pid_t pid = fork();
+    if (pid == 0) {
+        // exit codes tell the parent which step failed
+        char byte = 0;
+        ParametricSurfaceGrid expected(vec2d(0, 0), 96, 64, 16, 16);
+        SharedSurfaceMapSubscriber subscriber;
+        SharedSurfaceMapFrame frame;
+        if (!subscriber.open(name) || subscriber.width() != 96 || subscriber.height() != 64) {
+            _exit(1);
+        }
+        if (!subscriber.poll(frame) || frame.sequence != 1 || frame.dirty.width != 96 || frame.dirty.height != 64 ||
+            !frameMatches(frame, expected.generateSurfacePoints()) || !subscriber.isValid(frame)) {
+            _exit(2);
+        }
+        if (write(toParent[1], &byte, 1) != 1 || read(toChild[0], &byte, 1) != 1) {
+            _exit(3);
+        }
+        expected.moveControlPoint(2, 3, vec2d(3, -2));
+        if (!subscriber.poll(frame) || frame.sequence != 2 || frame.dirty.x != 8 || frame.dirty.width != 40 ||
+            !frameMatches(frame, expected.generateSurfacePoints()) || !subscriber.isValid(frame)) {
+            _exit(4);
+        }
+        _exit(subscriber.poll(frame) ? 5 : 0);
+    }
+    CHECK(pid > 0);
+    char byte = 0;
+    CHECK(read(toParent[0], &byte, 1) == 1);
+    grid.moveControlPoint(2, 3, vec2d(3, -2));
+    CHECK(publisher.publish(grid, DirtyRect(8, 0, 40, 64)) == 2);
+    CHECK(write(toChild[1], &byte, 1) == 1);
+    int status = -1;
+    CHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    for (int fd : {toChild[0], toChild[1], toParent[0], toParent[1]}) {
+        close(fd);
+    }
+}
+
+// The header is checked against the size of the shared memory object before any slot is indexed.
+TEST(sharedMapRejectsInconsistentHeader)
+{
+    std::string name = shmName("shared_map_header");
+    SharedSurfaceMapPublisher publisher(name, 64, 48, 2);
+    CHECK(publisher.isOpen());
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    CHECK(fd >= 0);
+    void* mapping = mmap(nullptr, sizeof(SharedSurfaceMapHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    CHECK(mapping != MAP_FAILED);
+    SharedSurfaceMapHeader& header = *static_cast<SharedSurfaceMapHeader*>(mapping);
+    SharedSurfaceMapSubscriber subscriber;
+    CHECK(subscriber.open(name));
+
+    uint32_t numSlots = header.numSlots, width = header.width;
+    uint64_t slotBytes = header.slotBytes, dataOffset = header.dataOffset;
+    for (uint32_t badSlots : {0u, 3u, (uint32_t)SharedSurfaceMapHeader::maxSlots + 1}) {
+        header.numSlots = badSlots;
+        CHECK(!subscriber.open(name));
+    }
+    header.numSlots = numSlots;
+    for (uint64_t badBytes : {slotBytes * 2, (uint64_t)1 << 62, (uint64_t)64 * 48 * 8}) {
+        header.slotBytes = badBytes;
+        CHECK(!subscriber.open(name));
+    }
+    header.slotBytes = slotBytes;
+    for (uint64_t badOffset : {(uint64_t)0, dataOffset + slotBytes, ~(uint64_t)0}) {
+        header.dataOffset = badOffset;
+        CHECK(!subscriber.open(name));
+    }
+    header.dataOffset = dataOffset;
+    header.width = 0x80000000u;
+    CHECK(!subscriber.open(name));
+    header.width = width;
+    CHECK(subscriber.open(name));
+    CHECK(subscriber.width() == 64 && subscriber.height() == 48);
+    munmap(mapping, sizeof(SharedSurfaceMapHeader));
+}
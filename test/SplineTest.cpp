@@ -0,0 +1,64 @@
+#include "../spline.h"
+
+#include <random>
+
+#include "Test.h"
+
+// Refits a mix of spline sizes, with partial groups of lanes and a linear spline among them, once with refit_batch()
+// and once spline by spline, and counts the splines whose values or derivatives differ in any bit.
+template <class T>
+static int batchMismatches(typename tk::basic_spline<T>::bd_type boundary)
+{
+    typedef tk::basic_spline<T> Spline;
+    std::mt19937 random(3);
+    std::uniform_real_distribution<T> step(4, 20), value(-50, 50);
+    std::vector<Spline> batch;
+    for (int s = 0; s < 21; ++s) {
+        int n = s % 3 == 0 ? 7 : 12;
+        std::vector<T> x(n), y(n);
+        x[0] = value(random);
+        y[0] = value(random);
+        for (int i = 1; i < n; ++i) {
+            x[i] = x[i - 1] + step(random);
+            y[i] = value(random);
+        }
+        batch.push_back(Spline(s == 5));
+        batch.back().set_boundary(boundary, s * T(0.1), boundary, s * T(-0.2));
+        batch.back().set_points(x, y);
+        // edited afterwards, so both refits have something to do
+        for (int i = 0; i < n; i += 2) {
+            batch.back().store_point(i, x[i], y[i] + value(random) / 10);
+        }
+    }
+    std::vector<Spline> single = batch;
+    for (Spline& spline : single) {
+        spline.refit();
+    }
+    typename Spline::batch_workspace workspace;
+    Spline::refit_batch(batch.data(), batch.size(), workspace);
+
+    int mismatches = 0;
+    for (size_t s = 0; s < batch.size(); ++s) {
+        std::vector<T> x, y;
+        single[s].getPoints(x, y);
+        bool same = true;
+        // both extrapolations and every segment
+        for (T at = x.front() - 10; at <= x.back() + 10; at += T(0.37)) {
+            same = same && batch[s](at) == single[s](at);
+            for (int order = 1; order <= 3; ++order) {
+                same = same && batch[s].deriv(order, at) == single[s].deriv(order, at);
+            }
+        }
+        mismatches += !same;
+    }
+    return mismatches;
+}
+
+// The interleaved solver gives the coefficients of set_points(), for both boundary conditions.
+TEST(refitBatchMatchesRefit)
+{
+    CHECK(batchMismatches<double>(tk::basic_spline<double>::second_deriv) == 0);
+    CHECK(batchMismatches<double>(tk::basic_spline<double>::first_deriv) == 0);
+    CHECK(batchMismatches<float>(tk::basic_spline<float>::second_deriv) == 0);
+    CHECK(batchMismatches<float>(tk::basic_spline<float>::first_deriv) == 0);
+}
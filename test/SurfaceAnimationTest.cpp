@@ -0,0 +1,78 @@
+#include "../SurfaceAnimation.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "Test.h"
+
+// The pipelined frames are the maps of the sampled control points, delivered in order.
+TEST(animationPipelineMatchesDirectGeneration)
+{
+    ParametricSurfaceGrid prototype(vec2d(1, 2), 120, 90, 15, 15);
+    std::vector<vec2d> start, end;
+    prototype.controlPointPositions(start);
+    end = start;
+    for (size_t i = 0; i < end.size(); ++i) {
+        end[i] = end[i] + vec2d(20, (double)(i % 3) - 1);
+    }
+    SurfaceAnimation animation(SurfaceAnimation::Linear);
+    animation.addKeyframe(0, start);
+    animation.addKeyframe(1, end);
+
+    ParametricSurfaceGrid reference = prototype;
+    SurfaceAnimationPipeline pipeline(prototype, animation);
+    int expectedFrame = 0;
+    int mismatches = 0;
+    pipeline.run(0, 0.25, 5, [&](int frame, const SurfacePoints& map) {
+        CHECK(frame == expectedFrame++);
+        std::vector<vec2d> points;
+        animation.sample(frame * 0.25, points);
+        reference.setControlPointPositions(points);
+        const SurfacePoints& expected = reference.generateSurfacePoints();
+        mismatches += !(map.size() == expected.size() && std::equal(map.begin(), map.end(), expected.begin()));
+    });
+    CHECK(expectedFrame == 5);
+    CHECK(mismatches == 0);
+    CHECK(pipeline.fitStats().frames == 5 && pipeline.consumeStats().frames == 5);
+
+    // the last frame moved every point by 20 pixels
+    std::vector<vec2d> points;
+    reference.controlPointPositions(points);
+    CHECK(points.size() == end.size());
+    double distance = 0;
+    for (size_t i = 0; i < points.size(); ++i) {
+        distance = std::max(distance, std::hypot(points[i].x - end[i].x, points[i].y - end[i].y));
+    }
+    CHECK(distance < 1e-9);
+}
+
+// A consumer that throws stops the pipeline with the exception, and the pipeline runs again afterwards.
+TEST(animationPipelineRethrowsConsumerExceptions)
+{
+    ParametricSurfaceGrid prototype(vec2d(0, 0), 120, 90, 15, 15);
+    std::vector<vec2d> points;
+    prototype.controlPointPositions(points);
+    SurfaceAnimation animation(SurfaceAnimation::Linear);
+    animation.addKeyframe(0, points);
+    animation.addKeyframe(1, points);
+
+    SurfaceAnimationPipeline pipeline(prototype, animation);
+    for (int throwAt : {0, 2, 7}) {
+        int consumed = 0;
+        bool caught = false;
+        try {
+            pipeline.run(0, 0.1, 8, [&](int frame, const SurfacePoints&) {
+                if (frame == throwAt) {
+                    throw std::runtime_error("consumer failed");
+                }
+                consumed++;
+            });
+        } catch (const std::runtime_error&) {
+            caught = true;
+        }
+        CHECK(caught && consumed == throwAt);
+    }
+    int consumed = 0;
+    pipeline.run(0, 0.1, 8, [&](int, const SurfacePoints&) { consumed++; });
+    CHECK(consumed == 8);
+}
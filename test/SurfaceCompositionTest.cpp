@@ -0,0 +1,40 @@
+#include "../SurfaceComposition.h"
+
+#include "Test.h"
+
+// The fused pass gives the map of the first surface fed point by point through the next ones.
+TEST(compositionMatchesChainedSurfaces)
+{
+    ParametricSurfaceGrid lens(vec2d(0, 0), 160, 120, 20, 20);
+    lens.moveControlPoint(2, 3, vec2d(4, -3));
+    ParametricSurfaceGrid keystone(vec2d(-5, 3), 170, 130, 17, 13);
+    keystone.moveControlPoint(4, 5, vec2d(-6, 2));
+    ParametricSurfaceGrid warp(vec2d(2, -1), 150, 140, 25, 20);
+    warp.moveControlPoint(3, 2, vec2d(3, 5));
+    SurfaceComposition composition({&lens, &keystone});
+    composition.addSurface(&warp);
+    CHECK(composition.numSurfaces() == 3);
+
+    const SurfacePoints& first = lens.generateSurfacePoints();
+    std::vector<double> expected(first.begin(), first.end());
+    for (ParametricSurfaceGrid* surface : {&keystone, &warp}) {
+        vec2d origin = surface->pixelOrigin();
+        for (size_t i = 0; i < expected.size(); i += 2) {
+            vec2d point = surface->surfacePoint((expected[i] - origin.x) / surface->pixelWidth(),
+                                                (expected[i + 1] - origin.y) / surface->pixelHeight()) +
+                          origin;
+            expected[i] = point.x;
+            expected[i + 1] = point.y;
+        }
+    }
+
+    for (int numThreads : {1, 3}) {
+        lens.setNumThreads(numThreads);
+        std::vector<double> points;
+        composition.generateSurfacePoints(points);
+        CHECK(points == expected);
+    }
+    vec2d pixel = composition.mapPixel(vec2d(37, 81));
+    size_t index = ((size_t)81 * lens.pixelWidth() + 37) * 2;
+    CHECK(pixel.x == expected[index] && pixel.y == expected[index + 1]);
+}
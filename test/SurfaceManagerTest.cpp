@@ -0,0 +1,115 @@
+#include "../SurfaceManager.h"
+
+#include <thread>
+
+#include "Test.h"
+
+static void dragPoint(ParametricSurfaceGrid& grid, int step)
+{
+    int row = 1 + step % (grid.numControlPointsY() - 2);
+    int col = 1 + (step * 7) % (grid.numControlPointsX() - 2);
+    grid.moveControlPoint(row, col, vec2d(step % 5 - 2, step % 3 - 1));
+}
+
+// Surfaces edited from their own threads while others read them end up with the map of their final grid, and every
+// map a reader sees is complete.
+TEST(managerMapsFollowConcurrentEdits)
+{
+    SurfaceManager manager(3);
+    std::vector<ParametricSurfaceGrid> grids;
+    grids.push_back(ParametricSurfaceGrid(vec2d(0, 0), 640, 480, 32, 32));
+    grids.push_back(ParametricSurfaceGrid(vec2d(-5, 3), 300, 200, 20, 25));
+    grids.push_back(ParametricSurfaceGrid(vec2d(2, 2), 130, 260, 16, 16));
+    // a map the manager must not carry along
+    grids[0].generateSurfacePoints();
+    for (size_t i = 0; i < grids.size(); ++i) {
+        CHECK(manager.addSurface(grids[i], (int)i) == (int)i);
+    }
+    CHECK(manager.numSurfaces() == 3);
+
+    std::vector<size_t> sizes;
+    for (ParametricSurfaceGrid& grid : grids) {
+        sizes.push_back((size_t)grid.pixelWidth() * grid.pixelHeight() * 2);
+    }
+    const int numEdits = 40;
+    std::atomic<bool> editing(true);
+    std::atomic<int> badReads(0);
+    std::vector<std::thread> threads;
+    for (int id = 0; id < 3; ++id) {
+        threads.emplace_back([&, id]() {
+            for (int step = 0; step < numEdits; ++step) {
+                manager.edit(id, [step](ParametricSurfaceGrid& grid) { dragPoint(grid, step); }, step % 2 ? 5 : 0);
+                dragPoint(grids[id], step);
+                if (step % 8 == 0) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+        });
+    }
+    for (int reader = 0; reader < 2; ++reader) {
+        threads.emplace_back([&]() {
+            std::vector<uint64_t> last(3, 0);
+            while (editing) {
+                for (int id = 0; id < 3; ++id) {
+                    uint64_t sequence = manager.readMap(id, [&](const SurfacePoints& map, uint64_t sequence) {
+                        badReads += map.size() != sizes[id] || sequence < last[id];
+                    });
+                    badReads += sequence < last[id];
+                    last[id] = sequence;
+                }
+            }
+        });
+    }
+    for (int id = 0; id < 3; ++id) {
+        threads[id].join();
+    }
+    manager.waitIdle();
+    editing = false;
+    for (size_t i = 3; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    CHECK(badReads == 0);
+
+    uint64_t maps = 0;
+    for (int id = 0; id < 3; ++id) {
+        uint64_t sequence = manager.readMap(id, [&](const SurfacePoints& map, uint64_t) {
+            const SurfacePoints& expected = grids[id].generateSurfacePoints();
+            CHECK(map.size() == expected.size() && std::equal(map.begin(), map.end(), expected.begin()));
+        });
+        // the first map plus one per edit that did not join a pending regeneration
+        SurfaceLatencyStats latency = manager.latencyStats(id);
+        CHECK(sequence == (uint64_t)latency.maps);
+        CHECK(latency.maps + latency.coalescedEdits == numEdits + 1);
+        maps += sequence;
+    }
+    SurfaceManagerStats stats = manager.stats();
+    CHECK(stats.maps == maps);
+    CHECK(stats.pixels == (uint64_t)manager.latencyStats(0).maps * 640 * 480 +
+                              (uint64_t)manager.latencyStats(1).maps * 300 * 200 +
+                              (uint64_t)manager.latencyStats(2).maps * 130 * 260);
+}
+
+// Edits arriving faster than a large map regenerates share regenerations.
+TEST(managerCoalescesEdits)
+{
+    SurfaceManager manager(2);
+    ParametricSurfaceGrid grid(vec2d(0, 0), 2000, 1500, 50, 50);
+    int id = manager.addSurface(grid);
+    const int numEdits = 200;
+    for (int step = 0; step < numEdits; ++step) {
+        manager.edit(id, [step](ParametricSurfaceGrid& grid) { dragPoint(grid, step); });
+        dragPoint(grid, step);
+    }
+    manager.waitIdle();
+    SurfaceLatencyStats latency = manager.latencyStats(id);
+    CHECK(latency.coalescedEdits > 0);
+    CHECK(latency.maps + latency.coalescedEdits == numEdits + 1);
+    CHECK(manager.mapSequence(id) == (uint64_t)latency.maps);
+    manager.readMap(id, [&](const SurfacePoints& map, uint64_t) {
+        const SurfacePoints& expected = grid.generateSurfacePoints();
+        CHECK(std::equal(map.begin(), map.end(), expected.begin(), expected.end()));
+    });
+
+    manager.resetStats();
+    CHECK(manager.latencyStats(id).maps == 0 && manager.stats().maps == 0);
+}
@@ -0,0 +1,65 @@
+#include "../SurfaceMapCache.h"
+
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "Test.h"
+
+static std::string tempDirectory(const char* name)
+{
+    std::string path = std::string("/tmp/") + name + "." + std::to_string(getpid());
+    mkdir(path.c_str(), 0755);
+    return path;
+}
+
+// Toggling between states restores their maps, from memory or from the spill files, and never hands out another
+// state's map.
+TEST(mapCacheRestoresToggledStates)
+{
+    SurfaceMapCacheOptions options;
+    options.spillDirectory = tempDirectory("map_cache");
+    // room for one 120x80 map in memory
+    options.memoryBudget = 120 * 80 * 2 * sizeof(double) + 100;
+    SurfaceMapCache cache(options);
+    ParametricSurfaceGrid grid(vec2d(0, 0), 120, 80, 20, 20);
+    std::vector<std::vector<double>> expected;
+    for (int state = 0; state < 3; ++state) {
+        grid.setControlPointPosition(2, 2, vec2d(40 + state, 40 - state));
+        const SurfacePoints& map = cache.generateSurfacePoints(grid);
+        expected.push_back(std::vector<double>(map.begin(), map.end()));
+        CHECK(cache.contains(grid));
+    }
+    CHECK(cache.stats().misses == 3 && cache.stats().spills == 2 && cache.stats().evictions == 2);
+    CHECK(cache.stats().memoryBytes == 120 * 80 * 2 * sizeof(double));
+
+    for (int state : {0, 2, 1, 1}) {
+        grid.setControlPointPosition(2, 2, vec2d(40 + state, 40 - state));
+        const SurfacePoints& map = cache.generateSurfacePoints(grid);
+        CHECK(std::vector<double>(map.begin(), map.end()) == expected[state]);
+    }
+    CHECK(cache.stats().misses == 3 && cache.stats().diskHits == 3 && cache.stats().hits == 1);
+
+    grid.setControlPointPosition(2, 2, vec2d(39, 39));
+    CHECK(!cache.contains(grid));
+    cache.clear();
+    CHECK(cache.stats().memoryBytes == 0 && cache.stats().diskBytes == 0);
+    rmdir(options.spillDirectory.c_str());
+}
+
+// Any part of the state, not only what the revisions track, selects another map.
+TEST(mapCacheMissesChangedState)
+{
+    SurfaceMapCache cache;
+    ParametricSurfaceGrid grid(vec2d(0, 0), 64, 48, 16, 16);
+    cache.generateSurfacePoints(grid);
+    CHECK(cache.contains(grid));
+    // directly edited splines are not part of the revision tracking, but they are part of the state
+    grid.rowSpline(1).setLinear(true);
+    CHECK(!cache.contains(grid));
+    SurfacePoints points;
+    CHECK(!cache.find(grid, points));
+    grid.rowSpline(1).setLinear(false);
+    CHECK(cache.find(grid, points));
+}
+
@@ -0,0 +1,90 @@
+#include "Test.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct RegisteredTest {
+    const char* name;
+    TestFunction function;
+};
+
+std::vector<RegisteredTest>& registry()
+{
+    static std::vector<RegisteredTest> tests;
+    return tests;
+}
+
+int failures = 0;
+std::atomic<size_t> allocations(0);
+
+} // namespace
+
+TestRegistrar::TestRegistrar(const char* name, TestFunction function)
+{
+    registry().push_back(RegisteredTest{name, function});
+}
+
+void testFailed(const char* file, int line, const char* expression)
+{
+    printf("  FAILED %s:%d: %s\n", file, line, expression);
+    failures++;
+}
+
+int runTests(const char* filter)
+{
+    int before = failures;
+    int run = 0;
+    for (const RegisteredTest& test : registry()) {
+        if (filter && !strstr(test.name, filter)) {
+            continue;
+        }
+        int failed = failures;
+        test.function();
+        printf("%s %s\n", failures == failed ? "ok    " : "FAILED", test.name);
+        run++;
+    }
+    printf("%d tests, %d failed checks\n", run, failures - before);
+    return failures - before;
+}
+
+size_t allocationCount()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+// std::stable_sort and other temporary buffers allocate with the nothrow form and free with the plain delete above
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    free(p);
+}
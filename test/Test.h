@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+
+// Minimal test registry for the programs in test/. A TEST registers a function that main() runs; CHECK records a
+// failure with its location and lets the test go on, so one run reports every broken expectation.
+typedef void (*TestFunction)();
+
+struct TestRegistrar {
+    TestRegistrar(const char* name, TestFunction function);
+};
+
+// Runs every registered test whose name contains filter, all of them for a null filter. Returns the number of failed
+// checks.
+int runTests(const char* filter = nullptr);
+void testFailed(const char* file, int line, const char* expression);
+// Allocations made through the global operator new since the program started, to check that hot paths do not allocate.
+size_t allocationCount();
+
+#define TEST(name)                                                                                                     \
+    static void name();                                                                                                \
+    static TestRegistrar name##Registrar(#name, name);                                                                 \
+    static void name()
+
+#define CHECK(expression)                                                                                              \
+    do {                                                                                                               \
+        if (!(expression)) {                                                                                           \
+            testFailed(__FILE__, __LINE__, #expression);                                                               \
+        }                                                                                                              \
+    } while (0)
+
+#define CHECK_NEAR(a, b, tolerance) CHECK(std::fabs((double)(a) - (double)(b)) <= (tolerance))
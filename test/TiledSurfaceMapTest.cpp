@@ -0,0 +1,124 @@
+#include "../TiledSurfaceMap.h"
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include <unistd.h>
+
+#include "Test.h"
+
+static std::string tempPath(const char* name)
+{
+    return std::string("/tmp/") + name + "." + std::to_string(getpid());
+}
+
+static bool matchesGrid(const TiledSurfaceMap& map, ParametricSurfaceGrid& grid)
+{
+    const SurfacePoints& points = grid.generateSurfacePoints();
+    for (int y = 0; y < grid.pixelHeight(); ++y) {
+        for (int x = 0; x < grid.pixelWidth(); ++x) {
+            vec2d p = map.at(x, y);
+            size_t index = ((size_t)y * grid.pixelWidth() + x) * 2;
+            if (p.x != points[index] || p.y != points[index + 1]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+TEST(tiledMapMatchesAndResumes)
+{
+    ParametricSurfaceGrid grid(vec2d(2, 3), 300, 200, 20, 20);
+    grid.moveControlPoint(3, 4, vec2d(5, -4));
+    std::string path = tempPath("tiled_map");
+    TiledSurfaceMapOptions options;
+    options.tileWidth = 64;
+    options.tileHeight = 48;
+    options.numThreads = 2;
+    CHECK(TiledSurfaceMap::generate(grid, path, options) == 5 * 5);
+    // everything completed, nothing left to resume
+    CHECK(TiledSurfaceMap::generate(grid, path, options) == 0);
+    TiledSurfaceMap map;
+    CHECK(map.open(path));
+    CHECK(map.isComplete());
+    CHECK(matchesGrid(map, grid));
+    map.close();
+    unlink(path.c_str());
+}
+
+// Copies the file at from to to, with value written over the bytes at offset.
+template <class T>
+static void writeCorrupted(const std::string& from, const std::string& to, size_t offset, T value)
+{
+    std::ifstream in(from, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::memcpy(&bytes[offset], &value, sizeof(value));
+    std::ofstream(to, std::ios::binary).write(bytes.data(), bytes.size());
+}
+
+// A header or index entry other than the one generate() writes is rejected, so no tile points outside the file, and
+// generating over a damaged index starts over.
+TEST(tiledMapRejectsCorruptLayout)
+{
+    ParametricSurfaceGrid grid(vec2d(0, 0), 300, 200, 20, 20);
+    std::string path = tempPath("tiled_map_layout"), corrupt = tempPath("tiled_map_corrupt");
+    TiledSurfaceMapOptions options;
+    options.tileWidth = 64;
+    options.tileHeight = 48;
+    CHECK(TiledSurfaceMap::generate(grid, path, options) == 5 * 5);
+    TiledSurfaceMap map;
+    const size_t tile = sizeof(TiledSurfaceMapHeader) + 7 * sizeof(TiledSurfaceMapTile);
+    writeCorrupted(path, corrupt, tile + offsetof(TiledSurfaceMapTile, offset), uint64_t(1) << 40);
+    CHECK(!map.open(corrupt));
+    writeCorrupted(path, corrupt, tile + offsetof(TiledSurfaceMapTile, width), uint32_t(65));
+    CHECK(!map.open(corrupt));
+    writeCorrupted(path, corrupt, tile + offsetof(TiledSurfaceMapTile, completed), uint32_t(2));
+    CHECK(!map.open(corrupt));
+    writeCorrupted(path, corrupt, offsetof(TiledSurfaceMapHeader, tilesX), uint32_t(6));
+    CHECK(!map.open(corrupt));
+    writeCorrupted(path, corrupt, offsetof(TiledSurfaceMapHeader, tileWidth), uint32_t(0));
+    CHECK(!map.open(corrupt));
+    // tile sizes whose byte count overflows
+    writeCorrupted(path, corrupt, offsetof(TiledSurfaceMapHeader, tileWidth), uint32_t(0xffffffff));
+    CHECK(!map.open(corrupt));
+    writeCorrupted(path, corrupt, offsetof(TiledSurfaceMapHeader, tileBytes), uint64_t(1) << 62);
+    CHECK(!map.open(corrupt));
+    writeCorrupted(path, corrupt, offsetof(TiledSurfaceMapHeader, width), uint64_t(1) << 40);
+    CHECK(!map.open(corrupt));
+    CHECK(!map.isOpen());
+
+    writeCorrupted(path, corrupt, tile + offsetof(TiledSurfaceMapTile, offset), uint64_t(1) << 40);
+    CHECK(TiledSurfaceMap::generate(grid, corrupt, options) == 5 * 5);
+    CHECK(map.open(corrupt));
+    CHECK(map.isComplete());
+    CHECK(matchesGrid(map, grid));
+    map.close();
+    unlink(corrupt.c_str());
+    unlink(path.c_str());
+}
+
+TEST(tiledMapShrinksTilesToBudget)
+{
+    ParametricSurfaceGrid grid(vec2d(0, 0), 300, 200, 20, 20);
+    std::string path = tempPath("tiled_map_budget");
+    TiledSurfaceMapOptions options;
+    options.tileWidth = 1024;
+    options.tileHeight = 1024;
+    options.memoryBudget = 64 * 1024;
+    CHECK(TiledSurfaceMap::generate(grid, path, options) > 0);
+    TiledSurfaceMap map;
+    CHECK(map.open(path));
+    CHECK((size_t)map.tileWidth() * map.tileHeight() * 2 * sizeof(double) <= options.memoryBudget);
+    CHECK(map.isComplete());
+    CHECK(matchesGrid(map, grid));
+    map.close();
+
+    // no room for a single page
+    options.memoryBudget = 16;
+    CHECK(TiledSurfaceMap::generate(grid, path, options) == -1);
+    unlink(path.c_str());
+    CHECK(TiledSurfaceMap::generate(grid, "/nonexistent/dir/map", options) == -1);
+}
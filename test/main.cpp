@@ -1,15 +1,27 @@
 #include "../ParametricSurfaceGrid.h"
 
 #include "../vec2.h"
+#include "Test.h"
 #include <iostream>
 
 
-int main() {
+// Build with the library sources and every file in test/, e.g.
+//   g++ -std=c++17 -O2 -I. test/*.cpp *.cpp -pthread -o surface_tests
+// and run, optionally with a substring of the test names to run. Also worth running built with
+// -fsanitize=address,undefined and, for the threaded tests, -fsanitize=thread.
+int main(int argc, char** argv) {
 
     ParametricSurfaceGrid* grid = new ParametricSurfaceGrid(vec2d(0,0), 100, 100, 10, 10);
 
     vec2d point = grid->surfacePoint(0.5,0.5) ;
     std::cout << point.x << ", " << point.y << std::endl;
 
-    return 0;
+    ParametricSurfaceGridf* gridf = new ParametricSurfaceGridf(vec2f(0,0), 100, 100, 10, 10);
+
+    vec2f pointf = gridf->surfacePoint(0.5f,0.5f) ;
+    std::cout << pointf.x << ", " << pointf.y << std::endl;
+
+    delete grid;
+    delete gridf;
+    return runTests(argc > 1 ? argv[1] : nullptr) == 0 ? 0 : 1;
 }